@@ -0,0 +1,32 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+/* C89 has no memory model, so wrap the GCC/Clang __atomic builtins. */
+
+#define ATOMIC_LOAD(PTR)         __atomic_load_n((PTR), __ATOMIC_SEQ_CST)
+#define ATOMIC_LOAD_ACQUIRE(PTR) __atomic_load_n((PTR), __ATOMIC_ACQUIRE)
+#define ATOMIC_LOAD_RELAXED(PTR) __atomic_load_n((PTR), __ATOMIC_RELAXED)
+
+#define ATOMIC_STORE(PTR, VAL)                                                \
+    __atomic_store_n((PTR), (VAL), __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE_RELEASE(PTR, VAL)                                        \
+    __atomic_store_n((PTR), (VAL), __ATOMIC_RELEASE)
+#define ATOMIC_STORE_RELAXED(PTR, VAL)                                        \
+    __atomic_store_n((PTR), (VAL), __ATOMIC_RELAXED)
+
+#define ATOMIC_FETCH_ADD(PTR, VAL)                                            \
+    __atomic_fetch_add((PTR), (VAL), __ATOMIC_SEQ_CST)
+#define ATOMIC_FETCH_SUB(PTR, VAL)                                            \
+    __atomic_fetch_sub((PTR), (VAL), __ATOMIC_SEQ_CST)
+
+/* Evaluates to non-zero on success. On failure *EXPECTED_PTR is updated with
+   the current value. */
+#define ATOMIC_CAS(PTR, EXPECTED_PTR, DESIRED)                                \
+    __atomic_compare_exchange_n((PTR), (EXPECTED_PTR), (DESIRED), 0,          \
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+#define ATOMIC_FENCE()         __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define ATOMIC_FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define ATOMIC_FENCE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+#endif
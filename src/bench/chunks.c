@@ -0,0 +1,293 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "macros.h"
+#include "codec.h"
+#include "client/terrain.h"
+#include "client/light.h"
+#include "client/mesher.h"
+
+/* Blocks followed by light, as stored in region files. */
+#define PAYLOAD_SIZE (2 * CHUNK_TOTAL)
+
+/* The volume's x and z are picked from the seed within this many chunks of
+   the origin. */
+#define ORIGIN_RANGE 1024
+
+enum stage {
+    STAGE_GENERATE,
+    STAGE_LIGHT,
+    STAGE_GATHER,
+    STAGE_MESH,
+    STAGE_MESH_AO,
+    STAGE_ENCODE,
+    STAGE_DECODE,
+    STAGE_COUNT
+};
+
+static const char *const stage_names[STAGE_COUNT] = {
+    "generate", "light", "gather", "mesh", "mesh_ao", "encode", "decode",
+};
+
+struct stage_stats {
+    double ns;
+    unsigned long allocations;
+};
+
+/* Heap allocations made by the code under test are counted by wrapping the
+   allocator at link time, see CMakeLists.txt. */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t count, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+static unsigned long allocations;
+
+void *__wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+static double elapsed_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+/* Timing and allocation count of one stage run. */
+static double stage_start;
+static unsigned long stage_allocations;
+
+static void begin_stage(void) {
+    stage_allocations = allocations;
+    stage_start       = elapsed_ns();
+}
+
+static void end_stage(struct stage_stats *stats) {
+    stats->ns += elapsed_ns() - stage_start;
+    stats->allocations += allocations - stage_allocations;
+}
+
+static void *alloc(size_t size) {
+    void *ptr = calloc(1, size);
+
+    if (!ptr) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    return ptr;
+}
+
+int main(int argc, char **argv) {
+    static unsigned char padded_blocks[CHUNK_PADDED_TOTAL];
+    static unsigned char padded_light[CHUNK_PADDED_TOTAL];
+    static unsigned char payload[PAYLOAD_SIZE];
+    static unsigned char encoded[CODEC_BOUND(PAYLOAD_SIZE)];
+    static unsigned char decoded[PAYLOAD_SIZE];
+    static unsigned char borders[6][LIGHT_BORDER_TOTAL];
+
+    struct stage_stats stats[STAGE_COUNT];
+    struct chunk_mesh *mesh;
+    unsigned char *blocks;
+    unsigned char *light;
+    struct coord origin;
+    size_t vertices[2] = {0, 0};
+    size_t encoded_total = 0;
+    unsigned int seed    = 1;
+    int chunks           = 512;
+    int side;
+    int total;
+    int i;
+
+    if (argc >= 2) {
+        chunks = atoi(argv[1]);
+    }
+
+    if (argc >= 3) {
+        seed = (unsigned int)atoi(argv[2]);
+    }
+
+    /* Chunks are benchmarked as a cube so they have neighbors to gather. */
+    chunks = MAX(chunks, 1);
+    side   = 1;
+    while (side * side * side < chunks) {
+        side++;
+    }
+    total = side * side * side;
+
+    /* Centered on the terrain surface, around block y 0. */
+    srand(seed);
+    origin.x = rand() % (2 * ORIGIN_RANGE) - ORIGIN_RANGE;
+    origin.y = -side / 2;
+    origin.z = rand() % (2 * ORIGIN_RANGE) - ORIGIN_RANGE;
+
+    blocks = alloc((size_t)total * CHUNK_TOTAL);
+    light  = alloc((size_t)total * CHUNK_TOTAL);
+    mesh   = alloc(sizeof(struct chunk_mesh));
+
+    memset(stats, 0, sizeof(stats));
+
+    printf("%d chunks (%d wide cube), seed %u.\r\n", total, side, seed);
+
+    /* Generate. */
+
+    for (i = 0; i < total; i++) {
+        struct coord coord;
+
+        coord.x = origin.x + i % side;
+        coord.y = origin.y + i / side % side;
+        coord.z = origin.z + i / (side * side);
+
+        begin_stage();
+        terrain_generate(blocks + (size_t)i * CHUNK_TOTAL, &coord, seed);
+        end_stage(&stats[STAGE_GENERATE]);
+    }
+
+    /* Light in order, each chunk from the borders of those lit before. */
+
+    for (i = 0; i < total; i++) {
+        const unsigned char *border_ptrs[6];
+        int coords[3];
+        int face;
+
+        coords[0] = i % side;
+        coords[1] = i / side % side;
+        coords[2] = i / (side * side);
+
+        for (face = 0; face < 6; face++) {
+            int axis = face / 2;
+            int step = (face & 1) ? -1 : 1;
+            int neighbor;
+
+            border_ptrs[face] = NULL;
+
+            /* Only neighbors in negative directions are lit already. */
+            if (step > 0 || coords[axis] == 0) {
+                continue;
+            }
+
+            neighbor = i - (axis == 0 ? 1 : axis == 1 ? side : side * side);
+            light_border(light + (size_t)neighbor * CHUNK_TOTAL, face ^ 1,
+                         borders[face]);
+            border_ptrs[face] = borders[face];
+        }
+
+        begin_stage();
+        light_compute(blocks + (size_t)i * CHUNK_TOTAL, border_ptrs,
+                      light + (size_t)i * CHUNK_TOTAL);
+        end_stage(&stats[STAGE_LIGHT]);
+    }
+
+    /* Gather, mesh and compress each chunk. */
+
+    for (i = 0; i < total; i++) {
+        const unsigned char *block_ptrs[27];
+        const unsigned char *light_ptrs[27];
+        struct coord coord;
+        size_t size;
+        int j;
+
+        coord.x = i % side;
+        coord.y = i / side % side;
+        coord.z = i / (side * side);
+
+        for (j = 0; j < 27; j++) {
+            int x = coord.x + j % 3 - 1;
+            int y = coord.y + j / 3 % 3 - 1;
+            int z = coord.z + j / 9 - 1;
+            size_t offset;
+
+            if (x < 0 || x >= side || y < 0 || y >= side || z < 0 ||
+                z >= side) {
+                block_ptrs[j] = NULL;
+                light_ptrs[j] = NULL;
+                continue;
+            }
+
+            offset        = (size_t)INDEX_3D(x, y, z, side) * CHUNK_TOTAL;
+            block_ptrs[j] = blocks + offset;
+            light_ptrs[j] = light + offset;
+        }
+
+        coord.x += origin.x;
+        coord.y += origin.y;
+        coord.z += origin.z;
+
+        begin_stage();
+        mesher_gather(block_ptrs, light_ptrs, padded_blocks, padded_light);
+        end_stage(&stats[STAGE_GATHER]);
+
+        begin_stage();
+        mesher_build(padded_blocks, padded_light, &coord, 0, mesh);
+        end_stage(&stats[STAGE_MESH]);
+        vertices[0] += mesh->vertex_count;
+
+        begin_stage();
+        mesher_build(padded_blocks, padded_light, &coord, MESHER_AO, mesh);
+        end_stage(&stats[STAGE_MESH_AO]);
+        vertices[1] += mesh->vertex_count;
+
+        memcpy(payload, block_ptrs[13], CHUNK_TOTAL);
+        memcpy(payload + CHUNK_TOTAL, light_ptrs[13], CHUNK_TOTAL);
+
+        begin_stage();
+        size = codec_encode(payload, PAYLOAD_SIZE, encoded, sizeof(encoded));
+        end_stage(&stats[STAGE_ENCODE]);
+        encoded_total += size;
+
+        begin_stage();
+        if (codec_decode(encoded, size, decoded, sizeof(decoded)) !=
+            PAYLOAD_SIZE) {
+            printf("Chunk %d failed to decode.\r\n", i);
+            return EXIT_FAILURE;
+        }
+        end_stage(&stats[STAGE_DECODE]);
+
+        if (memcmp(payload, decoded, PAYLOAD_SIZE) != 0) {
+            printf("Chunk %d did not round-trip.\r\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%-10s %12s %14s\r\n", "stage", "ns/chunk", "allocs/chunk");
+
+    for (i = 0; i < STAGE_COUNT; i++) {
+        printf("%-10s %12.0f %14.2f", stage_names[i], stats[i].ns / total,
+               (double)stats[i].allocations / total);
+
+        if (i == STAGE_MESH || i == STAGE_MESH_AO) {
+            printf("   %.0f vertices/chunk",
+                   (double)vertices[i - STAGE_MESH] / total);
+        } else if (i == STAGE_ENCODE) {
+            printf("   ratio %.1f",
+                   (double)PAYLOAD_SIZE * total / (double)encoded_total);
+        }
+
+        printf("\r\n");
+    }
+
+    free(mesh);
+    free(light);
+    free(blocks);
+
+    return EXIT_SUCCESS;
+}
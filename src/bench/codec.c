@@ -0,0 +1,224 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "macros.h"
+#include "codec.h"
+
+/* Blocks followed by light, as stored in region files. */
+#define PAYLOAD_SIZE 8192
+
+/* Decoding is repeated to get a measurable duration. */
+#define DECODE_REPEATS 16
+
+struct sample {
+    const char *name;
+    void (*fill)(unsigned char *payload);
+};
+
+static double elapsed_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+static void fill_air(unsigned char *payload) {
+    memset(payload, 0, PAYLOAD_SIZE);
+}
+
+/* Stone below a wavy grass surface with scattered ores and caves, and sky
+   light above the surface. */
+static void fill_terrain(unsigned char *payload) {
+    int surface = 4 + rand() % 8;
+    int x;
+    int y;
+    int z;
+
+    for (z = 0; z < 16; z++) {
+        for (y = 0; y < 16; y++) {
+            for (x = 0; x < 16; x++) {
+                int i      = INDEX_3D(x, y, z, 16);
+                int height = surface + (x + z) / 8;
+                unsigned char block;
+
+                if (y < height) {
+                    block = (rand() % 32 == 0) ? 4 : 3;
+                    block = (rand() % 64 == 0) ? 0 : block;
+                } else if (y == height) {
+                    block = 2;
+                } else {
+                    block = 0;
+                }
+
+                payload[i]        = block;
+                payload[4096 + i] = (unsigned char)((y > height) ? 0xF0 : 0);
+            }
+        }
+    }
+}
+
+/* Worst case: every byte independent. */
+static void fill_noise(unsigned char *payload) {
+    int i;
+
+    for (i = 0; i < PAYLOAD_SIZE; i++) {
+        payload[i] = (unsigned char)rand();
+    }
+}
+
+static const struct sample samples[] = {
+    {"air", fill_air},
+    {"terrain", fill_terrain},
+    {"noise", fill_noise},
+};
+
+/* SIZE bytes that codec_decode must reject when decoding into CAP. */
+struct malformed {
+    const char *name;
+    unsigned char src[8];
+    size_t size;
+    size_t cap;
+};
+
+static const struct malformed malformed[] = {
+    {"palette too long", {17}, 1, 64},
+    {"truncated palette", {3, 1}, 2, 64},
+    {"truncated literals", {0, 0x05, 'a', 'b'}, 4, 64},
+    {"truncated packed literals", {2, 1, 2, 0x05, 0x10}, 5, 64},
+    {"truncated run", {0, 0x40}, 2, 64},
+    {"truncated long run", {0, 0x7F, 0x10, 0x00}, 4, 64},
+    {"truncated match", {0, 0x00, 'a', 0x80, 0x01}, 5, 64},
+    {"match before start", {0, 0x00, 'a', 0x80, 0x02, 0x00}, 6, 64},
+    {"match of offset 0", {0, 0x00, 'a', 0x80, 0x00, 0x00}, 6, 64},
+    {"oversize run", {0, 0x7F, 0xFF, 0xFF, 'a'}, 5, PAYLOAD_SIZE},
+    {"oversize literals", {0, 0x03, 'a', 'b', 'c', 'd'}, 6, 3},
+    {"oversize match", {0, 0x00, 'a', 0x40, 'a', 0xFF, 0x01, 0x00}, 8, 64},
+};
+
+/* Returns FALSE if any malformed input decodes. */
+static int check_malformed(void) {
+    unsigned char decoded[PAYLOAD_SIZE];
+    int is_ok = TRUE;
+    size_t i;
+
+    for (i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++) {
+        const struct malformed *m = &malformed[i];
+
+        if (codec_decode(m->src, m->size, decoded, m->cap) != 0) {
+            printf("%s: decoded.\r\n", m->name);
+            is_ok = FALSE;
+        }
+    }
+
+    return is_ok;
+}
+
+/* Returns FALSE if the SIZE bytes at ENCODED, a whole payload, decode into
+   a buffer one byte short, or if any part of them decodes to all of it. */
+static int check_bounds(const char *name, const unsigned char *encoded,
+                        size_t size) {
+    static unsigned char decoded[PAYLOAD_SIZE];
+    size_t cut;
+
+    if (codec_decode(encoded, size, decoded, PAYLOAD_SIZE - 1) != 0) {
+        printf("%s: decoded into a short buffer.\r\n", name);
+        return FALSE;
+    }
+
+    for (cut = 0; cut < size; cut++) {
+        if (codec_decode(encoded, cut, decoded, PAYLOAD_SIZE) ==
+            PAYLOAD_SIZE) {
+            printf("%s: decoded whole from %lu of %lu bytes.\r\n", name,
+                   (unsigned long)cut, (unsigned long)size);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+int main(int argc, char **argv) {
+    static unsigned char payload[PAYLOAD_SIZE];
+    static unsigned char encoded[CODEC_BOUND(PAYLOAD_SIZE)];
+    static unsigned char decoded[PAYLOAD_SIZE];
+
+    int chunks = 1000;
+    unsigned int seed = 1;
+    size_t s;
+
+    if (argc >= 2) {
+        chunks = atoi(argv[1]);
+    }
+
+    if (argc >= 3) {
+        seed = (unsigned int)atoi(argv[2]);
+    }
+
+    chunks = MAX(chunks, 1);
+
+    if (!check_malformed()) {
+        return EXIT_FAILURE;
+    }
+
+    printf("%d chunks per sample, seed %u.\r\n", chunks, seed);
+    printf("%-8s %8s %12s %12s %10s\r\n", "sample", "ratio", "encode ns",
+           "decode ns", "decode GB/s");
+
+    for (s = 0; s < sizeof(samples) / sizeof(samples[0]); s++) {
+        double encode_ns = 0.0;
+        double decode_ns = 0.0;
+        size_t total     = 0;
+        int i;
+
+        srand(seed);
+
+        for (i = 0; i < chunks; i++) {
+            double start;
+            size_t size;
+            int r;
+
+            samples[s].fill(payload);
+
+            start = elapsed_ns();
+            size  = codec_encode(payload, PAYLOAD_SIZE, encoded,
+                                 sizeof(encoded));
+            encode_ns += elapsed_ns() - start;
+
+            start = elapsed_ns();
+            for (r = 0; r < DECODE_REPEATS; r++) {
+                if (codec_decode(encoded, size, decoded, sizeof(decoded)) !=
+                    PAYLOAD_SIZE) {
+                    printf("%s: chunk %d failed to decode.\r\n",
+                           samples[s].name, i);
+                    return EXIT_FAILURE;
+                }
+            }
+            decode_ns += (elapsed_ns() - start) / DECODE_REPEATS;
+
+            if (memcmp(payload, decoded, PAYLOAD_SIZE) != 0) {
+                printf("%s: chunk %d did not round-trip.\r\n",
+                       samples[s].name, i);
+                return EXIT_FAILURE;
+            }
+
+            /* Truncations of the first chunk, outside the timing. */
+            if (i == 0 && !check_bounds(samples[s].name, encoded, size)) {
+                return EXIT_FAILURE;
+            }
+
+            total += size;
+        }
+
+        printf("%-8s %8.1f %12.0f %12.0f %10.2f\r\n", samples[s].name,
+               (double)PAYLOAD_SIZE * chunks / (double)total,
+               encode_ns / chunks, decode_ns / chunks,
+               (double)PAYLOAD_SIZE * chunks / decode_ns);
+    }
+
+    return EXIT_SUCCESS;
+}
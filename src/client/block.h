@@ -0,0 +1,19 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#define BLOCK_AIR         0
+#define BLOCK_DIRT        1
+#define BLOCK_GRASS_BLOCK 2
+#define BLOCK_STONE       3
+#define BLOCK_COBBLESTONE 4
+#define BLOCK_BEDROCK     5
+#define BLOCK_GLOWSTONE   6
+
+#define CHUNK_SIZE  16
+#define CHUNK_TOTAL (CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE)
+
+/* Chunk with a one block border from its neighbors, for meshing. */
+#define CHUNK_PADDED       (CHUNK_SIZE + 2)
+#define CHUNK_PADDED_TOTAL (CHUNK_PADDED * CHUNK_PADDED * CHUNK_PADDED)
+
+#endif
@@ -42,7 +42,6 @@ void camera_update(struct camera *camera, const struct window *window,
                    float delta_time) {
     float speed;
     float yaw_rad;
-    float pitch_rad;
     struct vector3 forward;
     struct vector3 right;
     float look_speed;
@@ -55,14 +54,9 @@ void camera_update(struct camera *camera, const struct window *window,
 
     speed = 40.0f * delta_time;
 
-    yaw_rad   = camera->yaw * (float)PI / 180.0f;
-    pitch_rad = camera->pitch * (float)PI / 180.0f;
+    yaw_rad = camera->yaw * (float)PI / 180.0f;
 
-    forward.VEC_X =
-        (float)cos((double)pitch_rad) * (float)sin((double)yaw_rad);
-    forward.VEC_Y = (float)sin((double)pitch_rad);
-    forward.VEC_Z =
-        (float)cos((double)pitch_rad) * (float)cos((double)yaw_rad);
+    forward = camera_forward(camera);
 
     right.VEC_X = (float)sin((double)(yaw_rad - (float)PI_2));
     right.VEC_Y = 0.0f;
@@ -115,12 +109,38 @@ void camera_update(struct camera *camera, const struct window *window,
         camera->pitch = -MAX_PITCH;
     }
 
-    eye_pos = camera->pos;
-    center  = vector3_add(&camera->pos, &forward);
-
-    /* Position camera at player eye height. */
-    eye_pos.VEC_Y += PLAYER_EYE_HEIGHT;
-    center.VEC_Y += PLAYER_EYE_HEIGHT;
+    eye_pos = camera_eye(camera);
+    center  = vector3_add(&eye_pos, &forward);
 
     camera->view_matrix = look_at(&eye_pos, &center, &up);
 }
+
+struct vector3 camera_forward(const struct camera *camera) {
+    struct vector3 forward;
+    float yaw_rad;
+    float pitch_rad;
+
+    assert(camera);
+
+    yaw_rad   = camera->yaw * (float)PI / 180.0f;
+    pitch_rad = camera->pitch * (float)PI / 180.0f;
+
+    forward.VEC_X =
+        (float)cos((double)pitch_rad) * (float)sin((double)yaw_rad);
+    forward.VEC_Y = (float)sin((double)pitch_rad);
+    forward.VEC_Z =
+        (float)cos((double)pitch_rad) * (float)cos((double)yaw_rad);
+
+    return forward;
+}
+
+struct vector3 camera_eye(const struct camera *camera) {
+    struct vector3 eye;
+
+    assert(camera);
+
+    eye = camera->pos;
+    eye.VEC_Y += PLAYER_EYE_HEIGHT;
+
+    return eye;
+}
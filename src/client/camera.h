@@ -23,4 +23,10 @@ void camera_update_viewport(struct camera *camera, int width, int height);
 void camera_update(struct camera *camera, const struct window *window,
                    float delta_time);
 
+/* Unit vector the camera looks along. */
+struct vector3 camera_forward(const struct camera *camera);
+
+/* Position the camera looks from, at player eye height above pos. */
+struct vector3 camera_eye(const struct camera *camera);
+
 #endif
@@ -6,39 +6,76 @@
 #include <glad/glad.h>
 
 #include "coord.h"
-
-#define BLOCK_AIR         0
-#define BLOCK_DIRT        1
-#define BLOCK_GRASS_BLOCK 2
-#define BLOCK_STONE       3
-#define BLOCK_COBBLESTONE 4
-#define BLOCK_BEDROCK     5
-
-#define CHUNK_SIZE  16
-#define CHUNK_TOTAL CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE
+#include "vector.h"
+#include "client/block.h"
+#include "client/light.h"
 
 struct chunk {
     struct coord coord;
 
-    unsigned char blocks[CHUNK_TOTAL];
+    /* CHUNK_TOTAL blocks, NULL while the chunk is a placeholder. Workers
+       gather it lock-free, so it is never written in place: edits swap in a
+       changed copy with release order and retire the old one to the epoch. */
+    unsigned char *blocks;
+
+    /* CHUNK_TOTAL light values, replaced like blocks. First 4 bits =
+       skylight, last 4 bits = block light. */
+    unsigned char *light;
+
+    /* FALSE while the chunk is a placeholder waiting for generation. Workers
+       read it with acquire order, it is set once blocks are in place. */
+    int is_generated;
 
-    /* First 4 bits = skylight, last 4 bits = block light. */
-    unsigned char light[CHUNK_TOTAL];
+    /* TRUE if blocks and light match what is stored in the region file. */
+    int is_saved;
 
     /* TRUE if mesh needs to be regenerated. */
     int is_dirty;
 
+    /* FALSE until the light is first computed, the chunk is not meshed
+       before. Ordered like is_generated. */
+    int is_lit;
+
+    /* TRUE to relight from scratch, else the blocks whose light is stale
+       since the last relight, as local indices. */
+    int is_light_dirty;
+    unsigned short light_edits[LIGHT_EDITS_MAX];
+    size_t light_edit_count;
+
+    /* Serial of the lighting task in flight, 0 if none. */
+    unsigned int light_task;
+
+    /* Serial of the meshing task in flight, 0 if none. */
+    unsigned int mesh_task;
+
+    /* Warm cache LRU links, only used while the chunk is unloaded. */
+    struct chunk *lru_prev;
+    struct chunk *lru_next;
+
     GLuint vertex_array;
     GLuint vertex_buffer;
     GLuint element_buffer;
     size_t index_count;
-};
 
-struct world;
+    /* Indices are grouped by face direction, in mesher_face_dirs order, so
+       directions facing away from the camera are skipped as a whole. */
+    size_t face_offsets[6];
+    size_t face_counts[6];
+};
 
 void chunk_init(struct chunk *chunk, const unsigned char *blocks,
-                const struct coord *coord);
+                const unsigned char *light, const struct coord *coord);
 void chunk_free(struct chunk *chunk);
-void chunk_update(struct chunk *chunk, const struct world *world);
+
+/* Replaces the mesh of CHUNK with VERTEX_COUNT vertices of
+   MESHER_VERTEX_FLOATS floats, and INDICES grouped by face direction with
+   INDEX_COUNTS of each. Render thread only. */
+void chunk_upload(struct chunk *chunk, const float *vertices,
+                  size_t vertex_count, const unsigned int *indices,
+                  const size_t *index_counts);
+
+/* FALSE if every face of direction FACE is back facing seen from POS. */
+int chunk_is_facing(const struct chunk *chunk, int face,
+                    const struct vector3 *pos);
 
 #endif
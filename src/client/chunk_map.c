@@ -1,7 +1,16 @@
 #include "chunk_map.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "macros.h"
+#include "atomic.h"
 
 static size_t hash_coord(const struct coord *c) {
     size_t h;
@@ -23,172 +32,408 @@ static size_t hash_coord(const struct coord *c) {
 #define COORD_EQ(a, b)                                                        \
     ((a)->x == (b)->x && (a)->y == (b)->y && (a)->z == (b)->z)
 
-void chunk_map_init(struct chunk_map *map, size_t initial_cap) {
+static struct chunk_table *table_create(size_t capacity) {
+    struct chunk_table *table;
+
+    assert(capacity >= CHUNK_MAP_GROUP_WIDTH);
+    assert((capacity & (capacity - 1)) == 0);
+
+    table = malloc(sizeof(struct chunk_table));
+    if (!table) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    table->ctrl   = malloc(capacity);
+    table->keys   = malloc(capacity * sizeof(struct coord));
+    table->values = malloc(capacity * sizeof(struct chunk *));
+    if (!table->ctrl || !table->keys || !table->values) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(table->ctrl, CTRL_EMPTY, capacity);
+    table->capacity = capacity;
+
+    return table;
+}
+
+static void table_destroy(void *ptr, void *context) {
+    struct chunk_table *table = (struct chunk_table *)ptr;
+
+    (void)context;
+
+    free(table->ctrl);
+    free(table->keys);
+    free(table->values);
+    free(table);
+}
+
+/* Bitmask of the slots in a control group equal to BYTE. */
+static unsigned int group_match(const unsigned char *ctrl,
+                                unsigned char byte) {
+#ifdef __SSE2__
+    __m128i group;
+
+    group = _mm_loadu_si128((const __m128i *)(const void *)ctrl);
+
+    return (unsigned int)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < CHUNK_MAP_GROUP_WIDTH; i++) {
+        if (ctrl[i] == byte) {
+            mask |= 1U << i;
+        }
+    }
+
+    return mask;
+#endif
+}
+
+/* Bitmask of the empty or deleted slots in a control group. */
+static unsigned int group_match_free(const unsigned char *ctrl) {
+#ifdef __SSE2__
+    __m128i group;
+
+    group = _mm_loadu_si128((const __m128i *)(const void *)ctrl);
+
+    /* Only free slots have the top bit set. */
+    return (unsigned int)_mm_movemask_epi8(group);
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < CHUNK_MAP_GROUP_WIDTH; i++) {
+        if (ctrl[i] & 0x80) {
+            mask |= 1U << i;
+        }
+    }
+
+    return mask;
+#endif
+}
+
+#define H1(HASH) ((HASH) >> 7)
+#define H2(HASH) ((unsigned char)((HASH) & 0x7F))
+
+/* Returns the slot index of KEY, or (size_t)-1. Probes whole groups in
+   triangular steps, which visits every group once for power-of-two group
+   counts, and stops at the first group with an empty slot. Bounded, since a
+   torn read may hide every empty slot. */
+static size_t find(const struct chunk_table *table, const struct coord *key,
+                   size_t hash) {
+    size_t group_mask;
+    size_t group;
+    size_t step;
+
+    group_mask = table->capacity / CHUNK_MAP_GROUP_WIDTH - 1;
+    group      = H1(hash) & group_mask;
+
+    for (step = 1; step <= group_mask + 1; step++) {
+        const unsigned char *ctrl;
+        unsigned int match;
+
+        ctrl  = table->ctrl + group * CHUNK_MAP_GROUP_WIDTH;
+        match = group_match(ctrl, H2(hash));
+
+        while (match) {
+            size_t idx = group * CHUNK_MAP_GROUP_WIDTH +
+                         (size_t)__builtin_ctz(match);
+
+            if (COORD_EQ(&table->keys[idx], key)) {
+                return idx;
+            }
+
+            match &= match - 1;
+        }
+
+        if (group_match(ctrl, CTRL_EMPTY)) {
+            return (size_t)-1;
+        }
+
+        group = (group + step) & group_mask;
+    }
+
+    return (size_t)-1;
+}
+
+/* Returns the first empty or deleted slot on the probe sequence of HASH. */
+static size_t find_free(const struct chunk_table *table, size_t hash) {
+    size_t group_mask;
+    size_t group;
+    size_t step;
+
+    group_mask = table->capacity / CHUNK_MAP_GROUP_WIDTH - 1;
+    group      = H1(hash) & group_mask;
+
+    for (step = 1;; step++) {
+        unsigned int match;
+
+        match = group_match_free(table->ctrl + group * CHUNK_MAP_GROUP_WIDTH);
+
+        if (match) {
+            return group * CHUNK_MAP_GROUP_WIDTH +
+                   (size_t)__builtin_ctz(match);
+        }
+
+        group = (group + step) & group_mask;
+    }
+}
+
+/* Seqlock writer side. Slot stores between begin and end may be observed
+   torn by readers, who detect it by the sequence number having moved. */
+
+static void write_begin(struct chunk_map *map) {
+    ATOMIC_STORE_RELAXED(&map->seq, map->seq + 1);
+    ATOMIC_FENCE_RELEASE();
+}
+
+static void write_end(struct chunk_map *map) {
+    ATOMIC_STORE_RELEASE(&map->seq, map->seq + 1);
+}
+
+void chunk_map_init(struct chunk_map *map, size_t initial_cap,
+                    struct epoch *epoch) {
     size_t cap = 1;
 
-    if (initial_cap < 16) {
-        initial_cap = 16;
+    assert(map);
+
+    if (initial_cap < CHUNK_MAP_GROUP_WIDTH) {
+        initial_cap = CHUNK_MAP_GROUP_WIDTH;
     }
 
     while (cap < initial_cap) {
         cap <<= 1;
     }
 
-    map->capacity = cap;
-    map->size     = 0;
-    map->slots = (struct chunk_slot *)calloc(cap, sizeof(struct chunk_slot));
+    map->table      = table_create(cap);
+    map->seq        = 0;
+    map->size       = 0;
+    map->tombstones = 0;
+    map->epoch      = epoch;
 }
 
 void chunk_map_free(struct chunk_map *map) {
-    free(map->slots);
-    map->slots    = NULL;
-    map->capacity = 0;
-    map->size     = 0;
+    assert(map);
+
+    table_destroy(map->table, NULL);
+    map->table      = NULL;
+    map->size       = 0;
+    map->tombstones = 0;
 }
 
 struct chunk *chunk_map_get(const struct chunk_map *map,
                             const struct coord *key) {
     size_t hash;
-    size_t mask;
-    size_t idx;
 
-    if (map->size == 0 || key == NULL) {
+    if (key == NULL) {
         return NULL;
     }
 
     hash = hash_coord(key);
-    mask = map->capacity - 1;
-    idx  = hash & mask;
 
-    while (1) {
-        struct chunk_slot *slot = &map->slots[idx];
+    while (TRUE) {
+        unsigned long seq;
+        const struct chunk_table *table;
+        struct chunk *value;
+        size_t idx;
 
-        if (slot->state == SLOT_EMPTY) {
-            return NULL;
-        }
+        seq = ATOMIC_LOAD_ACQUIRE(&map->seq);
 
-        if (slot->state == SLOT_OCCUPIED && slot->hash == hash) {
-            if (COORD_EQ(&slot->key, key)) {
-                return slot->value;
-            }
+        /* Writer is mid-mutation. */
+        if (seq & 1) {
+            continue;
         }
 
-        idx = (idx + 1) & mask;
+        table = ATOMIC_LOAD_ACQUIRE(&map->table);
+        idx   = find(table, key, hash);
+        value = (idx == (size_t)-1) ? NULL : table->values[idx];
+
+        ATOMIC_FENCE_ACQUIRE();
+
+        if (ATOMIC_LOAD_RELAXED(&map->seq) == seq) {
+            return value;
+        }
     }
 }
 
-static void chunk_map_grow(struct chunk_map *map) {
-    size_t old_cap;
-    size_t new_cap;
-    size_t new_mask;
+/* Re-hash all live entries into a fresh table, dropping tombstones. The new
+   table is fully built before it is published, and readers still probing the
+   old one are protected by the epoch. */
+static void chunk_map_rehash(struct chunk_map *map, size_t new_cap) {
+    struct chunk_table *old_table;
+    struct chunk_table *new_table;
     size_t i;
-    size_t idx;
-    struct chunk_slot *old_slots;
-    struct chunk_slot *new_slots;
 
-    old_cap   = map->capacity;
-    old_slots = map->slots;
+    old_table = map->table;
+    new_table = table_create(new_cap);
 
-    new_cap  = old_cap * 2;
-    new_mask = new_cap - 1;
+    for (i = 0; i < old_table->capacity; i++) {
+        if (!(old_table->ctrl[i] & 0x80)) {
+            size_t hash;
+            size_t idx;
 
-    new_slots =
-        (struct chunk_slot *)calloc(new_cap, sizeof(struct chunk_slot));
+            hash = hash_coord(&old_table->keys[i]);
+            idx  = find_free(new_table, hash);
 
-    for (i = 0; i < old_cap; i++) {
-        if (old_slots[i].state == SLOT_OCCUPIED) {
-            idx = old_slots[i].hash & new_mask;
-
-            while (new_slots[idx].state == SLOT_OCCUPIED) {
-                idx = (idx + 1) & new_mask;
-            }
-
-            new_slots[idx] = old_slots[i];
+            new_table->ctrl[idx]   = H2(hash);
+            new_table->keys[idx]   = old_table->keys[i];
+            new_table->values[idx] = old_table->values[i];
         }
     }
 
-    free(old_slots);
-    map->slots    = new_slots;
-    map->capacity = new_cap;
+    ATOMIC_STORE_RELEASE(&map->table, new_table);
+    map->tombstones = 0;
+
+    if (map->epoch) {
+        epoch_retire(map->epoch, old_table, table_destroy, NULL);
+    } else {
+        table_destroy(old_table, NULL);
+    }
 }
 
-void chunk_map_insert(struct chunk_map *map, const struct coord *key,
-                      struct chunk *val) {
+int chunk_map_insert(struct chunk_map *map, const struct coord *key,
+                     struct chunk *val) {
+    struct chunk_table *table;
     size_t hash;
-    size_t mask;
     size_t idx;
-    size_t first_deleted;
 
     if (key == NULL) {
         return 0;
     }
 
-    if (map->size * 10 >= map->capacity * 7) {
-        chunk_map_grow(map);
-    }
+    hash = hash_coord(key);
 
-    hash          = hash_coord(key);
-    mask          = map->capacity - 1;
-    idx           = hash & mask;
-    first_deleted = (size_t)-1;
+    idx = find(map->table, key, hash);
+    if (idx != (size_t)-1) {
+        write_begin(map);
+        map->table->values[idx] = val;
+        write_end(map);
+        return 0; /* Updated existing key. */
+    }
 
-    while (1) {
-        struct chunk_slot *slot = &map->slots[idx];
+    /* Tombstones lengthen probes just like live entries, so count both. */
+    if ((map->size + map->tombstones + 1) * 10 >= map->table->capacity * 7) {
+        size_t new_cap = map->table->capacity;
 
-        if (slot->state == SLOT_EMPTY) {
-            if (first_deleted != (size_t)-1) {
-                idx = first_deleted;
-            }
-            break;
+        while ((map->size + 1) * 10 >= new_cap * 5) {
+            new_cap <<= 1;
         }
 
-        if (slot->state == SLOT_DELETED) {
-            if (first_deleted == (size_t)-1) {
-                first_deleted = idx;
-            }
-        } else if (slot->hash == hash && COORD_EQ(&slot->key, key)) {
-            slot->value = val;
-            return 0; /* Updated existing key. */
-        }
+        chunk_map_rehash(map, new_cap);
+    }
 
-        idx = (idx + 1) & mask;
+    table = map->table;
+    idx   = find_free(table, hash);
+
+    if (table->ctrl[idx] == CTRL_DELETED) {
+        map->tombstones--;
     }
 
-    map->slots[idx].key   = *key;
-    map->slots[idx].hash  = hash;
-    map->slots[idx].value = val;
-    map->slots[idx].state = SLOT_OCCUPIED;
+    /* Keys and values first, readers only look at them after the control
+       byte matches. */
+    write_begin(map);
+    table->keys[idx]   = *key;
+    table->values[idx] = val;
+    table->ctrl[idx]   = H2(hash);
+    write_end(map);
+
     map->size++;
     return 1; /* Inserted new key. */
 }
 
-void chunk_map_remove(struct chunk_map *map, const struct coord *key) {
-    size_t hash;
-    size_t mask;
+struct chunk *chunk_map_remove(struct chunk_map *map,
+                               const struct coord *key) {
+    struct chunk_table *table;
     size_t idx;
 
     if (map->size == 0 || key == NULL) {
-        return;
+        return NULL;
     }
 
-    hash = hash_coord(key);
-    mask = map->capacity - 1;
-    idx  = hash & mask;
+    table = map->table;
+    idx   = find(table, key, hash_coord(key));
+
+    if (idx == (size_t)-1) {
+        return NULL;
+    }
+
+    /* A lookup stops at the first group with an empty slot, and inserts only
+       ever skip full groups. So if this group still has an empty slot, no
+       key probes past it and the slot can be freed without a tombstone. */
+    write_begin(map);
+    if (group_match(table->ctrl + (idx & ~(size_t)(CHUNK_MAP_GROUP_WIDTH - 1)),
+                    CTRL_EMPTY)) {
+        table->ctrl[idx] = CTRL_EMPTY;
+    } else {
+        table->ctrl[idx] = CTRL_DELETED;
+        map->tombstones++;
+    }
+    write_end(map);
+
+    map->size--;
+    return table->values[idx];
+}
+
+struct chunk *chunk_map_next(const struct chunk_map *map, size_t *iter) {
+    const struct chunk_table *table;
+
+    assert(map);
+    assert(iter);
 
-    while (1) {
-        struct chunk_slot *slot = &map->slots[idx];
+    table = map->table;
 
-        if (slot->state == SLOT_EMPTY) {
-            return;
+    while (*iter < table->capacity) {
+        size_t idx = (*iter)++;
+
+        if (!(table->ctrl[idx] & 0x80)) {
+            return table->values[idx];
+        }
+    }
+
+    return NULL;
+}
+
+void chunk_map_stats(const struct chunk_map *map,
+                     struct chunk_map_stats *stats) {
+    const struct chunk_table *table;
+    size_t group_mask;
+    size_t i;
+
+    assert(map);
+    assert(stats);
+
+    table      = map->table;
+    group_mask = table->capacity / CHUNK_MAP_GROUP_WIDTH - 1;
+
+    stats->size        = map->size;
+    stats->capacity    = table->capacity;
+    stats->tombstones  = map->tombstones;
+    stats->max_probe   = 0;
+    stats->total_probe = 0;
+
+    for (i = 0; i < table->capacity; i++) {
+        size_t group;
+        size_t step;
+
+        if (table->ctrl[i] & 0x80) {
+            continue;
         }
 
-        if (slot->state == SLOT_OCCUPIED && slot->hash == hash &&
-            COORD_EQ(&slot->key, key)) {
-            slot->state = SLOT_DELETED;
-            map->size--;
-            return;
+        /* Walk the key's probe sequence up to the group it lives in. */
+
+        group = H1(hash_coord(&table->keys[i])) & group_mask;
+        step  = 1;
+
+        while (group != i / CHUNK_MAP_GROUP_WIDTH) {
+            group = (group + step) & group_mask;
+            step++;
         }
 
-        idx = (idx + 1) & mask;
+        stats->max_probe = MAX(stats->max_probe, step);
+        stats->total_probe += step;
     }
 }
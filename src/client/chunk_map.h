@@ -4,33 +4,78 @@
 #include <stddef.h>
 
 #include "coord.h"
+#include "epoch.h"
 
-#define SLOT_EMPTY    0
-#define SLOT_OCCUPIED 1
-#define SLOT_DELETED  2
+/* Control byte of a slot. Occupied slots store the low 7 bits of the key's
+   hash, so the top bit alone tells free slots from occupied ones. */
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xFE
 
-/* 32 bytes. */
-struct chunk_slot {
-    struct coord key;
-    unsigned int state;
-    size_t hash;
-    struct chunk *value;
+/* Slots are probed one 16-byte control group at a time. */
+#define CHUNK_MAP_GROUP_WIDTH 16
+
+/* Swiss-table layout: a dense control byte array that is scanned with SIMD,
+   and keys and values in parallel arrays that are only touched on a hash
+   fragment match. Replaced as a whole on growth so that readers always see
+   a capacity matching the arrays they probe. */
+struct chunk_table {
+    unsigned char *ctrl;
+    struct coord *keys;
+    struct chunk **values;
+    size_t capacity; /* Power of two, at least one group. */
 };
 
-/* Flat hash-map of coordinates to pointer-to-chunks with linear probing. */
+/* Flat hash-map of coordinates to pointer-to-chunks with quadratic probing
+   over 16-slot groups.
+
+   Single writer, lock-free readers: the writer brackets every mutation with
+   an odd/even sequence number and readers retry lookups that raced with a
+   mutation. Replaced tables are retired through the epoch, so readers must
+   call chunk_map_get inside epoch_enter/epoch_exit and may keep using the
+   returned chunk until epoch_exit. */
 struct chunk_map {
-    struct chunk_slot *slots;
-    size_t capacity; /* Always a power of two. */
+    struct chunk_table *table;
+
+    /* Odd while the writer is mutating. */
+    unsigned long seq;
+
+    /* Writer only. */
     size_t size;
+    size_t tombstones;
+
+    /* NULL if the map is never read concurrently. */
+    struct epoch *epoch;
 };
 
-void chunk_map_init(struct chunk_map *map, size_t initial_cap);
+/* Probe lengths count the control groups a successful lookup visits. */
+struct chunk_map_stats {
+    size_t size;
+    size_t capacity;
+    size_t tombstones;
+    size_t max_probe;
+    size_t total_probe; /* Divide by size for the mean. */
+};
+
+void chunk_map_init(struct chunk_map *map, size_t initial_cap,
+                    struct epoch *epoch);
 void chunk_map_free(struct chunk_map *map);
 
+/* Safe to call from any thread. */
 struct chunk *chunk_map_get(const struct chunk_map *map,
                             const struct coord *key);
-void chunk_map_insert(struct chunk_map *map, const struct coord *key,
-                      struct chunk *val);
-void chunk_map_remove(struct chunk_map *map, const struct coord *key);
 
-#endif
\ No newline at end of file
+/* Writer only. */
+int chunk_map_insert(struct chunk_map *map, const struct coord *key,
+                     struct chunk *val);
+struct chunk *chunk_map_remove(struct chunk_map *map,
+                               const struct coord *key);
+
+/* Writer only. Returns the next chunk after *iter, or NULL when done. Start
+   with *iter = 0. */
+struct chunk *chunk_map_next(const struct chunk_map *map, size_t *iter);
+
+/* Writer only. */
+void chunk_map_stats(const struct chunk_map *map,
+                     struct chunk_map_stats *stats);
+
+#endif
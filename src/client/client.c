@@ -3,30 +3,51 @@
 #include <unistd.h>
 
 #include "macros.h"
+#include "atomic.h"
+#include "profiler.h"
 
-static void worker(void *context) {
+/* Numbers workers in profiles. */
+static unsigned long worker_count;
+
+static void *worker(void *context) {
     struct client *client;
+    char name[32];
 
     assert(context);
 
     client = (struct client *)context;
 
+    sprintf(name, "worker %lu", ATOMIC_FETCH_ADD(&worker_count, 1));
+    profiler_thread_name(name);
+
     while (TRUE) {
-        struct task task;
+        struct task *task;
 
         pthread_mutex_lock(&client->mutex);
 
-        while (client->tasks.size == 0) {
+        while (client->task_count == 0) {
             pthread_cond_wait(&client->cond, &client->mutex);
         }
 
-        QUEUE_POP(&client->tasks, &task);
+        task              = client->task_head;
+        client->task_head = task->next;
+        client->task_count--;
+
+        if (!client->task_head) {
+            client->task_tail = NULL;
+        }
 
         pthread_mutex_unlock(&client->mutex);
 
-        assert(task.function);
-        task.function(task.context);
+        assert(task->function);
+        PROFILE_BEGIN("task");
+        task->function(task->context);
+        PROFILE_END();
+
+        free(task);
     }
+
+    return NULL;
 }
 
 void client_init(struct client *client) {
@@ -45,7 +66,49 @@ void client_init(struct client *client) {
     pthread_mutex_init(&client->mutex, NULL);
     pthread_cond_init(&client->cond, NULL);
 
+    client->task_head  = NULL;
+    client->task_tail  = NULL;
+    client->task_count = 0;
+
+    client->threads.size     = 0;
+    client->threads.capacity = 0;
+    client->thread_elems     = NULL;
+
     for (i = 0; i < workers; i++) {
-        pthread_create(&client->thread_elems[i], NULL, worker, client);
+        pthread_t thread;
+
+        pthread_create(&thread, NULL, worker, client);
+        ARRAY_APPEND(client->threads, client->thread_elems, thread);
+    }
+}
+
+void client_submit(struct client *client, void (*function)(void *context),
+                   void *context) {
+    struct task *task;
+
+    assert(client);
+    assert(function);
+
+    task = malloc(sizeof(struct task));
+    if (!task) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    task->function = function;
+    task->context  = context;
+    task->next     = NULL;
+
+    pthread_mutex_lock(&client->mutex);
+
+    if (client->task_tail) {
+        client->task_tail->next = task;
+    } else {
+        client->task_head = task;
     }
-}
\ No newline at end of file
+    client->task_tail = task;
+    client->task_count++;
+
+    pthread_cond_signal(&client->cond);
+    pthread_mutex_unlock(&client->mutex);
+}
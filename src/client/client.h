@@ -1,10 +1,10 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#include <stddef.h>
 #include <pthread.h>
 
 #include "array.h"
-#include "queue.h"
 
 /* Thread pool task. */
 struct task {
@@ -22,11 +22,17 @@ struct client {
     pthread_mutex_t mutex;
     pthread_cond_t cond;
 
-    struct queue tasks;
-    struct task *task_elems;
+    /* FIFO of pending tasks. */
+    struct task *task_head;
+    struct task *task_tail;
+    size_t task_count;
 };
 
 void client_init(struct client *client);
 void client_update(struct client *client);
 
+/* Enqueue FUNCTION to run on a worker thread. Thread-safe. */
+void client_submit(struct client *client, void (*function)(void *context),
+                   void *context);
+
 #endif
@@ -0,0 +1,375 @@
+#include "client/light.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include "macros.h"
+#include "ring_buffer.h"
+
+static const int face_dirs[6][3] = {
+    {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1},
+};
+
+/* Indexed by block id. */
+static const unsigned char emissions[] = {
+    0,  /* BLOCK_AIR */
+    0,  /* BLOCK_DIRT */
+    0,  /* BLOCK_GRASS_BLOCK */
+    0,  /* BLOCK_STONE */
+    0,  /* BLOCK_COBBLESTONE */
+    0,  /* BLOCK_BEDROCK */
+    15, /* BLOCK_GLOWSTONE */
+};
+
+unsigned char light_emission(unsigned char block) {
+    if (block >= sizeof(emissions)) {
+        return 0;
+    }
+
+    return emissions[block];
+}
+
+/* Light spreads into air only, but opaque emitters still spread out of
+   their own block. */
+#define IS_OPAQUE(BLOCK) ((BLOCK) != BLOCK_AIR)
+
+int light_border_block(int face, int idx) {
+    int edge = (face & 1) ? 0 : CHUNK_SIZE - 1;
+    int a    = idx % CHUNK_SIZE;
+    int b    = idx / CHUNK_SIZE;
+
+    assert(face >= 0 && face < 6);
+    assert(idx >= 0 && idx < LIGHT_BORDER_TOTAL);
+
+    switch (face >> 1) {
+        case 0:
+            return INDEX_3D(edge, a, b, CHUNK_SIZE);
+
+        case 1:
+            return INDEX_3D(a, edge, b, CHUNK_SIZE);
+
+        default:
+            return INDEX_3D(a, b, edge, CHUNK_SIZE);
+    }
+}
+
+void light_border(const unsigned char *light, int face,
+                  unsigned char *border) {
+    int i;
+
+    assert(light);
+    assert(border);
+
+    for (i = 0; i < LIGHT_BORDER_TOTAL; i++) {
+        border[i] = light[light_border_block(face, i)];
+    }
+}
+
+/* Queue of blocks whose light must spread to their neighbors. A block is
+   queued at most once at a time, its light is read when it is popped. */
+struct flood {
+    struct ring_buffer queue;
+    unsigned short elems[CHUNK_TOTAL];
+    unsigned char is_queued[CHUNK_TOTAL];
+};
+
+static void flood_init(struct flood *flood) {
+    memset(&flood->queue, 0, sizeof(flood->queue));
+    flood->queue.capacity = CHUNK_TOTAL;
+    memset(flood->is_queued, FALSE, sizeof(flood->is_queued));
+}
+
+static void flood_push(struct flood *flood, int idx) {
+    if (!flood->is_queued[idx]) {
+        flood->is_queued[idx] = TRUE;
+        RING_BUFFER_PUSH(flood->queue, flood->elems, (unsigned short)idx);
+    }
+}
+
+/* Raise the light at IDX to at least SKY and BLOCK and queue it if that
+   changed anything. */
+static void raise_light(unsigned char *light, struct flood *flood, int idx,
+                        int sky, int block) {
+    int old_sky   = LIGHT_SKY(light[idx]);
+    int old_block = LIGHT_BLOCK(light[idx]);
+
+    if (sky > old_sky || block > old_block) {
+        light[idx] = LIGHT_PACK(MAX(sky, old_sky), MAX(block, old_block));
+        flood_push(flood, idx);
+    }
+}
+
+/* Breadth-first spread of both channels. Light drops by one per block,
+   except full skylight going down, which is how sky reaches cave floors
+   under open shafts. */
+static void flood_spread(const unsigned char *blocks, unsigned char *light,
+                         struct flood *flood) {
+    while (flood->queue.size > 0) {
+        unsigned short idx;
+        int sky;
+        int block;
+        int x;
+        int y;
+        int z;
+        int face;
+
+        RING_BUFFER_POP(flood->queue, flood->elems, idx);
+        flood->is_queued[idx] = FALSE;
+
+        sky   = LIGHT_SKY(light[idx]);
+        block = LIGHT_BLOCK(light[idx]);
+
+        x = idx % CHUNK_SIZE;
+        y = (idx / CHUNK_SIZE) % CHUNK_SIZE;
+        z = idx / (CHUNK_SIZE * CHUNK_SIZE);
+
+        for (face = 0; face < 6; face++) {
+            int nx = x + face_dirs[face][0];
+            int ny = y + face_dirs[face][1];
+            int nz = z + face_dirs[face][2];
+            int neighbor;
+            int spread_sky;
+
+            if (nx < 0 || nx >= CHUNK_SIZE || ny < 0 || ny >= CHUNK_SIZE ||
+                nz < 0 || nz >= CHUNK_SIZE) {
+                continue;
+            }
+
+            neighbor = INDEX_3D(nx, ny, nz, CHUNK_SIZE);
+
+            if (IS_OPAQUE(blocks[neighbor])) {
+                continue;
+            }
+
+            spread_sky = (face == LIGHT_NEG_Y && sky == LIGHT_MAX)
+                             ? LIGHT_MAX
+                             : MAX(sky - 1, 0);
+
+            raise_light(light, flood, neighbor, spread_sky,
+                        MAX(block - 1, 0));
+        }
+    }
+}
+
+/* Light entering the chunk layer at each face from the neighbor's border. */
+static void seed_borders(const unsigned char *blocks,
+                         const unsigned char *const *borders,
+                         unsigned char *light, struct flood *flood) {
+    int face;
+    int i;
+
+    for (face = 0; face < 6; face++) {
+        const unsigned char *border = borders[face];
+
+        /* Dark, except open sky above. */
+        if (!border && face != LIGHT_POS_Y) {
+            continue;
+        }
+
+        for (i = 0; i < LIGHT_BORDER_TOTAL; i++) {
+            int idx = light_border_block(face, i);
+            unsigned char incoming;
+            int sky;
+
+            if (IS_OPAQUE(blocks[idx])) {
+                continue;
+            }
+
+            incoming = border ? border[i] : LIGHT_PACK(LIGHT_MAX, 0);
+            sky      = LIGHT_SKY(incoming);
+
+            if (face != LIGHT_POS_Y || sky != LIGHT_MAX) {
+                sky = MAX(sky - 1, 0);
+            }
+
+            raise_light(light, flood, idx, sky,
+                        MAX(LIGHT_BLOCK(incoming) - 1, 0));
+        }
+    }
+}
+
+static void seed_emitter(const unsigned char *blocks, unsigned char *light,
+                         struct flood *flood, int idx) {
+    int emission = light_emission(blocks[idx]);
+
+    if (emission > 0) {
+        raise_light(light, flood, idx, 0, emission);
+    }
+}
+
+void light_compute(const unsigned char *blocks,
+                   const unsigned char *const *borders, unsigned char *light) {
+    struct flood flood;
+    int x;
+    int z;
+    int i;
+
+    assert(blocks);
+    assert(borders);
+    assert(light);
+
+    flood_init(&flood);
+    memset(light, 0, CHUNK_TOTAL);
+
+    /* Direct skylight. Columns open to the sky at the top of the chunk are
+       fully lit down to their heightmap, the highest opaque block. */
+    for (z = 0; z < CHUNK_SIZE; z++) {
+        for (x = 0; x < CHUNK_SIZE; x++) {
+            const unsigned char *above = borders[LIGHT_POS_Y];
+            int height;
+            int y;
+
+            if (above &&
+                LIGHT_SKY(above[INDEX_2D(x, z, CHUNK_SIZE)]) != LIGHT_MAX) {
+                continue;
+            }
+
+            for (height = CHUNK_SIZE - 1; height >= 0; height--) {
+                if (IS_OPAQUE(blocks[INDEX_3D(x, height, z, CHUNK_SIZE)])) {
+                    break;
+                }
+            }
+
+            for (y = CHUNK_SIZE - 1; y > height; y--) {
+                int idx = INDEX_3D(x, y, z, CHUNK_SIZE);
+
+                light[idx] = LIGHT_PACK(LIGHT_MAX, 0);
+                flood_push(&flood, idx);
+            }
+        }
+    }
+
+    for (i = 0; i < CHUNK_TOTAL; i++) {
+        seed_emitter(blocks, light, &flood, i);
+    }
+
+    seed_borders(blocks, borders, light, &flood);
+    flood_spread(blocks, light, &flood);
+}
+
+/* Light removal queue entry: a block that was cleared and the light it
+   had, which its neighbors may have been lit from. */
+struct removal {
+    unsigned short idx;
+    unsigned char value;
+};
+
+/* Clear the light of CHANNEL (0 sky, 1 block) that depended on the edited
+   blocks, queueing the blocks around the cleared area that are lit
+   independently to flood back in. */
+static void remove_light(const unsigned char *blocks, unsigned char *light,
+                         const unsigned short *edits, size_t edit_count,
+                         int channel, struct flood *flood) {
+    static const int shifts[2] = {4, 0};
+
+    struct ring_buffer queue;
+    struct removal elems[CHUNK_TOTAL];
+    int shift = shifts[channel];
+    size_t i;
+
+    memset(&queue, 0, sizeof(queue));
+    queue.capacity = CHUNK_TOTAL;
+
+    for (i = 0; i < edit_count; i++) {
+        struct removal removal;
+
+        removal.idx   = edits[i];
+        removal.value = (unsigned char)((light[edits[i]] >> shift) & 0x0F);
+
+        if (removal.value > 0) {
+            light[removal.idx] &= (unsigned char)~(0x0F << shift);
+            RING_BUFFER_PUSH(queue, elems, removal);
+        }
+    }
+
+    while (queue.size > 0) {
+        struct removal removal;
+        int x;
+        int y;
+        int z;
+        int face;
+
+        RING_BUFFER_POP(queue, elems, removal);
+
+        x = removal.idx % CHUNK_SIZE;
+        y = (removal.idx / CHUNK_SIZE) % CHUNK_SIZE;
+        z = removal.idx / (CHUNK_SIZE * CHUNK_SIZE);
+
+        for (face = 0; face < 6; face++) {
+            int nx = x + face_dirs[face][0];
+            int ny = y + face_dirs[face][1];
+            int nz = z + face_dirs[face][2];
+            struct removal next;
+
+            if (nx < 0 || nx >= CHUNK_SIZE || ny < 0 || ny >= CHUNK_SIZE ||
+                nz < 0 || nz >= CHUNK_SIZE) {
+                continue;
+            }
+
+            next.idx   = (unsigned short)INDEX_3D(nx, ny, nz, CHUNK_SIZE);
+            next.value = (unsigned char)((light[next.idx] >> shift) & 0x0F);
+
+            if (next.value == 0) {
+                continue;
+            }
+
+            /* Dimmer neighbors, and full skylight below full skylight, were
+               lit from the removed light. Others have their own source. */
+            if (next.value < removal.value ||
+                (channel == 0 && face == LIGHT_NEG_Y &&
+                 removal.value == LIGHT_MAX)) {
+                light[next.idx] &= (unsigned char)~(0x0F << shift);
+                RING_BUFFER_PUSH(queue, elems, next);
+
+                if (channel == 1) {
+                    seed_emitter(blocks, light, flood, next.idx);
+                }
+            } else {
+                flood_push(flood, next.idx);
+            }
+        }
+    }
+}
+
+void light_update(const unsigned char *blocks,
+                  const unsigned char *const *borders, unsigned char *light,
+                  const unsigned short *edits, size_t edit_count) {
+    struct flood flood;
+    size_t i;
+
+    assert(blocks);
+    assert(borders);
+    assert(light);
+    assert(edits || edit_count == 0);
+
+    flood_init(&flood);
+
+    remove_light(blocks, light, edits, edit_count, 0, &flood);
+    remove_light(blocks, light, edits, edit_count, 1, &flood);
+
+    /* Let the light around each edited block flow back into it, and light
+       new emitters. */
+    for (i = 0; i < edit_count; i++) {
+        int x = edits[i] % CHUNK_SIZE;
+        int y = (edits[i] / CHUNK_SIZE) % CHUNK_SIZE;
+        int z = edits[i] / (CHUNK_SIZE * CHUNK_SIZE);
+        int face;
+
+        for (face = 0; face < 6; face++) {
+            int nx = x + face_dirs[face][0];
+            int ny = y + face_dirs[face][1];
+            int nz = z + face_dirs[face][2];
+
+            if (nx >= 0 && nx < CHUNK_SIZE && ny >= 0 && ny < CHUNK_SIZE &&
+                nz >= 0 && nz < CHUNK_SIZE) {
+                flood_push(&flood, INDEX_3D(nx, ny, nz, CHUNK_SIZE));
+            }
+        }
+
+        seed_emitter(blocks, light, &flood, edits[i]);
+    }
+
+    /* Cleared blocks on the edges may be lit from the neighbors. */
+    seed_borders(blocks, borders, light, &flood);
+    flood_spread(blocks, light, &flood);
+}
@@ -0,0 +1,61 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include <stddef.h>
+
+#include "client/block.h"
+
+#define LIGHT_MAX 15
+
+/* Light is stored per block with skylight in the upper 4 bits and block
+   light in the lower 4. */
+#define LIGHT_SKY(LIGHT)         ((LIGHT) >> 4)
+#define LIGHT_BLOCK(LIGHT)       ((LIGHT) & 0x0F)
+#define LIGHT_PACK(SKY, BLOCK)   ((unsigned char)((SKY) << 4 | (BLOCK)))
+#define LIGHT_LEVEL(LIGHT)                                                    \
+    ((LIGHT_SKY(LIGHT) > LIGHT_BLOCK(LIGHT)) ? LIGHT_SKY(LIGHT)               \
+                                             : LIGHT_BLOCK(LIGHT))
+
+/* Directions of the six face neighbors, in the order borders are passed. */
+#define LIGHT_POS_X 0
+#define LIGHT_NEG_X 1
+#define LIGHT_POS_Y 2
+#define LIGHT_NEG_Y 3
+#define LIGHT_POS_Z 4
+#define LIGHT_NEG_Z 5
+
+/* Light of the layer of a neighbor chunk that faces the chunk being lit,
+   indexed by the two coordinates along the face in x, y, z order. */
+#define LIGHT_BORDER_TOTAL (CHUNK_SIZE * CHUNK_SIZE)
+
+/* Past this many edited blocks in a chunk, relighting it from scratch is as
+   fast as updating. */
+#define LIGHT_EDITS_MAX 512
+
+/* Light emitted by BLOCK. */
+unsigned char light_emission(unsigned char block);
+
+/* Index within the chunk of the block at IDX of the layer facing FACE. */
+int light_border_block(int face, int idx);
+
+/* Writes the layer of LIGHT facing the neighbor in direction FACE into
+   BORDER, to pass as that neighbor's border in direction FACE ^ 1. */
+void light_border(const unsigned char *light, int face,
+                  unsigned char *border);
+
+/* Lights a chunk from scratch, flood filling skylight down columns and out
+   of them, block light out of emitters, and both in from BORDERS. A NULL
+   border means the neighbor is not loaded: open sky above, dark elsewhere.
+   Light that reaches the edge of the chunk is picked up by the neighbors
+   when they are relit with this chunk's new borders. */
+void light_compute(const unsigned char *blocks,
+                   const unsigned char *const *borders, unsigned char *light);
+
+/* Updates LIGHT, computed for the chunk before the blocks at the local
+   indices EDITS changed, to match BLOCKS. Only light depending on the edited
+   blocks is removed and flooded again. */
+void light_update(const unsigned char *blocks,
+                  const unsigned char *const *borders, unsigned char *light,
+                  const unsigned short *edits, size_t edit_count);
+
+#endif
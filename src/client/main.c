@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <errno.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -19,31 +20,97 @@
 
 #include "macros.h"
 #include "array.h"
+#include "region.h"
+#include "profiler.h"
+#include "protocol.h"
+#include "transport.h"
 #include "client/system.h"
 #include "client/renderer.h"
 #include "client/opengl.h"
 #include "client/chunk.h"
 #include "client/world.h"
 #include "client/camera.h"
-
-#pragma pack(push, 1)
-typedef struct client_update_pkt_s {
-    int sender_socket;
+#include "client/client.h"
+
+/* Zones listed by the profile overlay, and how often it refreshes. */
+#define PROFILE_LINES    12
+#define PROFILE_INTERVAL 500000000u /* Nanoseconds. */
+
+/* The state is sent this often, in Hz, the server tick rate. */
+#define SEND_RATE PROTOCOL_TICK_RATE
+
+/* Connects are resent this often, in seconds, until one is accepted. */
+#define CONNECT_INTERVAL 0.25
+#define CONNECT_ATTEMPTS 20
+
+/* Snapshots and sent states are kept modulo the transport window. */
+#define WINDOW_MASK (TRANSPORT_WINDOW - 1)
+
+/* Results of read_snapshot. */
+#define SNAPSHOT_READ      0
+#define SNAPSHOT_NO_BASE   1
+#define SNAPSHOT_MALFORMED 2
+
+/* Remote players are drawn this many seconds behind the server clock, two
+   server ticks, between the states taken around then. Past the newest, they
+   move on along its velocity for at most EXTRAPOLATE_MAX seconds. */
+#define INTERPOLATE_DELAY 0.1
+#define EXTRAPOLATE_MAX   0.25
+
+/* The server clock is estimated as an offset from the local one. Datagrams
+   are only ever delayed, so the offset follows those arriving early
+   quickly and those arriving late slowly, in case the delay grew for good.
+   Off by more than CLOCK_RESET seconds, it starts over. */
+#define CLOCK_FAST  0.25
+#define CLOCK_SLOW  0.02
+#define CLOCK_RESET 1.0
+
+/* Blocks are edited this many blocks away from the eyes at most. */
+#define REACH 6.0f
+
+/* States kept per remote player, enough for the delay at the tick rate. */
+#define PLAYER_SAMPLES 8
+
+/* State of a remote player, and the server time it was taken at. */
+typedef struct player_sample_s {
+    double time;
     struct vector3 position;
     struct vector3 velocity;
     float head_yaw;
     float head_pitch;
-} client_update_pkt_t;
-#pragma pack(pop)
+} player_sample_t;
 
 typedef struct remote_player_s {
-    int socket;
+    unsigned int id;
+
+    /* Newest state received, and the samples, oldest first. */
+    struct player_state state;
+    player_sample_t samples[PLAYER_SAMPLES];
+    size_t sample_count;
+
+    /* Where it is drawn this frame. */
     struct vector3 position;
     struct vector3 velocity;
     float head_yaw;
     float head_pitch;
 } remote_player_t;
 
+/* State sent to the server, kept as the base of later ones. */
+typedef struct sent_state_s {
+    int is_used;
+    uint16_t sequence; /* Of the datagram it went in. */
+    struct player_state state;
+} sent_state_t;
+
+/* Snapshot received, kept as the base of later ones. */
+typedef struct received_snapshot_s {
+    int is_used;
+    uint16_t sequence;
+    uint32_t time; /* Server ticks. */
+    struct array players;
+    struct player_update *player_elems;
+} received_snapshot_t;
+
 static int set_nonblocking(int socket) {
     int flags = fcntl(socket, F_GETFL, 0);
 
@@ -60,39 +127,482 @@ static int set_nonblocking(int socket) {
     return TRUE;
 }
 
+/* Newest of the states in SENT, kept modulo the window, that the server
+   acked, NULL if none. */
+static const sent_state_t *get_state_base(const struct transport *transport,
+                                          const sent_state_t *sent) {
+    const sent_state_t *base = NULL;
+    size_t i;
+
+    for (i = 0; i < TRANSPORT_WINDOW; i++) {
+        if (sent[i].is_used &&
+            transport_is_acked(transport, sent[i].sequence) &&
+            (!base || transport_is_newer(sent[i].sequence, base->sequence))) {
+            base = &sent[i];
+        }
+    }
+
+    return base;
+}
+
+static struct player_update *find_update(const received_snapshot_t *snapshot,
+                                         unsigned int id) {
+    size_t i;
+
+    for (i = 0; i < snapshot->players.size; i++) {
+        if (snapshot->player_elems[i].id == id) {
+            return &snapshot->player_elems[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Reads a varint at *USED in the SIZE bytes at SRC, which hold a whole
+   packet, so it must be complete, and moves *USED past it. Returns FALSE if
+   it is not. */
+static int read_varint(const unsigned char *src, size_t size, size_t *used,
+                       uint32_t *value) {
+    size_t n = protocol_read_varint(src + *used, size - *used, value);
+
+    if (n == 0 || n == PROTOCOL_MALFORMED) {
+        return FALSE;
+    }
+
+    *used += n;
+    return TRUE;
+}
+
+/* Decodes the snapshot in the SIZE bytes at SRC, from datagram SEQUENCE,
+   into its slot of SNAPSHOTS. Returns SNAPSHOT_NO_BASE if its base is no
+   longer kept, so it cannot be decoded and must not be acked. */
+static int read_snapshot(const unsigned char *src, size_t size,
+                         uint16_t sequence, received_snapshot_t *snapshots) {
+    const received_snapshot_t *base = NULL;
+    received_snapshot_t *snapshot;
+    uint32_t time;
+    uint32_t leave_count;
+    uint32_t update_count;
+    uint32_t i;
+    size_t used;
+
+    if (size < 2 || src[0] != PACKET_SNAPSHOT) {
+        return SNAPSHOT_MALFORMED;
+    }
+
+    snapshot = &snapshots[sequence & WINDOW_MASK];
+
+    if (src[1] > 0) {
+        uint16_t base_sequence = (uint16_t)(sequence - src[1]);
+
+        base = &snapshots[base_sequence & WINDOW_MASK];
+
+        if (base == snapshot || !base->is_used ||
+            base->sequence != base_sequence) {
+            return SNAPSHOT_NO_BASE;
+        }
+    }
+
+    snapshot->is_used      = FALSE;
+    snapshot->players.size = 0;
+
+    if (base && base->players.size > 0) {
+        ARRAY_APPEND_N(snapshot->players, snapshot->player_elems,
+                       base->players.size, base->player_elems);
+    }
+
+    used = 2;
+    if (!read_varint(src, size, &used, &time) ||
+        !read_varint(src, size, &used, &leave_count) ||
+        !read_varint(src, size, &used, &update_count)) {
+        return SNAPSHOT_MALFORMED;
+    }
+
+    for (i = 0; i < leave_count; i++) {
+        struct player_update *update;
+        uint32_t id;
+
+        if (!read_varint(src, size, &used, &id)) {
+            return SNAPSHOT_MALFORMED;
+        }
+
+        update = find_update(snapshot, id);
+        if (update) {
+            ARRAY_REMOVE(snapshot->players, snapshot->player_elems,
+                         (size_t)(update - snapshot->player_elems));
+        }
+    }
+
+    /* Deltas against the state in the base, or the zero state. */
+    for (i = 0; i < update_count; i++) {
+        struct player_update *update;
+        struct player_update new_update;
+        uint32_t id;
+        size_t n;
+
+        if (!read_varint(src, size, &used, &id)) {
+            return SNAPSHOT_MALFORMED;
+        }
+
+        update = find_update(snapshot, id);
+
+        if (!update) {
+            memset(&new_update, 0, sizeof(new_update));
+            new_update.id = id;
+
+            ARRAY_APPEND(snapshot->players, snapshot->player_elems,
+                         new_update);
+            update = &snapshot->player_elems[snapshot->players.size - 1];
+        }
+
+        n = protocol_read_state(src + used, size - used, &update->state);
+        if (n == 0 || n == PROTOCOL_MALFORMED) {
+            return SNAPSHOT_MALFORMED;
+        }
+
+        used += n;
+    }
+
+    snapshot->is_used  = TRUE;
+    snapshot->sequence = sequence;
+    snapshot->time     = time;
+
+    return SNAPSHOT_READ;
+}
+
+static remote_player_t *find_player(const struct array *players,
+                                    remote_player_t *player_elems,
+                                    unsigned int id) {
+    size_t i;
+
+    for (i = 0; i < players->size; i++) {
+        if (player_elems[i].id == id) {
+            return &player_elems[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Adds STATE, taken at server TIME, to the samples of PLAYER. Moving players
+   always change state between ticks, so one moving with its state unchanged
+   was left out of the snapshot, and is extrapolated instead of stopped. */
+static void add_sample(remote_player_t *player,
+                       const struct player_state *state, double time) {
+    player_sample_t sample;
+
+    if (player->sample_count > 0 &&
+        memcmp(state, &player->state, sizeof(*state)) == 0 &&
+        (state->velocity[0] != 0 || state->velocity[1] != 0 ||
+         state->velocity[2] != 0)) {
+        return;
+    }
+
+    player->state = *state;
+
+    sample.time = time;
+    protocol_dequantize(state, &sample.position, &sample.velocity,
+                        &sample.head_yaw, &sample.head_pitch);
+
+    if (player->sample_count == PLAYER_SAMPLES) {
+        memmove(player->samples, player->samples + 1,
+                (PLAYER_SAMPLES - 1) * sizeof(player_sample_t));
+        player->sample_count--;
+    }
+
+    player->samples[player->sample_count++] = sample;
+}
+
+/* Adds the players of SNAPSHOT, the newest received, to the remote players
+   as samples at its server TIME, and drops those it no longer has. */
+static void show_snapshot(const received_snapshot_t *snapshot, double time,
+                          struct array *players,
+                          remote_player_t **player_elems) {
+    size_t i;
+
+    for (i = players->size; i-- > 0;) {
+        if (!find_update(snapshot, (*player_elems)[i].id)) {
+            ARRAY_REMOVE(*players, *player_elems, i);
+        }
+    }
+
+    for (i = 0; i < snapshot->players.size; i++) {
+        const struct player_update *update = &snapshot->player_elems[i];
+        remote_player_t *player;
+
+        player = find_player(players, *player_elems, update->id);
+
+        if (!player) {
+            remote_player_t new_player;
+
+            memset(&new_player, 0, sizeof(new_player));
+            new_player.id = update->id;
+
+            ARRAY_APPEND(*players, *player_elems, new_player);
+            player = &(*player_elems)[players->size - 1];
+        }
+
+        add_sample(player, &update->state, time);
+    }
+}
+
+/* Moves OFFSET, local time minus server time, toward SAMPLE, that of a
+   snapshot just received. */
+static double smooth_offset(double offset, double sample) {
+    if (fabs(sample - offset) > CLOCK_RESET) {
+        return sample;
+    }
+
+    return offset +
+           (sample - offset) * (sample < offset ? CLOCK_FAST : CLOCK_SLOW);
+}
+
+static float lerp(float a, float b, float t) {
+    return a + (b - a) * t;
+}
+
+/* Turns from yaw A to B the short way, in degrees. */
+static float lerp_yaw(float a, float b, float t) {
+    float delta = b - a;
+
+    if (delta > 180.0f) {
+        delta -= 360.0f;
+    } else if (delta < -180.0f) {
+        delta += 360.0f;
+    }
+
+    return a + delta * t;
+}
+
+/* Sets where PLAYER is drawn at TIME, between the samples around it. */
+static void interpolate_player(remote_player_t *player, double time) {
+    const player_sample_t *a;
+    const player_sample_t *b;
+    float t;
+    size_t i;
+
+    assert(player->sample_count > 0);
+
+    a = &player->samples[0];
+    b = a;
+
+    for (i = 1; i < player->sample_count && b->time < time; i++) {
+        a = b;
+        b = &player->samples[i];
+    }
+
+    if (time <= a->time) {
+        b = a;
+        t = 0.0f;
+    } else if (time < b->time) {
+        t = (float)((time - a->time) / (b->time - a->time));
+    } else {
+        /* Past the newest sample, after a lost datagram or a player left
+           out of the snapshot. */
+        float ahead = (float)MIN(time - b->time, EXTRAPOLATE_MAX);
+
+        player->position.VEC_X = b->position.VEC_X + b->velocity.VEC_X * ahead;
+        player->position.VEC_Y = b->position.VEC_Y + b->velocity.VEC_Y * ahead;
+        player->position.VEC_Z = b->position.VEC_Z + b->velocity.VEC_Z * ahead;
+        player->velocity       = b->velocity;
+        player->head_yaw       = b->head_yaw;
+        player->head_pitch     = b->head_pitch;
+        return;
+    }
+
+    player->position.VEC_X = lerp(a->position.VEC_X, b->position.VEC_X, t);
+    player->position.VEC_Y = lerp(a->position.VEC_Y, b->position.VEC_Y, t);
+    player->position.VEC_Z = lerp(a->position.VEC_Z, b->position.VEC_Z, t);
+    player->velocity.VEC_X = lerp(a->velocity.VEC_X, b->velocity.VEC_X, t);
+    player->velocity.VEC_Y = lerp(a->velocity.VEC_Y, b->velocity.VEC_Y, t);
+    player->velocity.VEC_Z = lerp(a->velocity.VEC_Z, b->velocity.VEC_Z, t);
+    player->head_yaw       = lerp_yaw(a->head_yaw, b->head_yaw, t);
+    player->head_pitch     = lerp(a->head_pitch, b->head_pitch, t);
+}
+
+/* Breaks the block the camera looks at, bedrock aside, or places BLOCK
+   against it. */
+static void edit_block(struct world *world, const struct camera *camera,
+                       unsigned char block) {
+    struct vector3 eye;
+    struct vector3 forward;
+    struct coord hit;
+    struct coord before;
+
+    eye     = camera_eye(camera);
+    forward = camera_forward(camera);
+
+    if (!world_raycast(world, &eye, &forward, REACH, &hit, &before)) {
+        return;
+    }
+
+    if (block == BLOCK_AIR) {
+        if (world_get_block(world, &hit) != BLOCK_BEDROCK) {
+            world_set_block(world, &hit, BLOCK_AIR);
+        }
+    } else if (world_get_block(world, &before) == BLOCK_AIR) {
+        world_set_block(world, &before, block);
+    }
+}
+
+static void usage(void) {
+    printf("Usage: ./client [options] [<address> <port>]\r\n");
+    printf("Options: --render-distance <chunks> --adaptive "
+           "--world <directory> --trace <file>\r\n");
+}
+
+/* Value of the option at ARGV[*ARGI], which must have one. */
+static const char *option_value(int argc, char **argv, int *argi) {
+    if (*argi + 1 >= argc) {
+        printf("Missing value for %s.\r\n", argv[*argi]);
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    return argv[++*argi];
+}
+
+/* Sends connects to the server until it accepts, or gives up. Once it
+   challenges, they echo its cookie. */
+static int handshake(int socket) {
+    unsigned char datagram[TRANSPORT_CONNECT_SIZE];
+    struct timeval timeout;
+    size_t size;
+    int attempt;
+
+    size = transport_write_control(datagram, DATAGRAM_CONNECT, 0);
+
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = (suseconds_t)(CONNECT_INTERVAL * 1000000.0);
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    for (attempt = 0; attempt < CONNECT_ATTEMPTS; attempt++) {
+        unsigned char reply[TRANSPORT_CONNECT_SIZE];
+        ssize_t len;
+
+        if (send(socket, datagram, size, 0) == -1) {
+            return FALSE;
+        }
+
+        len = recv(socket, reply, sizeof(reply), 0);
+
+        /* Refused right away if nothing listens, like a TCP connect. */
+        if (len == -1 && errno == ECONNREFUSED) {
+            return FALSE;
+        }
+
+        if (len <= 0) {
+            continue;
+        }
+
+        switch (transport_type(reply, (size_t)len)) {
+            case DATAGRAM_CHALLENGE:
+                size = transport_write_control(datagram, DATAGRAM_CONNECT,
+                                               transport_cookie(reply));
+                break;
+
+            case DATAGRAM_ACCEPT:
+                return TRUE;
+
+            case DATAGRAM_CLOSE:
+                printf("Server is full.\r\n");
+                return FALSE;
+
+            default:
+                break;
+        }
+    }
+
+    return FALSE;
+}
+
 int main(int argc, char **argv) {
-    int multiplayer = FALSE;
-    char *host;
-    int port;
-
-    window_t window;
-    renderer_t renderer;
-    camera_t camera;
-    world_t world;
+    int multiplayer        = FALSE;
+    int render_distance    = RENDER_DISTANCE_DEFAULT;
+    int is_adaptive        = FALSE;
+    const char *world_path = "world";
+    const char *trace_path = "trace.json";
+    char *host             = NULL;
+    int port               = 0;
+    int argi;
+
+    struct window window;
+    struct renderer renderer;
+    struct camera camera;
+    struct world world;
+    struct client client;
+    struct region_store regions;
     double last_time;
+    int status = EXIT_SUCCESS;
 
     int server_socket;
     struct sockaddr_in server_addr;
 
-    unsigned char *in_buf = NULL;
-    size_t in_count       = 0;
-    size_t in_cap         = 0;
-
-    remote_player_t *remote_players = NULL;
-    size_t remote_player_count      = 0;
-    size_t remote_player_cap        = 0;
-
-    struct vector3 last_pos;
+    struct transport transport;
+    sent_state_t sent_states[TRANSPORT_WINDOW];
+    received_snapshot_t snapshots[TRANSPORT_WINDOW];
+    uint16_t latest_sequence = 0;
+    int has_snapshot         = FALSE;
+    double clock_offset      = 0.0;
+
+    struct array remote_players;
+    remote_player_t *remote_player_elems = NULL;
+
+    struct vector3 sent_pos;
+    double sent_time;
+
+    struct profiler_zone zones[PROFILE_LINES];
+    size_t zone_count     = 0;
+    uint64_t summary_time = 0;
+    int is_profiling      = FALSE;
+    int was_f3_pressed    = FALSE;
+    int was_f4_pressed    = FALSE;
+    int was_q_pressed     = FALSE;
+    int was_e_pressed     = FALSE;
+
+    remote_players.size     = 0;
+    remote_players.capacity = 0;
+
+    memset(sent_states, 0, sizeof(sent_states));
+    memset(snapshots, 0, sizeof(snapshots));
+
+    profiler_init();
+    profiler_thread_name("main");
+
+    /* Parse options, then server hostname and port. */
+    for (argi = 1; argi < argc; argi++) {
+        if (strcmp(argv[argi], "--render-distance") == 0) {
+            render_distance = atoi(option_value(argc, argv, &argi));
+        } else if (strcmp(argv[argi], "--world") == 0) {
+            world_path = option_value(argc, argv, &argi);
+        } else if (strcmp(argv[argi], "--trace") == 0) {
+            trace_path = option_value(argc, argv, &argi);
+        } else if (strcmp(argv[argi], "--adaptive") == 0) {
+            is_adaptive = TRUE;
+        } else if (strncmp(argv[argi], "--", 2) == 0) {
+            printf("Unknown option %s.\r\n", argv[argi]);
+            usage();
+            exit(EXIT_FAILURE);
+        } else if (!host) {
+            host = argv[argi];
+        } else if (!multiplayer) {
+            port        = atoi(argv[argi]);
+            multiplayer = TRUE;
+        } else {
+            printf("Unexpected argument %s.\r\n", argv[argi]);
+            usage();
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    /* Parse server hostname and port. */
-    if (argc >= 3) {
-        host        = argv[1];
-        port        = atoi(argv[2]);
-        multiplayer = TRUE;
+    if (host && !multiplayer) {
+        printf("Missing port for %s.\r\n", host);
+        usage();
+        exit(EXIT_FAILURE);
     }
 
     if (multiplayer) {
-        server_socket = socket(AF_INET, SOCK_STREAM, 0);
+        server_socket = socket(AF_INET, SOCK_DGRAM, 0);
         if (server_socket == -1) {
             printf("Failed to create socket.\r\n");
             exit(EXIT_FAILURE);
@@ -104,8 +614,10 @@ int main(int argc, char **argv) {
         server_addr.sin_port   = htons((unsigned short)port);
         inet_pton(AF_INET, host, &server_addr.sin_addr);
 
+        /* Connected, so only the server's datagrams arrive. */
         if (connect(server_socket, (struct sockaddr *)&server_addr,
-                    sizeof(server_addr)) == -1) {
+                    sizeof(server_addr)) == -1 ||
+            !handshake(server_socket)) {
             printf("Failed to connect to server.\r\n");
             exit(EXIT_FAILURE);
         }
@@ -114,14 +626,30 @@ int main(int argc, char **argv) {
             printf("Failed to set socket to non-blocking.\r\n");
             exit(EXIT_FAILURE);
         }
+
+        transport_init(&transport);
+
+        /* The server checks the version before anything else. */
+        {
+            unsigned char hello[3];
+
+            hello[0] = PACKET_HELLO;
+            hello[1] = (unsigned char)(PROTOCOL_VERSION & 0xFF);
+            hello[2] = (unsigned char)(PROTOCOL_VERSION >> 8);
+
+            transport_send(&transport, hello, sizeof(hello));
+        }
     } else {
         printf("Launching in singleplayer mode.\r\n");
         printf("To connect to a server, start the client with the server "
                "address and port.\r\n");
-        printf("Example: ./client <address> <port>\r\n");
+        usage();
+        printf("Q breaks the block looked at, E places cobblestone.\r\n");
+        printf("F3 toggles the profile, F4 saves a trace of the last "
+               "frames.\r\n");
     }
 
-    window_init(&window);
+    window_init(&window, "Minecraft", 900, 600);
 
     glEnable(GL_DEPTH_TEST);
 
@@ -132,72 +660,113 @@ int main(int argc, char **argv) {
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 #ifndef NDEBUG
-    glEnable(GL_DEBUG_OUTPUT);
-    glDebugMessageCallback(opengl_debug_callback, NULL);
+    /* Core since 4.3, the context may be older. */
+    if (GLAD_GL_VERSION_4_3) {
+        glEnable(GL_DEBUG_OUTPUT);
+        glDebugMessageCallback(opengl_debug_callback, NULL);
+    }
 #endif
 
+    client_init(&client);
+    region_store_init(&regions, world_path);
+
     camera_init(&camera);
-    world_init(&world);
+    world_init(&world, &client, &regions, render_distance, is_adaptive);
     renderer_init(&renderer);
 
-    last_pos  = camera.pos;
     last_time = elapsed_time_seconds();
 
-    while (TRUE) {
+    sent_pos  = camera.pos;
+    sent_time = last_time - 1.0 / SEND_RATE;
+
+    /* Runs until the window is closed or the server is lost. */
+    while (status == EXIT_SUCCESS && !window.is_closed) {
         double current_time;
         float delta_time;
         int vertical = 16;
-        char recv_buf[1024];
-        ssize_t bytes_received;
         size_t i;
 
+        PROFILE_BEGIN("frame");
+
         /* Network Receive */
 
         if (multiplayer) {
-            bytes_received =
-                recv(server_socket, recv_buf, sizeof(recv_buf), 0);
-            if (bytes_received > 0) {
-                ARR_APPEND_N(in_buf, in_count, in_cap, (size_t)bytes_received,
-                             recv_buf);
-
-                while (in_count >= sizeof(client_update_pkt_t)) {
-                    client_update_pkt_t pkt;
-                    int found = FALSE;
-
-                    memcpy(&pkt, in_buf, sizeof(client_update_pkt_t));
-
-                    for (i = 0; i < remote_player_count; i++) {
-                        if (remote_players[i].socket == pkt.sender_socket) {
-                            remote_players[i].position   = pkt.position;
-                            remote_players[i].velocity   = pkt.velocity;
-                            remote_players[i].head_yaw   = pkt.head_yaw;
-                            remote_players[i].head_pitch = pkt.head_pitch;
-
-                            found = TRUE;
-                            break;
-                        }
-                    }
-
-                    if (!found) {
-                        remote_player_t rp;
-                        rp.socket     = pkt.sender_socket;
-                        rp.position   = pkt.position;
-                        rp.velocity   = pkt.velocity;
-                        rp.head_yaw   = pkt.head_yaw;
-                        rp.head_pitch = pkt.head_pitch;
-                        ARR_APPEND(remote_players, remote_player_count,
-                                   remote_player_cap, &rp);
-                    }
-
-                    ARR_REMOVE_N(in_buf, in_count, 0,
-                                 sizeof(client_update_pkt_t));
+            unsigned char datagram[TRANSPORT_MTU];
+            double receive_time = elapsed_time_seconds();
+            ssize_t len;
+
+            while ((len = recv(server_socket, datagram, sizeof(datagram),
+                               0)) >= 0) {
+                uint16_t sequence;
+                size_t used;
+                int result;
+                int type = transport_type(datagram, (size_t)len);
+
+                if (type == DATAGRAM_CLOSE) {
+                    printf("Disconnected by server.\r\n");
+                    status = EXIT_FAILURE;
+                    break;
+                }
+
+                /* Late accepts are dropped too. */
+                if (type != DATAGRAM_DATA) {
+                    continue;
+                }
+
+                used = transport_read(&transport, datagram, (size_t)len,
+                                     &sequence);
+                if (used == TRANSPORT_MALFORMED) {
+                    printf("Malformed packet from server.\r\n");
+                    status = EXIT_FAILURE;
+                    break;
+                }
+
+                /* Until the hello arrives, datagrams only carry acks. */
+                if (used == (size_t)len) {
+                    transport_ack(&transport, sequence);
+                    continue;
+                }
+
+                result = read_snapshot(datagram + used, (size_t)len - used,
+                                       sequence, snapshots);
+                if (result == SNAPSHOT_MALFORMED) {
+                    printf("Malformed packet from server.\r\n");
+                    status = EXIT_FAILURE;
+                    break;
+                }
+                if (result == SNAPSHOT_NO_BASE) {
+                    continue;
+                }
+
+                transport_ack(&transport, sequence);
+
+                /* Snapshots that arrive late are kept as bases only. */
+                if (!has_snapshot ||
+                    transport_is_newer(sequence, latest_sequence)) {
+                    const received_snapshot_t *snapshot =
+                        &snapshots[sequence & WINDOW_MASK];
+                    double server_time =
+                        (double)snapshot->time / PROTOCOL_TICK_RATE;
+                    double offset = receive_time - server_time;
+
+                    clock_offset = has_snapshot
+                                       ? smooth_offset(clock_offset, offset)
+                                       : offset;
+
+                    show_snapshot(snapshot, server_time, &remote_players,
+                                  &remote_player_elems);
+
+                    latest_sequence = sequence;
+                    has_snapshot    = TRUE;
                 }
             }
         }
 
         /* Update. */
 
+        PROFILE_BEGIN("window_update");
         window_update(&window);
+        PROFILE_END();
 
         current_time = elapsed_time_seconds();
         delta_time   = (float)(current_time - last_time);
@@ -205,29 +774,90 @@ int main(int argc, char **argv) {
 
         camera_update(&camera, &window, delta_time);
 
-        world_update(&world, &camera);
+        /* Edit, before world_update remeshes the edits. */
 
-        /* Network Send */
-        if (multiplayer) {
-            if (delta_time > 0.0f) {
-                client_update_pkt_t pkt;
-
-                pkt.sender_socket = -1;
-                pkt.position      = camera.pos;
-                pkt.velocity.VEC_X =
-                    (camera.pos.VEC_X - last_pos.VEC_X) / delta_time;
-                pkt.velocity.VEC_Y =
-                    (camera.pos.VEC_Y - last_pos.VEC_Y) / delta_time;
-                pkt.velocity.VEC_Z =
-                    (camera.pos.VEC_Z - last_pos.VEC_Z) / delta_time;
-                pkt.head_yaw   = camera.yaw;
-                pkt.head_pitch = camera.pitch;
-
-                send(server_socket, &pkt, sizeof(client_update_pkt_t), 0);
-
-                last_pos = camera.pos;
+        if (window_is_key_pressed(&window, XK_Q) && !was_q_pressed) {
+            edit_block(&world, &camera, BLOCK_AIR);
+        }
+        was_q_pressed = window_is_key_pressed(&window, XK_Q);
+
+        if (window_is_key_pressed(&window, XK_E) && !was_e_pressed) {
+            edit_block(&world, &camera, BLOCK_COBBLESTONE);
+        }
+        was_e_pressed = window_is_key_pressed(&window, XK_E);
+
+        PROFILE_BEGIN("world_update");
+        world_update(&world, &camera, delta_time);
+        PROFILE_END();
+
+        /* Profile. */
+
+        if (window_is_key_pressed(&window, XK_F3) && !was_f3_pressed) {
+            is_profiling = !is_profiling;
+            summary_time = 0;
+        }
+        was_f3_pressed = window_is_key_pressed(&window, XK_F3);
+
+        if (window_is_key_pressed(&window, XK_F4) && !was_f4_pressed) {
+            if (profiler_export(trace_path)) {
+                printf("Saved trace to %s.\r\n", trace_path);
+            } else {
+                printf("Failed to save trace to %s.\r\n", trace_path);
             }
         }
+        was_f4_pressed = window_is_key_pressed(&window, XK_F4);
+
+        /* Summarizing walks every thread's events, so not every frame. */
+        if (is_profiling &&
+            profiler_now() - summary_time >= PROFILE_INTERVAL) {
+            summary_time = profiler_now();
+            zone_count   = profiler_summary(zones, PROFILE_LINES, 1.0);
+        }
+
+        /* Network Send. The state at the send rate, as a delta against the
+           newest the server acked, so a lost datagram costs nothing but its
+           tick. */
+        if (multiplayer && current_time - sent_time >= 1.0 / SEND_RATE) {
+            unsigned char datagram[TRANSPORT_MTU];
+            const sent_state_t *base;
+            sent_state_t *sent;
+            struct player_state state;
+            struct player_state zero;
+            struct vector3 velocity;
+            float interval = (float)(current_time - sent_time);
+            uint16_t sequence;
+            size_t size;
+
+            velocity.VEC_X = (camera.pos.VEC_X - sent_pos.VEC_X) / interval;
+            velocity.VEC_Y = (camera.pos.VEC_Y - sent_pos.VEC_Y) / interval;
+            velocity.VEC_Z = (camera.pos.VEC_Z - sent_pos.VEC_Z) / interval;
+
+            protocol_quantize(&state, &camera.pos, &velocity, camera.yaw,
+                              camera.pitch);
+            memset(&zero, 0, sizeof(zero));
+
+            size = transport_write(&transport, datagram, current_time,
+                                   &sequence);
+            base = get_state_base(&transport, sent_states);
+
+            datagram[size]     = PACKET_STATE;
+            datagram[size + 1] =
+                base ? (unsigned char)(uint16_t)(sequence - base->sequence)
+                     : 0;
+            size += 2 + protocol_write_state(datagram + size + 2, &state,
+                                             base ? &base->state : &zero);
+
+            sent           = &sent_states[sequence & WINDOW_MASK];
+            sent->is_used  = TRUE;
+            sent->sequence = sequence;
+            sent->state    = state;
+
+            /* Refused or not, it is sent again next time. */
+            send(server_socket, datagram, size, 0);
+
+            sent_pos  = camera.pos;
+            sent_time = current_time;
+        }
 
         /* Draw. */
 
@@ -238,39 +868,88 @@ int main(int argc, char **argv) {
         renderer_draw_world(&renderer, &world, &camera);
 
         if (multiplayer) {
-            for (i = 0; i < remote_player_count; i++) {
-                renderer_draw_player(&renderer, &remote_players[i].position,
-                                     &remote_players[i].velocity,
-                                     remote_players[i].head_yaw,
-                                     remote_players[i].head_pitch, &camera);
+            PROFILE_BEGIN("draw_players");
+            for (i = 0; i < remote_players.size; i++) {
+                remote_player_t *player = &remote_player_elems[i];
+
+                interpolate_player(player, current_time - clock_offset -
+                                               INTERPOLATE_DELAY);
+
+                renderer_draw_player(&renderer, &player->position,
+                                     &player->velocity, player->head_yaw,
+                                     player->head_pitch, &camera);
             }
+            PROFILE_END();
         }
 
         if (multiplayer) {
-            renderer_gui_draw_text(&renderer, 10, 10, "Minecraft Multiplayer");
+            renderer_gui_text(&renderer, 10, 10, "Minecraft Multiplayer");
         } else {
-            renderer_gui_draw_text(&renderer, 10, 10,
-                                   "Minecraft Singleplayer");
+            renderer_gui_text(&renderer, 10, 10, "Minecraft Singleplayer");
         }
 
-        renderer_gui_draw_text(&renderer, 10, 10, "Minecraft");
-        renderer_gui_draw_text(&renderer, 10, 10 + vertical, "Frame %.1fms",
-                               (double)(delta_time * 1000.0f));
-
-        renderer_gui_draw_text(&renderer, 10, 10 + 3 * vertical, "X %.2f",
-                               (double)camera.pos.VEC_X);
-        renderer_gui_draw_text(&renderer, 10, 10 + 4 * vertical, "Y %.2f",
-                               (double)camera.pos.VEC_Y);
-        renderer_gui_draw_text(&renderer, 10, 10 + 5 * vertical, "Z %.2f",
-                               (double)camera.pos.VEC_Z);
-
-        renderer_gui_draw_text(&renderer, 10, 10 + 7 * vertical, "Yaw %.2f",
-                               (double)camera.yaw);
-        renderer_gui_draw_text(&renderer, 10, 10 + 8 * vertical, "Pitch %.2f",
-                               (double)camera.pitch);
+        renderer_gui_text(&renderer, 10, 10 + vertical, "Frame %.1fms",
+                          (double)(delta_time * 1000.0f));
+
+        renderer_gui_text(&renderer, 10, 10 + 2 * vertical,
+                          "Render distance %d", world.render_distance);
+
+        renderer_gui_text(&renderer, 10, 10 + 3 * vertical, "X %.2f",
+                          (double)camera.pos.VEC_X);
+        renderer_gui_text(&renderer, 10, 10 + 4 * vertical, "Y %.2f",
+                          (double)camera.pos.VEC_Y);
+        renderer_gui_text(&renderer, 10, 10 + 5 * vertical, "Z %.2f",
+                          (double)camera.pos.VEC_Z);
+
+        renderer_gui_text(&renderer, 10, 10 + 7 * vertical, "Yaw %.2f",
+                          (double)camera.yaw);
+        renderer_gui_text(&renderer, 10, 10 + 8 * vertical, "Pitch %.2f",
+                          (double)camera.pitch);
+
+        /* Time per second spent in each zone, over the last second. */
+        if (is_profiling) {
+            renderer_gui_text(&renderer, 10, 10 + 10 * vertical,
+                              "Profile, F4 saves %s", trace_path);
+
+            for (i = 0; i < zone_count; i++) {
+                renderer_gui_text(
+                    &renderer, 10, 10 + (11 + (int)i) * vertical,
+                    "%s %s %.1fms/s max %.2fms x%lu", zones[i].thread,
+                    zones[i].name, zones[i].total_ms, zones[i].max_ms,
+                    zones[i].count);
+            }
+        }
 
         renderer_gui_flush(&renderer, &camera);
 
+        PROFILE_BEGIN("swap_buffers");
         glXSwapBuffers(window.display, window.handle);
+        PROFILE_END();
+
+        PROFILE_END();
+    }
+
+    if (multiplayer) {
+        unsigned char datagram[TRANSPORT_CONNECT_SIZE];
+
+        /* So the server drops the player now rather than at its timeout.
+           Lost or not, nothing waits for it. */
+        if (status == EXIT_SUCCESS) {
+            send(server_socket, datagram,
+                 transport_write_control(datagram, DATAGRAM_CLOSE, 0), 0);
+        }
+
+        close(server_socket);
     }
+
+    /* Chunks changed since the last autosave are queued, and written before
+       the writer stops. Workers may still be running tasks, so the world
+       is not freed, the process exits around them. */
+    printf("Saving world...\r\n");
+    world_shutdown(&world);
+    region_store_free(&regions);
+
+    window_free(&window);
+
+    return status;
 }
@@ -0,0 +1,313 @@
+#include "client/mesher.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include "macros.h"
+#include "vector.h"
+#include "client/light.h"
+
+static const float cube_positions[72] = {
+    -0.5f, -0.5f, 0.5f,  0.5f,  -0.5f, 0.5f,  0.5f,  0.5f,  0.5f,
+    -0.5f, 0.5f,  0.5f,  0.5f,  -0.5f, -0.5f, -0.5f, -0.5f, -0.5f,
+    -0.5f, 0.5f,  -0.5f, 0.5f,  0.5f,  -0.5f, -0.5f, -0.5f, -0.5f,
+    -0.5f, -0.5f, 0.5f,  -0.5f, 0.5f,  0.5f,  -0.5f, 0.5f,  -0.5f,
+    0.5f,  -0.5f, 0.5f,  0.5f,  -0.5f, -0.5f, 0.5f,  0.5f,  -0.5f,
+    0.5f,  0.5f,  0.5f,  -0.5f, 0.5f,  0.5f,  0.5f,  0.5f,  0.5f,
+    0.5f,  0.5f,  -0.5f, -0.5f, 0.5f,  -0.5f, -0.5f, -0.5f, -0.5f,
+    0.5f,  -0.5f, -0.5f, 0.5f,  -0.5f, 0.5f,  -0.5f, -0.5f, 0.5f};
+
+static const float cube_uvs[48] = {
+    0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,
+    1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f,
+    0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,
+    1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f};
+
+const int mesher_face_dirs[6][3] = {
+    {0, 0, 1}, {0, 0, -1}, {-1, 0, 0}, {1, 0, 0}, {0, 1, 0}, {0, -1, 0},
+};
+
+static const float cube_shadows[6] = {0.90f, 0.60f, 0.50f,
+                                      0.70f, 1.00f, 0.55f};
+
+/* Shade of a face corner with 0 to 3 of the blocks around it open. */
+static const float corner_shades[4] = {0.50f, 0.70f, 0.85f, 1.00f};
+
+/* BLOCKS is the chunk padded with its neighbors' border blocks. */
+static int is_face_visible(const unsigned char *blocks, int x, int y, int z,
+                           int dir_x, int dir_y, int dir_z) {
+    return blocks[INDEX_3D(x + 1 + dir_x, y + 1 + dir_y, z + 1 + dir_z,
+                           CHUNK_PADDED)] == BLOCK_AIR;
+}
+
+/* Ambient occlusion at the corner of the face of block X, Y, Z facing DIR,
+   in direction CORNER from the block center: the number of open blocks of
+   the two beside the corner and the one diagonal to it, in front of the
+   face. Two solid sides hide the diagonal, and count as fully occluded. */
+static int get_corner_occlusion(const unsigned char *blocks, int x, int y,
+                                int z, const int *dir, const int *corner) {
+    int diagonal[3];
+    int side_a[3];
+    int side_b[3];
+    int tangent_a = -1;
+    int tangent_b = -1;
+    int is_solid_a;
+    int is_solid_b;
+    int is_solid_diagonal;
+    int axis;
+
+    /* The corner's component along the normal is the face direction. */
+    diagonal[0] = x + 1 + corner[0];
+    diagonal[1] = y + 1 + corner[1];
+    diagonal[2] = z + 1 + corner[2];
+
+    for (axis = 0; axis < 3; axis++) {
+        side_a[axis] = diagonal[axis];
+        side_b[axis] = diagonal[axis];
+
+        if (dir[axis] == 0) {
+            if (tangent_a < 0) {
+                tangent_a = axis;
+            } else {
+                tangent_b = axis;
+            }
+        }
+    }
+
+    side_a[tangent_b] -= corner[tangent_b];
+    side_b[tangent_a] -= corner[tangent_a];
+
+    is_solid_a = blocks[INDEX_3D(side_a[0], side_a[1], side_a[2],
+                                 CHUNK_PADDED)] != BLOCK_AIR;
+    is_solid_b = blocks[INDEX_3D(side_b[0], side_b[1], side_b[2],
+                                 CHUNK_PADDED)] != BLOCK_AIR;
+    is_solid_diagonal = blocks[INDEX_3D(diagonal[0], diagonal[1],
+                                        diagonal[2], CHUNK_PADDED)] !=
+                        BLOCK_AIR;
+
+    if (is_solid_a && is_solid_b) {
+        return 0;
+    }
+
+    return 3 - is_solid_a - is_solid_b - is_solid_diagonal;
+}
+
+/* Source start, length and destination start along one axis of the part of
+   a chunk at OFFSET -1, 0 or 1 that lands in the padded arrays. */
+static void gather_span(int offset, int *src, int *len, int *dst) {
+    if (offset < 0) {
+        *src = CHUNK_SIZE - 1;
+        *len = 1;
+        *dst = 0;
+    } else if (offset > 0) {
+        *src = 0;
+        *len = 1;
+        *dst = CHUNK_SIZE + 1;
+    } else {
+        *src = 0;
+        *len = CHUNK_SIZE;
+        *dst = 1;
+    }
+}
+
+void mesher_gather(const unsigned char *const *blocks,
+                   const unsigned char *const *light,
+                   unsigned char *padded_blocks,
+                   unsigned char *padded_light) {
+    int i;
+
+    assert(blocks);
+    assert(light);
+    assert(padded_blocks);
+    assert(padded_light);
+
+    memset(padded_blocks, BLOCK_AIR, CHUNK_PADDED_TOTAL);
+    memset(padded_light, LIGHT_PACK(LIGHT_MAX, 0), CHUNK_PADDED_TOTAL);
+
+    for (i = 0; i < 27; i++) {
+        int src_x, src_y, src_z;
+        int len_x, len_y, len_z;
+        int dst_x, dst_y, dst_z;
+        int y;
+        int z;
+
+        gather_span(i % 3 - 1, &src_x, &len_x, &dst_x);
+        gather_span(i / 3 % 3 - 1, &src_y, &len_y, &dst_y);
+        gather_span(i / 9 - 1, &src_z, &len_z, &dst_z);
+
+        /* Rows along x are contiguous in both arrays. */
+        for (z = 0; z < len_z; z++) {
+            for (y = 0; y < len_y; y++) {
+                size_t dst = (size_t)INDEX_3D(dst_x, dst_y + y, dst_z + z,
+                                              CHUNK_PADDED);
+                size_t src = (size_t)INDEX_3D(src_x, src_y + y, src_z + z,
+                                              CHUNK_SIZE);
+
+                if (blocks[i]) {
+                    memcpy(padded_blocks + dst, blocks[i] + src,
+                           (size_t)len_x);
+                }
+                if (light[i]) {
+                    memcpy(padded_light + dst, light[i] + src,
+                           (size_t)len_x);
+                }
+            }
+        }
+    }
+}
+
+void mesher_build(const unsigned char *blocks, const unsigned char *light,
+                  const struct coord *coord, int options,
+                  struct chunk_mesh *mesh) {
+    int x;
+    int y;
+    int z;
+
+    assert(blocks);
+    assert(light);
+    assert(coord);
+    assert(mesh);
+
+    mesh->vertex_count = 0;
+    memset(mesh->index_counts, 0, sizeof(mesh->index_counts));
+
+    /* Batch block faces into mesh. */
+
+    for (x = 0; x < CHUNK_SIZE; x++) {
+        for (y = 0; y < CHUNK_SIZE; y++) {
+            for (z = 0; z < CHUNK_SIZE; z++) {
+                unsigned char block;
+                struct vector2 uv_offset;
+                int face_idx;
+
+                block = blocks[INDEX_3D(x + 1, y + 1, z + 1, CHUNK_PADDED)];
+
+                if (block == BLOCK_AIR) {
+                    continue;
+                }
+
+                uv_offset.VEC_U = 0.0f;
+                uv_offset.VEC_V = 0.0f;
+
+                switch (block) {
+                    case BLOCK_STONE:
+                        uv_offset.VEC_U = 16.0f / 256.0f;
+                        break;
+
+                    case BLOCK_BEDROCK:
+                        uv_offset.VEC_U = 16.0f / 256.0f;
+                        uv_offset.VEC_V = 16.0f / 256.0f;
+                        break;
+
+                    /* The atlas has no glowstone, gold stands in. */
+                    case BLOCK_GLOWSTONE:
+                        uv_offset.VEC_U = 112.0f / 256.0f;
+                        uv_offset.VEC_V = 16.0f / 256.0f;
+                        break;
+                }
+
+                /* For each face. */
+
+                for (face_idx = 0; face_idx < 6; face_idx++) {
+                    int dir_x;
+                    int dir_y;
+                    int dir_z;
+
+                    dir_x = mesher_face_dirs[face_idx][0];
+                    dir_y = mesher_face_dirs[face_idx][1];
+                    dir_z = mesher_face_dirs[face_idx][2];
+
+                    if (is_face_visible(blocks, x, y, z, dir_x, dir_y,
+                                        dir_z)) {
+                        static const unsigned int face_indices[6] = {
+                            0, 1, 2, 2, 3, 0};
+                        static const unsigned int flipped_indices[6] = {
+                            1, 2, 3, 3, 0, 1};
+
+                        const unsigned int *indices;
+                        int occlusion[4] = {3, 3, 3, 3};
+                        unsigned char light_level;
+                        int i;
+
+                        /* Ambient occlusion of each corner. */
+
+                        for (i = 0; i < 4 && (options & MESHER_AO); i++) {
+                            size_t p;
+                            int corner[3];
+                            int axis;
+
+                            p = (size_t)face_idx * 12 + (size_t)i * 3;
+
+                            for (axis = 0; axis < 3; axis++) {
+                                corner[axis] =
+                                    (cube_positions[p + (size_t)axis] > 0.0f)
+                                        ? 1
+                                        : -1;
+                            }
+
+                            occlusion[i] = get_corner_occlusion(
+                                blocks, x, y, z, mesher_face_dirs[face_idx],
+                                corner);
+                        }
+
+                        /* Split the quad along its brighter diagonal, so
+                           occlusion interpolates the same whichever way the
+                           face is oriented. */
+                        indices = (occlusion[0] + occlusion[2] <
+                                   occlusion[1] + occlusion[3])
+                                      ? flipped_indices
+                                      : face_indices;
+
+                        /* Append indices. */
+
+                        for (i = 0; i < 6; i++) {
+                            size_t num_vertices;
+                            unsigned int index;
+
+                            num_vertices = mesh->vertex_count;
+
+                            index = (unsigned int)num_vertices + indices[i];
+
+                            mesh->indices[face_idx]
+                                         [mesh->index_counts[face_idx]++] =
+                                             index;
+                        }
+
+                        /* Append vertices. */
+
+                        light_level = (unsigned char)LIGHT_LEVEL(
+                            light[INDEX_3D(x + 1 + dir_x, y + 1 + dir_y,
+                                           z + 1 + dir_z, CHUNK_PADDED)]);
+
+                        for (i = 0; i < 4; i++) {
+                            float *vertex;
+                            size_t p;
+                            size_t t;
+
+                            p = (size_t)face_idx * 12 + (size_t)i * 3;
+                            t = (size_t)face_idx * 8 + (size_t)i * 2;
+
+                            vertex    = &mesh->vertices[mesh->vertex_count *
+                                                        MESHER_VERTEX_FLOATS];
+                            vertex[0] = (float)(coord->x * CHUNK_SIZE) +
+                                        cube_positions[p + 0] + (float)x;
+                            vertex[1] = (float)(coord->y * CHUNK_SIZE) +
+                                        cube_positions[p + 1] + (float)y;
+                            vertex[2] = (float)(coord->z * CHUNK_SIZE) +
+                                        cube_positions[p + 2] + (float)z;
+                            vertex[3] =
+                                cube_uvs[t + 0] / 16.0f + uv_offset.VEC_U;
+                            vertex[4] =
+                                cube_uvs[t + 1] / 16.0f + uv_offset.VEC_V;
+                            vertex[5] = cube_shadows[face_idx] *
+                                        corner_shades[occlusion[i]];
+                            vertex[6] = (float)light_level;
+
+                            mesh->vertex_count++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef MESHER_H
+#define MESHER_H
+
+#include <stddef.h>
+
+#include "coord.h"
+#include "client/block.h"
+
+/* Floats per vertex: position, UV, shade and light level. */
+#define MESHER_VERTEX_FLOATS 7
+
+/* Vertices and indices of a chunk mesh, at most one face per block and
+   direction. */
+#define MESHER_VERTICES_MAX     (CHUNK_TOTAL * 6 * 4)
+#define MESHER_FACE_INDICES_MAX (CHUNK_TOTAL * 6)
+
+/* Mesher options. */
+#define MESHER_AO 0x1 /* Per-vertex ambient occlusion. */
+
+/* Face directions, in the order mesh indices are grouped by. */
+extern const int mesher_face_dirs[6][3];
+
+/* Chunk mesh, independent of the GPU buffers it is uploaded to. */
+struct chunk_mesh {
+    float vertices[MESHER_VERTICES_MAX * MESHER_VERTEX_FLOATS];
+    size_t vertex_count;
+
+    /* Indices of each face direction, in mesher_face_dirs order. */
+    unsigned int indices[6][MESHER_FACE_INDICES_MAX];
+    size_t index_counts[6];
+};
+
+/* Fills PADDED_BLOCKS and PADDED_LIGHT, CHUNK_PADDED wide cubes, with the
+   chunk at the center of the 27 in BLOCKS and LIGHT and a one block border
+   from the others, indexed INDEX_3D(x + 1, y + 1, z + 1, 3) by their offset
+   from the center. NULL blocks are air and NULL light is full skylight. */
+void mesher_gather(const unsigned char *const *blocks,
+                   const unsigned char *const *light,
+                   unsigned char *padded_blocks,
+                   unsigned char *padded_light);
+
+/* Meshes the chunk at COORD from its padded blocks and light, with
+   MESHER_* OPTIONS. Thread-safe. */
+void mesher_build(const unsigned char *blocks, const unsigned char *light,
+                  const struct coord *coord, int options,
+                  struct chunk_mesh *mesh);
+
+#endif
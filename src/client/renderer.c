@@ -1,16 +1,21 @@
 #include "client/renderer.h"
 
 #include <stdlib.h>
-#include <varargs.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <assert.h>
 #include <math.h>
 
 #include "matrix.h"
+#include "profiler.h"
 #include "client/opengl.h"
 #include "client/world.h"
 
 #define GLYPH_PIXELS 12
 
+/* Glyphs drawn per frame, the size of the GUI buffers. */
+#define MAX_GLYPHS 1024
+
 static const float sky_vertices[] = {-1.0f, 1.0f, -1.0f, -1.0f, 1.0f, -1.0f,
                                      -1.0f, 1.0f, 1.0f,  -1.0f, 1.0f, 1.0f};
 
@@ -122,14 +127,9 @@ void renderer_init(struct renderer *renderer) {
 
     /* GUI. */
 
-    renderer->glyphs = malloc(1024 * sizeof(struct glyph));
-    if (!renderer->glyphs) {
-        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
-        exit(EXIT_FAILURE);
-    }
-
-    renderer->glyphs_info.size = 0;
-    renderer->glyphs_info.cap  = 1024;
+    renderer->glyphs.size     = 0;
+    renderer->glyphs.capacity = 0;
+    renderer->glyph_elems     = NULL;
 
     renderer->charset_shader_program =
         opengl_shader_program("res/charset_vs.glsl", "res/charset_fs.glsl");
@@ -144,7 +144,7 @@ void renderer_init(struct renderer *renderer) {
 
     glGenBuffers(1, &renderer->charset_vertex_buffer);
     glBindBuffer(GL_ARRAY_BUFFER, renderer->charset_vertex_buffer);
-    glBufferData(GL_ARRAY_BUFFER, 1024 * 4 * 4 * sizeof(float), NULL,
+    glBufferData(GL_ARRAY_BUFFER, MAX_GLYPHS * 4 * 4 * sizeof(float), NULL,
                  GL_DYNAMIC_DRAW); /* Pre allocate. */
 
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float),
@@ -156,8 +156,9 @@ void renderer_init(struct renderer *renderer) {
 
     glGenBuffers(1, &renderer->charset_element_buffer);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer->charset_element_buffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 1024 * 6 * sizeof(unsigned int),
-                 NULL, GL_DYNAMIC_DRAW); /* Pre allocate. */
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 MAX_GLYPHS * 6 * sizeof(unsigned int), NULL,
+                 GL_DYNAMIC_DRAW); /* Pre allocate. */
 }
 
 void renderer_draw_sky(const struct renderer *renderer,
@@ -167,6 +168,8 @@ void renderer_draw_sky(const struct renderer *renderer,
     assert(renderer);
     assert(camera);
 
+    PROFILE_BEGIN("draw_sky");
+
     glDepthMask(GL_FALSE);
 
     glUseProgram(renderer->sky_shader_program);
@@ -179,17 +182,39 @@ void renderer_draw_sky(const struct renderer *renderer,
     glDrawArrays(GL_TRIANGLES, 0, 6);
 
     glDepthMask(GL_TRUE);
+
+    PROFILE_END();
 }
 
 void renderer_draw_chunk(const struct renderer *renderer,
                          const struct chunk *chunk,
                          const struct camera *camera) {
     struct matrix4 mvp_matrix;
+    GLsizei counts[6];
+    const void *offsets[6];
+    GLsizei range_count;
+    int i;
 
     assert(renderer);
     assert(chunk);
     assert(camera);
 
+    /* Face direction ranges that can face the camera. */
+    range_count = 0;
+    for (i = 0; i < 6; i++) {
+        if (chunk->face_counts[i] > 0 &&
+            chunk_is_facing(chunk, i, &camera->pos)) {
+            counts[range_count]  = (GLsizei)chunk->face_counts[i];
+            offsets[range_count] =
+                (const void *)(chunk->face_offsets[i] * sizeof(unsigned int));
+            range_count++;
+        }
+    }
+
+    if (range_count == 0) {
+        return;
+    }
+
     glUseProgram(renderer->chunk_shader_program);
 
     glUniform1i(renderer->uniform_locations.chunk.texture, 0);
@@ -207,19 +232,26 @@ void renderer_draw_chunk(const struct renderer *renderer,
 
     glBindVertexArray(chunk->vertex_array);
 
-    glDrawElements(GL_TRIANGLES, (GLsizei)chunk->index_count, GL_UNSIGNED_INT,
-                   0);
+    glMultiDrawElements(GL_TRIANGLES, counts, GL_UNSIGNED_INT, offsets,
+                        range_count);
 }
 
 void renderer_draw_world(const struct renderer *renderer, struct world *world,
                          struct camera *camera) {
-    int i;
+    size_t i;
 
-    for (i = 0; i < LOADED_CHUNKS_TOTAL; i++) {
-        if (world->loaded_chunks[i]) {
-            renderer_draw_chunk(renderer, world->loaded_chunks[i], camera);
+    PROFILE_BEGIN("draw_world");
+
+    /* The ring is walked in memory order. */
+    for (i = 0; i < world->ring->total; i++) {
+        const struct chunk *chunk = world->ring->slots[i];
+
+        if (chunk && chunk->index_count > 0) {
+            renderer_draw_chunk(renderer, chunk, camera);
         }
     }
+
+    PROFILE_END();
 }
 
 static void draw_box(const struct renderer *renderer, const float *uvs,
@@ -472,8 +504,8 @@ void renderer_draw_player(const struct renderer *renderer,
     draw_box(renderer, player_left_leg_uvs, &left_leg_matrix, camera);
 }
 
-void renderer_gui_draw_text(struct renderer *renderer, int x, int y,
-                            const char *fmt, ...) {
+void renderer_gui_text(struct renderer *renderer, int x, int y,
+                       const char *fmt, ...) {
     va_list args;
     char buf[512];
     int len;
@@ -496,13 +528,13 @@ void renderer_gui_draw_text(struct renderer *renderer, int x, int y,
         struct glyph glyph;
         char c = buf[i];
 
-        if (gui->glyph_count == MAX_GLYPHS) {
+        if (renderer->glyphs.size == MAX_GLYPHS) {
             break;
         }
 
-        glyph.charset.x   = c % 16;
-        glyph.charset.y   = c / 16;
-        glyph.charset.w   = glyph_widths[(size_t)c];
+        glyph.charset.x   = (unsigned char)c % 16;
+        glyph.charset.y   = (unsigned char)c / 16;
+        glyph.charset.w   = glyph_widths[(unsigned char)c];
         glyph.screen.x    = cursor;
         glyph.screen.y    = y;
         glyph.screen.w    = GLYPH_PIXELS * glyph.charset.w / 8;
@@ -511,7 +543,7 @@ void renderer_gui_draw_text(struct renderer *renderer, int x, int y,
         glyph.color.VEC_G = 1.0f;
         glyph.color.VEC_B = 1.0f;
 
-        gui->glyphs[gui->glyph_count++] = glyph;
+        ARRAY_APPEND(renderer->glyphs, renderer->glyph_elems, glyph);
 
         cursor += glyph.screen.w;
     }
@@ -531,13 +563,15 @@ void renderer_gui_flush(struct renderer *renderer,
     assert(renderer);
     assert(camera);
 
-    if (gui->glyph_count == 0) {
+    if (renderer->glyphs.size == 0) {
         return;
     }
 
+    PROFILE_BEGIN("gui_flush");
+
     /* Batch glyphs. */
 
-    for (glyph_idx = 0; glyph_idx < gui->glyph_count; glyph_idx++) {
+    for (glyph_idx = 0; glyph_idx < renderer->glyphs.size; glyph_idx++) {
         struct glyph glyph;
         size_t num_vertices;
         float x0;
@@ -552,7 +586,7 @@ void renderer_gui_flush(struct renderer *renderer,
         float v1;
         float *vertex;
 
-        glyph = gui->glyphs[glyph_idx];
+        glyph = renderer->glyph_elems[glyph_idx];
 
         /* Append indices. */
 
@@ -603,9 +637,9 @@ void renderer_gui_flush(struct renderer *renderer,
 
     /* Upload mesh to GPU. */
 
-    glBindVertexArray(gui->vertex_array);
+    glBindVertexArray(renderer->charset_vertex_array);
 
-    glBindBuffer(GL_ARRAY_BUFFER, gui->vertex_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->charset_vertex_buffer);
     glBufferData(GL_ARRAY_BUFFER,
                  (GLsizeiptr)(mesh_vertex_count * sizeof(float)), NULL,
                  GL_DYNAMIC_DRAW); /* Buffer orphaning. */
@@ -613,7 +647,7 @@ void renderer_gui_flush(struct renderer *renderer,
                     (GLsizeiptr)(mesh_vertex_count * sizeof(float)),
                     mesh_vertices);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gui->element_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer->charset_element_buffer);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER,
                  (GLsizeiptr)(mesh_index_count * sizeof(unsigned int)), NULL,
                  GL_DYNAMIC_DRAW); /* Buffer orphaning. */
@@ -623,17 +657,19 @@ void renderer_gui_flush(struct renderer *renderer,
 
     /* Draw. */
 
-    glUseProgram(gui->shader_program);
+    glUseProgram(renderer->charset_shader_program);
 
-    glUniform1i(gui->charset_texture_uniform_loc, 0);
+    glUniform1i(renderer->uniform_locations.charset.texture, 0);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gui->charset_texture);
+    glBindTexture(GL_TEXTURE_2D, renderer->charset_texture);
 
-    glBindVertexArray(gui->vertex_array);
+    glBindVertexArray(renderer->charset_vertex_array);
 
     glDrawElements(GL_TRIANGLES, (GLsizei)mesh_index_count, GL_UNSIGNED_INT,
                    0);
 
     /* Reset. */
-    gui->glyph_count = 0;
+    renderer->glyphs.size = 0;
+
+    PROFILE_END();
 }
\ No newline at end of file
@@ -83,6 +83,8 @@ struct renderer {
     } uniform_locations;
 };
 
+struct world;
+
 void renderer_init(struct renderer *renderer);
 
 void renderer_draw_sky(const struct renderer *renderer,
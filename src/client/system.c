@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "client/system.h"
 
 #include <stdlib.h>
@@ -55,19 +57,26 @@ static const int context_attribs[] = {GLX_CONTEXT_MAJOR_VERSION_ARB,
 
 static char key_state[256] = {0};
 
+/* Wall time, as clock() stops while the process waits on the swap or the
+   network. */
 double elapsed_time_seconds(void) {
-    static clock_t start   = 0;
+    static struct timespec start;
     static int initialized = 0;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
     if (!initialized) {
-        start       = clock();
+        start       = now;
         initialized = 1;
     }
 
-    return (double)(clock() - start) / CLOCKS_PER_SEC;
+    return (double)(now.tv_sec - start.tv_sec) +
+           (double)(now.tv_nsec - start.tv_nsec) / 1e9;
 }
 
-void window_init(struct window *window) {
+void window_init(struct window *window, const char *title, int width,
+                 int height) {
     int framebuffer_count;
     GLXFBConfig *framebuffer_configs;
     GLXFBConfig framebuffer_config;
@@ -75,8 +84,7 @@ void window_init(struct window *window) {
     Window root;
     XSetWindowAttributes window_attribs;
     glXCreateContextAttribsARBProc glXCreateContextAttribsARB = 0;
-    GLXContext context;
-
+    window->is_closed = FALSE;
     window->display = XOpenDisplay(NULL);
 
     if (!window->display) {
@@ -114,8 +122,8 @@ void window_init(struct window *window) {
         StructureNotifyMask | KeyPressMask | KeyReleaseMask;
 
     window->handle = XCreateWindow(
-        window->display, root, 0, 0, 800, 600, 0, visual_info->depth,
-        InputOutput, visual_info->visual,
+        window->display, root, 0, 0, (unsigned int)width, (unsigned int)height,
+        0, visual_info->depth, InputOutput, visual_info->visual,
         CWBorderPixel | CWColormap | CWEventMask, &window_attribs);
 
     if (!window->handle) {
@@ -125,7 +133,15 @@ void window_init(struct window *window) {
 
     XFree(visual_info);
 
-    XStoreName(window->display, window->handle, "Minecraft");
+    XStoreName(window->display, window->handle, title);
+
+    /* Closing the window asks, rather than dropping the connection, so the
+       world is saved. */
+    window->delete_message =
+        XInternAtom(window->display, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(window->display, window->handle, &window->delete_message,
+                    1);
+
     XMapWindow(window->display, window->handle);
 
     glXCreateContextAttribsARB =
@@ -137,16 +153,16 @@ void window_init(struct window *window) {
         exit(EXIT_FAILURE);
     }
 
-    context = glXCreateContextAttribsARB(window->display, framebuffer_config,
-                                         0, True, context_attribs);
+    window->context = glXCreateContextAttribsARB(
+        window->display, framebuffer_config, 0, True, context_attribs);
     XSync(window->display, False);
 
-    if (!context) {
+    if (!window->context) {
         printf("Failed to create OpenGL 3.3 context.\r\n");
         exit(EXIT_FAILURE);
     }
 
-    glXMakeCurrent(window->display, window->handle, context);
+    glXMakeCurrent(window->display, window->handle, window->context);
 
     if (!gladLoadGLLoader((GLADloadproc)glXGetProcAddressARB)) {
         printf("Failed to initialize GLAD.\r\n");
@@ -178,10 +194,23 @@ void window_update(struct window *window) {
                 }
                 key_state[event.xkey.keycode] = 0;
                 break;
+
+            case ClientMessage:
+                if ((Atom)event.xclient.data.l[0] == window->delete_message) {
+                    window->is_closed = TRUE;
+                }
+                break;
         }
     }
 }
 
+void window_free(struct window *window) {
+    glXMakeCurrent(window->display, None, NULL);
+    glXDestroyContext(window->display, window->context);
+    XDestroyWindow(window->display, window->handle);
+    XCloseDisplay(window->display);
+}
+
 int window_is_key_pressed(const struct window *window, KeySym keysym) {
     KeyCode code = XKeysymToKeycode(window->display, keysym);
     if (!code) {
@@ -3,17 +3,25 @@
 
 #include <X11/Xlib.h>
 #include <X11/keysym.h>
+#include <glad/glad.h>
+#include <GL/glx.h>
 
 double elapsed_time_seconds(void);
 
 struct window {
     Display *display;
     Window handle;
+    GLXContext context;
+
+    /* Sent by the window manager when the window is closed. */
+    Atom delete_message;
+    int is_closed;
 };
 
 void window_init(struct window *window, const char *title, int width,
                  int height);
 void window_update(struct window *window);
+void window_free(struct window *window);
 
 int window_is_key_pressed(const struct window *window, KeySym keysym);
 
@@ -0,0 +1,112 @@
+#include "client/terrain.h"
+
+#include <assert.h>
+
+#include "macros.h"
+#include "client/block.h"
+
+static float noise3d(float x, float y, float z, int seed) {
+    int xi, yi, zi;
+    int i;
+    float xf, yf, zf;
+    float c[2][2][2];
+    float u, v, w;
+    float a, b, c1, d;
+
+    xi = (int)x;
+    yi = (int)y;
+    zi = (int)z;
+
+    if (x < 0) {
+        xi--;
+    }
+    if (y < 0) {
+        yi--;
+    }
+    if (z < 0) {
+        zi--;
+    }
+
+    xf = x - (float)xi;
+    yf = y - (float)yi;
+    zf = z - (float)zi;
+
+    u = xf * xf * (3.0f - 2.0f * xf);
+    v = yf * yf * (3.0f - 2.0f * yf);
+    w = zf * zf * (3.0f - 2.0f * zf);
+
+    for (i = 0; i < 8; i++) {
+        int xx = xi + (i & 1);
+        int yy = yi + ((i >> 1) & 1);
+        int zz = zi + ((i >> 2) & 1);
+        int n;
+
+        n = xx * 15731 + yy * 789221 + zz * 1376312589;
+        n = ((n << 13) ^ n) ^ seed;
+
+        c[i & 1][(i >> 1) & 1][(i >> 2) & 1] =
+            1.0f - ((float)((n * (n * n * 15731 + 789221) + 1376312589) &
+                            0x7fffffff) /
+                    1073741824.0f);
+    }
+
+    a  = c[0][0][0] * (1.0f - u) + c[1][0][0] * u;
+    b  = c[0][1][0] * (1.0f - u) + c[1][1][0] * u;
+    c1 = c[0][0][1] * (1.0f - u) + c[1][0][1] * u;
+    d  = c[0][1][1] * (1.0f - u) + c[1][1][1] * u;
+
+    a = a * (1.0f - v) + b * v;
+    b = c1 * (1.0f - v) + d * v;
+
+    return a * (1.0f - w) + b * w;
+}
+
+void terrain_generate(unsigned char *blocks, const struct coord *coord,
+                      unsigned int seed) {
+    int noise_seed = (int)(seed & 0x7FFFFFFF);
+    int x;
+    int y;
+    int z;
+
+    assert(blocks);
+    assert(coord);
+
+    for (x = 0; x < CHUNK_SIZE; x++) {
+        for (y = 0; y < CHUNK_SIZE; y++) {
+            for (z = 0; z < CHUNK_SIZE; z++) {
+                unsigned char *block;
+                struct coord block_coord;
+                float noise_x;
+                float noise_y;
+                float noise_z;
+                float n;
+
+                block = &blocks[INDEX_3D(x, y, z, CHUNK_SIZE)];
+
+                block_coord.x = coord->x * CHUNK_SIZE + x;
+                block_coord.y = coord->y * CHUNK_SIZE + y;
+                block_coord.z = coord->z * CHUNK_SIZE + z;
+
+                noise_x = (float)(coord->x * CHUNK_SIZE + x) / 25.0f;
+                noise_y = (float)(coord->y * CHUNK_SIZE + y) / 25.0f;
+                noise_z = (float)(coord->z * CHUNK_SIZE + z) / 25.0f;
+
+                n = noise3d(noise_x, noise_y, noise_z, noise_seed);
+
+                if (block_coord.y < -10) {
+                    if (n > 0.2f) {
+                        *block = BLOCK_AIR;
+                    } else {
+                        *block = BLOCK_BEDROCK;
+                    }
+                } else {
+                    if (n > 0.28f) {
+                        *block = (n > 0.29f) ? BLOCK_STONE : BLOCK_GRASS_BLOCK;
+                    } else {
+                        *block = BLOCK_AIR;
+                    }
+                }
+            }
+        }
+    }
+}
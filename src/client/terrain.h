@@ -0,0 +1,11 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include "coord.h"
+
+/* Fills BLOCKS with the terrain of the chunk at COORD. The same coordinate
+   and SEED always give the same blocks. Thread-safe. */
+void terrain_generate(unsigned char *blocks, const struct coord *coord,
+                      unsigned int seed);
+
+#endif
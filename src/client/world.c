@@ -5,322 +5,1281 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
 #include <assert.h>
 
 #include "macros.h"
+#include "atomic.h"
+#include "codec.h"
+#include "profiler.h"
+#include "client/mesher.h"
+#include "client/terrain.h"
 
-static struct chunk *get_chunk(struct world *world,
+static int ring_mod(int value, int len) {
+    int mod = value % len;
+
+    return (mod < 0) ? mod + len : mod;
+}
+
+static size_t ring_index(const struct chunk_ring *ring,
+                         const struct coord *coord) {
+    return (size_t)INDEX_3D(ring_mod(coord->x, ring->len),
+                            ring_mod(coord->y, ring->len),
+                            ring_mod(coord->z, ring->len), ring->len);
+}
+
+static struct chunk_ring *ring_create(int render_distance) {
+    struct chunk_ring *ring;
+
+    ring = malloc(sizeof(struct chunk_ring));
+    if (!ring) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    ring->len   = (render_distance + UNLOAD_MARGIN) * 2 + 1;
+    ring->total = (size_t)ring->len * (size_t)ring->len * (size_t)ring->len;
+    ring->slots = calloc(ring->total, sizeof(struct chunk *));
+    if (!ring->slots) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    return ring;
+}
+
+static void ring_destroy(void *ptr, void *context) {
+    struct chunk_ring *ring = (struct chunk_ring *)ptr;
+
+    (void)context;
+
+    free(ring->slots);
+    free(ring);
+}
+
+static int is_in_range(const struct coord *coord, const struct coord *center,
+                       int distance) {
+    return abs(coord->x - center->x) <= distance &&
+           abs(coord->y - center->y) <= distance &&
+           abs(coord->z - center->z) <= distance;
+}
+
+/* Lock-free. Workers must call this between epoch_enter and epoch_exit and
+   stop using the returned chunk after epoch_exit. */
+static struct chunk *get_chunk(const struct world *world,
                                const struct coord *coord) {
+    const struct chunk_ring *ring;
+    struct chunk *chunk;
+
     assert(world);
     assert(coord);
 
-    /* TODO: Return chunk from map. */
+    /* The slot may hold another chunk congruent to the coordinate. */
+    ring  = ATOMIC_LOAD_ACQUIRE(&world->ring);
+    chunk = ATOMIC_LOAD_ACQUIRE(&ring->slots[ring_index(ring, coord)]);
+    if (chunk && chunk->coord.x == coord->x && chunk->coord.y == coord->y &&
+        chunk->coord.z == coord->z) {
+        return chunk;
+    }
 
-    return NULL;
+    return chunk_map_get(&world->chunks, coord);
 }
 
-static float noise3d(float x, float y, float z) {
-    int xi, yi, zi;
-    int i;
-    float xf, yf, zf;
-    float c[2][2][2];
-    float u, v, w;
-    float a, b, c1, d;
+static void destroy_chunk(void *ptr, void *context) {
+    struct chunk *chunk = (struct chunk *)ptr;
+
+    (void)context;
 
-    xi = (int)x;
-    yi = (int)y;
-    zi = (int)z;
+    chunk_free(chunk);
+    free(chunk);
+}
+
+/* Destroys a blocks or light array replaced while workers may gather it. */
+static void destroy_array(void *ptr, void *context) {
+    (void)context;
+
+    free(ptr);
+}
 
-    if (x < 0) {
-        xi--;
+/* Copy of the CHUNK_TOTAL values of ARRAY, to be changed and swapped in. */
+static unsigned char *copy_array(const unsigned char *array) {
+    unsigned char *copy;
+
+    copy = malloc(CHUNK_TOTAL);
+    if (!copy) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
     }
-    if (y < 0) {
-        yi--;
+
+    memcpy(copy, array, CHUNK_TOTAL);
+
+    return copy;
+}
+
+/* Queue a changed chunk for saving. The payload is copied, so the chunk may
+   be destroyed right after. It is queued uncompressed, the region writer
+   thread encodes it, so autosaves and evictions only cost the copy here. */
+static void save_chunk(struct world *world, struct chunk *chunk) {
+    unsigned char payload[CHUNK_PAYLOAD_SIZE];
+
+    if (!chunk->is_generated || chunk->is_saved) {
+        return;
     }
-    if (z < 0) {
-        zi--;
+
+    memcpy(payload, chunk->blocks, CHUNK_TOTAL);
+    memcpy(payload + CHUNK_TOTAL, chunk->light, CHUNK_TOTAL);
+
+    region_store_write(world->regions, &chunk->coord, REGION_COMPRESSION_NONE,
+                       payload, sizeof(payload));
+
+    chunk->is_saved = TRUE;
+}
+
+static void loaded(struct region_read *read);
+
+/* Insert a placeholder chunk and queue reading it from its region file. The
+   reads are submitted together at the end of the sweep. */
+static void load_chunk(struct world *world, const struct coord *coord) {
+    struct chunk *chunk;
+    struct region_read *read;
+    size_t idx;
+
+    assert(world);
+    assert(coord);
+
+    chunk = calloc(1, sizeof(struct chunk));
+    if (!chunk) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
     }
+    chunk->coord = *coord;
 
-    xf = x - (float)xi;
-    yf = y - (float)yi;
-    zf = z - (float)zi;
+    /* Coordinate is set before the chunk is published to workers. */
+    idx = ring_index(world->ring, coord);
+    assert(!world->ring->slots[idx]);
+    ATOMIC_STORE_RELEASE(&world->ring->slots[idx], chunk);
 
-    u = xf * xf * (3.0f - 2.0f * xf);
-    v = yf * yf * (3.0f - 2.0f * yf);
-    w = zf * zf * (3.0f - 2.0f * zf);
+    read = calloc(1, sizeof(struct region_read));
+    if (!read) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    read->coord    = *coord;
+    read->cap      = CODEC_BOUND(CHUNK_PAYLOAD_SIZE);
+    read->complete = loaded;
+    read->context  = world;
 
-    for (i = 0; i < 8; i++) {
-        int xx = xi + (i & 1);
-        int yy = yi + ((i >> 1) & 1);
-        int zz = zi + ((i >> 2) & 1);
-        int n;
+    ARRAY_APPEND(world->loads, world->load_elems, read);
+}
 
-        n = xx * 15731 + yy * 789221 + zz * 1376312589;
-        n = (n << 13) ^ n;
+static void lru_unlink(struct world *world, struct chunk *chunk) {
+    if (chunk->lru_prev) {
+        chunk->lru_prev->lru_next = chunk->lru_next;
+    } else {
+        world->lru_head = chunk->lru_next;
+    }
 
-        c[i & 1][(i >> 1) & 1][(i >> 2) & 1] =
-            1.0f - ((float)((n * (n * n * 15731 + 789221) + 1376312589) &
-                            0x7fffffff) /
-                    1073741824.0f);
+    if (chunk->lru_next) {
+        chunk->lru_next->lru_prev = chunk->lru_prev;
+    } else {
+        world->lru_tail = chunk->lru_prev;
     }
 
-    a  = c[0][0][0] * (1.0f - u) + c[1][0][0] * u;
-    b  = c[0][1][0] * (1.0f - u) + c[1][1][0] * u;
-    c1 = c[0][0][1] * (1.0f - u) + c[1][0][1] * u;
-    d  = c[0][1][1] * (1.0f - u) + c[1][1][1] * u;
+    chunk->lru_prev = NULL;
+    chunk->lru_next = NULL;
+}
+
+static void lru_push_front(struct world *world, struct chunk *chunk) {
+    chunk->lru_prev = NULL;
+    chunk->lru_next = world->lru_head;
 
-    a = a * (1.0f - v) + b * v;
-    b = c1 * (1.0f - v) + d * v;
+    if (world->lru_head) {
+        world->lru_head->lru_prev = chunk;
+    } else {
+        world->lru_tail = chunk;
+    }
 
-    return a * (1.0f - w) + b * w;
+    world->lru_head = chunk;
+}
+
+/* Take a chunk leaving the loaded volume, before the caller clears its ring
+   slot. Generated chunks move to the warm cache first, so readers never miss
+   them, evicting the least recently unloaded one when full. Evicted chunks
+   are saved if they changed. They and placeholders are destroyed by
+   epoch_reclaim once no worker can still hold a pointer to them. */
+static void unload_chunk(struct world *world, struct chunk *chunk) {
+    assert(world);
+    assert(chunk);
+
+    if (!chunk->is_generated) {
+        epoch_retire(&world->epoch, chunk, destroy_chunk, NULL);
+        return;
+    }
+
+    chunk_map_insert(&world->chunks, &chunk->coord, chunk);
+    lru_push_front(world, chunk);
+
+    if (world->chunks.size > CHUNK_CACHE_CAP) {
+        struct chunk *evicted = world->lru_tail;
+
+        lru_unlink(world, evicted);
+        chunk_map_remove(&world->chunks, &evicted->coord);
+        save_chunk(world, evicted);
+        epoch_retire(&world->epoch, evicted, destroy_chunk, NULL);
+    }
+}
+
+/* Move a cached chunk back into its ring slot, mesh and all. */
+static void restore_chunk(struct world *world, struct chunk *chunk) {
+    size_t idx;
+
+    assert(world);
+    assert(chunk);
+
+    idx = ring_index(world->ring, &chunk->coord);
+    assert(!world->ring->slots[idx]);
+
+    /* Publish in the ring before unlinking, so readers never miss it. */
+    ATOMIC_STORE_RELEASE(&world->ring->slots[idx], chunk);
+    chunk_map_remove(&world->chunks, &chunk->coord);
+    lru_unlink(world, chunk);
+}
+
+/* Unload chunks that left the retained volume and load the ones that entered
+   render distance, from the warm cache if possible. Runs on the render
+   thread, the only writer of chunk storage. */
+static void sweep(struct world *world) {
+    struct chunk_ring *ring;
+    struct chunk *chunk;
+    struct coord coord;
+    int distance;
+    size_t i;
+
+    ring     = world->ring;
+    distance = world->render_distance;
+
+    /* Unloading first frees every ring slot the loads below need, since the
+       ring is as wide as the retained volume. */
+    for (i = 0; i < ring->total; i++) {
+        chunk = ring->slots[i];
+
+        if (chunk && !is_in_range(&chunk->coord, &world->center,
+                                  distance + UNLOAD_MARGIN)) {
+            unload_chunk(world, chunk);
+            ATOMIC_STORE_RELEASE(&ring->slots[i], (struct chunk *)NULL);
+        }
+    }
+
+    for (coord.z = world->center.z - distance;
+         coord.z <= world->center.z + distance; coord.z++) {
+        for (coord.y = world->center.y - distance;
+             coord.y <= world->center.y + distance; coord.y++) {
+            for (coord.x = world->center.x - distance;
+                 coord.x <= world->center.x + distance; coord.x++) {
+                chunk = get_chunk(world, &coord);
+
+                if (!chunk) {
+                    load_chunk(world, &coord);
+                } else if (ring->slots[ring_index(ring, &coord)] != chunk) {
+                    restore_chunk(world, chunk);
+                }
+            }
+        }
+    }
+
+    region_io_submit(&world->io, world->load_elems, world->loads.size);
+    world->loads.size = 0;
 }
 
 static void generate(void *context) {
-    const struct world *world;
+    struct world *world;
     struct coord coord;
+    size_t reader;
 
     struct gen_result *result;
 
-    int x;
-    int y;
-    int z;
-
     assert(context);
 
     world = ((struct gen_context *)context)->world;
     coord = ((struct gen_context *)context)->coord;
 
     /* The chunk might have been unloaded while this task was enqueued. */
-    pthread_mutex_lock(&world->mutex);
-    if (!get_chunk(&world, &coord)) {
-        pthread_mutex_unlock(&world->mutex);
+    reader = epoch_enter(&world->epoch);
+    if (!get_chunk(world, &coord)) {
+        epoch_exit(&world->epoch, reader);
+        free(context);
         return;
     }
-    pthread_mutex_unlock(&world->mutex);
+    epoch_exit(&world->epoch, reader);
 
-    result = malloc(sizeof(struct generation_result));
+    result = malloc(sizeof(struct gen_result));
     if (!result) {
         printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
         exit(EXIT_FAILURE);
     }
     result->coord = coord;
 
-    for (x = 0; x < CHUNK_SIZE; x++) {
-        for (y = 0; y < CHUNK_SIZE; y++) {
-            for (z = 0; z < CHUNK_SIZE; z++) {
-                unsigned char *block;
-                struct coord block_coord;
-                float noise_x;
-                float noise_y;
-                float noise_z;
-                float n;
-
-                block = &result->blocks[INDEX_3D(x, y, z, CHUNK_SIZE)];
-
-                block_coord.x = coord.x * CHUNK_SIZE + x;
-                block_coord.y = coord.y * CHUNK_SIZE + y;
-                block_coord.z = coord.z * CHUNK_SIZE + z;
-
-                noise_x = (float)(coord.x * CHUNK_SIZE + x) / 25.0f;
-                noise_y = (float)(coord.y * CHUNK_SIZE + y) / 25.0f;
-                noise_z = (float)(coord.z * CHUNK_SIZE + z) / 25.0f;
-
-                n = noise3d(noise_x, noise_y, noise_z);
-
-                if (block_coord.y < -10) {
-                    if (n > 0.2f) {
-                        *block = BLOCK_AIR;
-                    } else {
-                        *block = BLOCK_BEDROCK;
-                    }
-                } else {
-                    if (n > 0.28f) {
-                        *block = (n > 0.29f) ? BLOCK_STONE : BLOCK_GRASS;
-                    } else {
-                        *block = BLOCK_AIR;
-                    }
-                }
-            }
-        }
-    }
+    result->is_saved = FALSE;
+
+    PROFILE_BEGIN("generate");
+    terrain_generate(result->blocks, &coord, WORLD_SEED);
+    PROFILE_END();
+    memset(result->light, 0, sizeof(result->light));
 
     /* Push result onto queue. */
     pthread_mutex_lock(&world->mutex);
-    QUEUE_PUSH(world->gens_elems, world->gens, &result);
+    RING_BUFFER_PUSH(world->gens, world->gen_elems, result);
     pthread_mutex_unlock(&world->mutex);
 
     free(context);
 }
 
+/* Returns TRUE if READ holds a valid chunk, copied into RESULT. */
+static int decode_saved(const struct region_read *read,
+                        struct gen_result *result) {
+    unsigned char payload[CHUNK_PAYLOAD_SIZE];
+    size_t size;
+
+    if (read->compression == REGION_COMPRESSION_CODEC) {
+        size = codec_decode(read->payload, read->size, payload,
+                            sizeof(payload));
+    } else if (read->compression == REGION_COMPRESSION_NONE &&
+               read->size == CHUNK_PAYLOAD_SIZE) {
+        size = read->size;
+        memcpy(payload, read->payload, size);
+    } else {
+        size = 0;
+    }
+
+    if (size != CHUNK_PAYLOAD_SIZE) {
+        return FALSE;
+    }
+
+    memcpy(result->blocks, payload, CHUNK_TOTAL);
+    memcpy(result->light, payload + CHUNK_TOTAL, CHUNK_TOTAL);
+
+    return TRUE;
+}
+
+/* Region read completion, on the I/O thread. Saved chunks complete straight
+   into the result queue, the others are generated on a worker. */
+static void loaded(struct region_read *read) {
+    struct world *world;
+    struct gen_context *context;
+    struct gen_result *result;
+    size_t reader;
+
+    assert(read);
+
+    world = (struct world *)read->context;
+
+    /* The chunk might have been unloaded while it was being read, then
+       neither decoding nor generating it is of use. */
+    reader = epoch_enter(&world->epoch);
+    if (!get_chunk(world, &read->coord)) {
+        epoch_exit(&world->epoch, reader);
+        free(read);
+        return;
+    }
+    epoch_exit(&world->epoch, reader);
+
+    if (read->size > 0) {
+        result = malloc(sizeof(struct gen_result));
+        if (!result) {
+            printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+            exit(EXIT_FAILURE);
+        }
+        result->coord = read->coord;
+
+        if (decode_saved(read, result)) {
+            result->is_saved = TRUE;
+
+            pthread_mutex_lock(&world->mutex);
+            RING_BUFFER_PUSH(world->gens, world->gen_elems, result);
+            pthread_mutex_unlock(&world->mutex);
+
+            free(read);
+            return;
+        }
+
+        free(result);
+    }
+
+    context = malloc(sizeof(struct gen_context));
+    if (!context) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    context->coord = read->coord;
+    context->world = world;
+
+    client_submit(world->client, generate, context);
+
+    free(read);
+}
+
 static const struct coord neighbor_offsets[6] = {
     {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
 
+int world_gather(const struct world *world, const struct coord *coord,
+                 unsigned char *padded_blocks, unsigned char *padded_light) {
+    const unsigned char *blocks[27];
+    const unsigned char *light[27];
+    struct coord offset;
+    int is_loaded = FALSE;
+    int i         = 0;
+
+    assert(world);
+    assert(coord);
+
+    for (offset.z = -1; offset.z <= 1; offset.z++) {
+        for (offset.y = -1; offset.y <= 1; offset.y++) {
+            for (offset.x = -1; offset.x <= 1; offset.x++) {
+                struct coord chunk_coord;
+                struct chunk *chunk;
+                int is_generated = FALSE;
+                int is_lit       = FALSE;
+
+                chunk_coord = coord_add(coord, &offset);
+                chunk       = get_chunk(world, &chunk_coord);
+
+                if (offset.x == 0 && offset.y == 0 && offset.z == 0) {
+                    is_loaded = chunk != NULL;
+                }
+
+                /* Pairs with the releases in chunk_init, apply_light and
+                   world_set_block, the arrays are complete once their flag
+                   is seen set, and replaced ones stay valid until
+                   epoch_exit. */
+                if (chunk) {
+                    is_generated = ATOMIC_LOAD_ACQUIRE(&chunk->is_generated);
+                    is_lit       = ATOMIC_LOAD_ACQUIRE(&chunk->is_lit);
+                }
+
+                blocks[i] = is_generated ?
+                    ATOMIC_LOAD_ACQUIRE(&chunk->blocks) : NULL;
+                light[i]  = is_lit ? ATOMIC_LOAD_ACQUIRE(&chunk->light) : NULL;
+                i++;
+            }
+        }
+    }
+
+    mesher_gather(blocks, light, padded_blocks, padded_light);
+
+    return is_loaded;
+}
+
+/* Mesh a chunk on a worker. */
 static void mesh(void *void_context) {
     struct mesh_context *context;
     struct mesh_result *result;
+    struct chunk_mesh *chunk_mesh;
+    size_t reader;
+    int face;
 
-    int i;
-    int x;
-    int y;
-    int z;
+    /* Chunk blocks and light padded with adjacent blocks from neighboring
+       chunks. */
+    unsigned char blocks[CHUNK_PADDED_TOTAL];
+    unsigned char light[CHUNK_PADDED_TOTAL];
 
-    struct chunk *chunk;
-    struct coord neighbor_coords[6];
+    assert(void_context);
+
+    context = (struct mesh_context *)void_context;
+
+    /* Populate block array. No lock is taken, the epoch keeps the chunk and
+       its neighbors alive until we are done copying. Edits racing the copy
+       mark the chunk dirty again, so it is meshed once more after this. */
+
+    PROFILE_BEGIN("gather");
+    reader = epoch_enter(&context->world->epoch);
+
+    if (!world_gather(context->world, &context->coord, blocks, light)) {
+        epoch_exit(&context->world->epoch, reader);
+        PROFILE_END();
+        free(context);
+        return;
+    }
+
+    epoch_exit(&context->world->epoch, reader);
+    PROFILE_END();
+
+    /* Too large for a worker stack. */
+    chunk_mesh = malloc(sizeof(struct chunk_mesh));
+    result     = calloc(1, sizeof(struct mesh_result));
+    if (!chunk_mesh || !result) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    result->coord  = context->coord;
+    result->serial = context->serial;
+
+    PROFILE_BEGIN("mesh");
+    mesher_build(blocks, light, &context->coord, MESHER_AO, chunk_mesh);
+    PROFILE_END();
+
+    if (chunk_mesh->vertex_count > 0) {
+        ARRAY_APPEND_N(result->vertices, result->vertex_elems,
+                       chunk_mesh->vertex_count * MESHER_VERTEX_FLOATS,
+                       chunk_mesh->vertices);
+    }
+
+    for (face = 0; face < 6; face++) {
+        result->index_counts[face] = chunk_mesh->index_counts[face];
+
+        if (chunk_mesh->index_counts[face] > 0) {
+            ARRAY_APPEND_N(result->indices, result->index_elems,
+                           chunk_mesh->index_counts[face],
+                           chunk_mesh->indices[face]);
+        }
+    }
 
-    /* Chunk blocks padded with adjacent blocks from neighboring chunks. */
-    unsigned char
-        blocks[(CHUNK_SIZE + 2) * (CHUNK_SIZE + 2) * (CHUNK_SIZE + 2)] = {0};
+    free(chunk_mesh);
+
+    pthread_mutex_lock(&context->world->mutex);
+    RING_BUFFER_PUSH(context->world->meshes, context->world->mesh_elems,
+                     result);
+    pthread_mutex_unlock(&context->world->mutex);
+
+    free(context);
+}
+
+static void relight(void *void_context) {
+    struct light_context *context;
+    const unsigned char *borders[6];
+    int i;
 
     assert(void_context);
 
-    context = (struct mesh_context *)void_context;
+    context = (struct light_context *)void_context;
 
     for (i = 0; i < 6; i++) {
-        neighbor_coords[i] = coord_add(&context->coord, &neighbor_offsets[i]);
+        borders[i] = context->has_border[i] ? context->borders[i] : NULL;
     }
 
-    /* Populate block array. */
+    PROFILE_BEGIN("light");
+    if (context->is_full) {
+        light_compute(context->blocks, borders, context->light);
+    } else {
+        light_update(context->blocks, borders, context->light,
+                     context->edits, context->edit_count);
+    }
+    PROFILE_END();
 
     pthread_mutex_lock(&context->world->mutex);
+    RING_BUFFER_PUSH(context->world->lights, context->world->light_elems,
+                     context);
+    pthread_mutex_unlock(&context->world->mutex);
+}
 
-    chunk = get_chunk(&context->world, &context->coord);
-    if (!chunk) {
-        pthread_mutex_unlock(&context->world->mutex);
-        free(context);
-        return;
+/* Snapshot CHUNK with the facing layers of its lit neighbors and relight it
+   on a worker. Light that goes stale meanwhile is recorded for the next
+   task. */
+static void submit_light(struct world *world, struct chunk *chunk) {
+    struct light_context *context;
+    int i;
+
+    assert(world);
+    assert(chunk);
+    assert(!chunk->light_task);
+
+    context = malloc(sizeof(struct light_context));
+    if (!context) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
     }
-    for (y = 0; y < CHUNK_SIZE; y++) {
-        for (z = 0; z < CHUNK_SIZE; z++) {
-            for (x = 0; x < CHUNK_SIZE; x++) {
-                blocks[INDEX_3D(x + 1, y + 1, z + 1, CHUNK_SIZE + 2)] =
-                    chunk->blocks[INDEX_3D(x, y, z, CHUNK_SIZE)];
-            }
-        }
+    context->coord = chunk->coord;
+    context->world = world;
+
+    /* 0 means no task. */
+    if (++world->light_serial == 0) {
+        world->light_serial++;
     }
-    chunk = get_chunk(context->world, neighbor_coords[0]);
-    if (chunk) {
-        for (y = 0; y < CHUNK_SIZE; y++) {
-            for (z = 0; z < CHUNK_SIZE; z++) {
-                blocks[INDEX_3D(17, y + 1, z + 1, CHUNK_SIZE + 2)] =
-                    chunk->blocks[INDEX_3D(0, y, z, CHUNK_SIZE)];
-            }
+    context->serial   = world->light_serial;
+    chunk->light_task = world->light_serial;
+
+    memcpy(context->blocks, chunk->blocks, CHUNK_TOTAL);
+    memcpy(context->light, chunk->light, CHUNK_TOTAL);
+
+    for (i = 0; i < 6; i++) {
+        struct coord neighbor_coord;
+        struct chunk *neighbor;
+
+        neighbor_coord = coord_add(&chunk->coord, &neighbor_offsets[i]);
+        neighbor       = get_chunk(world, &neighbor_coord);
+
+        context->has_border[i] = neighbor && neighbor->is_lit;
+        if (context->has_border[i]) {
+            light_border(neighbor->light, i ^ 1, context->borders[i]);
         }
     }
-    chunk = get_chunk(context->world, neighbor_coords[1]);
-    if (chunk) {
-        for (y = 0; y < CHUNK_SIZE; y++) {
-            for (z = 0; z < CHUNK_SIZE; z++) {
-                blocks[INDEX_3D(0, y + 1, z + 1, CHUNK_SIZE + 2)] =
-                    chunk->blocks[INDEX_3D(CHUNK_SIZE - 1, y, z, CHUNK_SIZE)];
-            }
-        }
+
+    context->is_full    = chunk->is_light_dirty;
+    context->edit_count = chunk->light_edit_count;
+    memcpy(context->edits, chunk->light_edits,
+           chunk->light_edit_count * sizeof(*chunk->light_edits));
+
+    chunk->is_light_dirty   = FALSE;
+    chunk->light_edit_count = 0;
+
+    client_submit(world->client, relight, context);
+}
+
+/* Remesh CHUNK on a worker. It is marked clean now, so edits made while
+   the task runs are meshed by the next one. */
+static void submit_mesh(struct world *world, struct chunk *chunk) {
+    struct mesh_context *context;
+
+    assert(world);
+    assert(chunk);
+    assert(!chunk->mesh_task);
+
+    context = malloc(sizeof(struct mesh_context));
+    if (!context) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
     }
-    chunk = get_chunk(context->world, neighbor_coords[2]);
-    if (chunk) {
-        for (z = 0; z < CHUNK_SIZE; z++) {
-            for (x = 0; x < CHUNK_SIZE; x++) {
-                blocks[INDEX_3D(x + 1, 17, z + 1, CHUNK_SIZE + 2)] =
-                    chunk->blocks[INDEX_3D(x, 0, z, CHUNK_SIZE)];
-            }
-        }
+    context->coord = chunk->coord;
+    context->world = world;
+
+    /* 0 means no task. */
+    if (++world->mesh_serial == 0) {
+        world->mesh_serial++;
+    }
+    context->serial  = world->mesh_serial;
+    chunk->mesh_task = world->mesh_serial;
+    chunk->is_dirty  = FALSE;
+
+    client_submit(world->client, mesh, context);
+}
+
+static void apply_mesh(struct world *world,
+                       const struct mesh_result *result) {
+    struct chunk *chunk;
+
+    /* The chunk may have been unloaded, or reloaded and remeshed by a later
+       task, in the meantime. */
+    chunk = get_chunk(world, &result->coord);
+    if (!chunk || chunk->mesh_task != result->serial) {
+        return;
     }
-    chunk = get_chunk(context->world, neighbor_coords[3]);
-    if (chunk) {
-        for (z = 0; z < CHUNK_SIZE; z++) {
-            for (x = 0; x < CHUNK_SIZE; x++) {
-                blocks[INDEX_3D(x + 1, 0, z + 1, CHUNK_SIZE + 2)] =
-                    chunk->blocks[INDEX_3D(x, CHUNK_SIZE - 1, z, CHUNK_SIZE)];
+
+    chunk->mesh_task = 0;
+    chunk_upload(chunk, result->vertex_elems,
+                 result->vertices.size / MESHER_VERTEX_FLOATS,
+                 result->index_elems, result->index_counts);
+}
+
+/* Mark the light of CHUNK around local block IDX stale. */
+static void add_light_edit(struct chunk *chunk, int idx) {
+    if (chunk->is_light_dirty) {
+        return;
+    }
+
+    if (chunk->light_edit_count == LIGHT_EDITS_MAX) {
+        chunk->is_light_dirty   = TRUE;
+        chunk->light_edit_count = 0;
+        return;
+    }
+
+    chunk->light_edits[chunk->light_edit_count++] = (unsigned short)idx;
+}
+
+/* Relight and remesh generated neighbors where the layer of CHUNK facing
+   them differs from OLD_LIGHT, or everywhere if OLD_LIGHT is NULL since they
+   were lit without it. Changes keep spreading chunk to chunk until the light
+   settles. */
+static void relight_neighbors(struct world *world, const struct chunk *chunk,
+                              const unsigned char *old_light) {
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        unsigned char old_border[LIGHT_BORDER_TOTAL];
+        unsigned char new_border[LIGHT_BORDER_TOTAL];
+        struct coord neighbor_coord;
+        struct chunk *neighbor;
+        int j;
+
+        neighbor_coord = coord_add(&chunk->coord, &neighbor_offsets[i]);
+        neighbor       = get_chunk(world, &neighbor_coord);
+
+        if (!neighbor || !neighbor->is_generated) {
+            continue;
+        }
+
+        light_border(chunk->light, i, new_border);
+        if (old_light) {
+            light_border(old_light, i, old_border);
+        }
+
+        for (j = 0; j < LIGHT_BORDER_TOTAL; j++) {
+            if (!old_light || old_border[j] != new_border[j]) {
+                add_light_edit(neighbor, light_border_block(i ^ 1, j));
+                neighbor->is_dirty = TRUE;
             }
         }
     }
-    chunk = get_chunk(context->world, neighbor_coords[4]);
-    if (chunk) {
-        for (y = 0; y < CHUNK_SIZE; y++) {
-            for (x = 0; x < CHUNK_SIZE; x++) {
-                blocks[INDEX_3D(x + 1, y + 1, 17, CHUNK_SIZE + 2)] =
-                    chunk->blocks[INDEX_3D(x, y, 0, CHUNK_SIZE)];
-            }
+}
+
+static void apply_light(struct world *world,
+                        const struct light_context *result) {
+    unsigned char *old_light;
+    struct chunk *chunk;
+    int was_lit;
+
+    /* The chunk may have been unloaded, or reloaded and relit by a later
+       task, in the meantime. */
+    chunk = get_chunk(world, &result->coord);
+    if (!chunk || chunk->light_task != result->serial) {
+        return;
+    }
+
+    /* Swapped rather than overwritten, workers may be gathering it. */
+    was_lit   = chunk->is_lit;
+    old_light = chunk->light;
+    ATOMIC_STORE_RELEASE(&chunk->light, copy_array(result->light));
+
+    chunk->light_task = 0;
+    chunk->is_dirty   = TRUE;
+    chunk->is_saved   = FALSE;
+    ATOMIC_STORE_RELEASE(&chunk->is_lit, TRUE);
+
+    relight_neighbors(world, chunk, was_lit ? old_light : NULL);
+
+    epoch_retire(&world->epoch, old_light, destroy_array, NULL);
+}
+
+/* Results are bounded by the number of loaded chunks, plus stale results of
+   unloaded chunks that may still be queued when the volume is reloaded. */
+static void reserve_results(struct world *world) {
+    size_t results_cap = 1;
+
+    while (results_cap < 2 * world->ring->total) {
+        results_cap <<= 1;
+    }
+
+    pthread_mutex_lock(&world->mutex);
+    RING_BUFFER_RESERVE(world->gens, world->gen_elems, results_cap);
+    RING_BUFFER_RESERVE(world->meshes, world->mesh_elems, results_cap);
+    RING_BUFFER_RESERVE(world->lights, world->light_elems, results_cap);
+    pthread_mutex_unlock(&world->mutex);
+}
+
+void world_init(struct world *world, struct client *client,
+                struct region_store *regions, int render_distance,
+                int is_adaptive) {
+    assert(world);
+    assert(client);
+    assert(regions);
+
+    world->client         = client;
+    world->regions        = regions;
+    world->autosave_timer = 0.0f;
+    world->light_serial   = 0;
+    world->mesh_serial    = 0;
+
+    world->edits.size     = 0;
+    world->edits.capacity = 0;
+    world->edit_elems     = NULL;
+
+    region_io_init(&world->io, regions);
+    world->loads.size     = 0;
+    world->loads.capacity = 0;
+    world->load_elems     = NULL;
+
+    epoch_init(&world->epoch);
+    chunk_map_init(&world->chunks, 2 * CHUNK_CACHE_CAP, &world->epoch);
+    world->lru_head = NULL;
+    world->lru_tail = NULL;
+
+    world->render_distance =
+        MAX(RENDER_DISTANCE_MIN, MIN(render_distance, RENDER_DISTANCE_MAX));
+    world->ring = ring_create(world->render_distance);
+
+    world->is_adaptive    = is_adaptive;
+    world->frame_time_avg = ADAPT_TARGET_FRAME_TIME;
+    world->adapt_timer    = 0.0f;
+
+    /* Out of range center, so the first update loads everything. */
+    world->center.x = INT_MAX;
+    world->center.y = INT_MAX;
+    world->center.z = INT_MAX;
+
+    /* Task results. */
+
+    pthread_mutex_init(&world->mutex, NULL);
+
+    memset(&world->gens, 0, sizeof(world->gens));
+    memset(&world->meshes, 0, sizeof(world->meshes));
+    memset(&world->lights, 0, sizeof(world->lights));
+    world->gen_elems   = NULL;
+    world->mesh_elems  = NULL;
+    world->light_elems = NULL;
+
+    reserve_results(world);
+}
+
+void world_set_render_distance(struct world *world, int render_distance) {
+    struct chunk_ring *old_ring;
+    struct chunk_ring *new_ring;
+    size_t i;
+
+    assert(world);
+
+    render_distance =
+        MAX(RENDER_DISTANCE_MIN, MIN(render_distance, RENDER_DISTANCE_MAX));
+
+    if (render_distance == world->render_distance) {
+        return;
+    }
+
+    old_ring = world->ring;
+    new_ring = ring_create(render_distance);
+
+    /* Carry over chunks still within the retained volume and unload the
+       rest, before publishing the new ring so readers never miss a generated
+       chunk. Readers still on the old ring are protected by the epoch. */
+    for (i = 0; i < old_ring->total; i++) {
+        struct chunk *chunk = old_ring->slots[i];
+
+        if (!chunk) {
+            continue;
+        }
+
+        if (is_in_range(&chunk->coord, &world->center,
+                        render_distance + UNLOAD_MARGIN)) {
+            new_ring->slots[ring_index(new_ring, &chunk->coord)] = chunk;
+        } else {
+            unload_chunk(world, chunk);
         }
     }
-    chunk = get_chunk(context->world, neighbor_coords[5]);
-    if (chunk) {
-        for (y = 0; y < CHUNK_SIZE; y++) {
-            for (x = 0; x < CHUNK_SIZE; x++) {
-                blocks[INDEX_3D(x + 1, y + 1, 0, CHUNK_SIZE + 2)] =
-                    chunk->blocks[INDEX_3D(x, y, CHUNK_SIZE - 1, CHUNK_SIZE)];
+
+    ATOMIC_STORE_RELEASE(&world->ring, new_ring);
+    epoch_retire(&world->epoch, old_ring, ring_destroy, NULL);
+
+    world->render_distance = render_distance;
+
+    reserve_results(world);
+
+    /* Load what came into range. */
+    if (world->center.x != INT_MAX) {
+        sweep(world);
+    }
+}
+
+/* Grow render distance while frames are fast and workers keep up, shrink it
+   when frames are slow. The frame time is smoothed, and changes are spaced
+   out so the load they cause is measured before the next decision. */
+static void adapt_render_distance(struct world *world, float delta_time) {
+    size_t backlog;
+
+    world->frame_time_avg += (delta_time - world->frame_time_avg) * 0.05f;
+    world->adapt_timer += delta_time;
+
+    if (world->adapt_timer < ADAPT_INTERVAL) {
+        return;
+    }
+
+    world->adapt_timer = 0.0f;
+
+    /* Tasks waiting for a worker. */
+    backlog = ATOMIC_LOAD_RELAXED(&world->client->task_count);
+
+    if (world->frame_time_avg > ADAPT_TARGET_FRAME_TIME * 1.1f) {
+        world_set_render_distance(world, world->render_distance - 1);
+    } else if (world->frame_time_avg < ADAPT_TARGET_FRAME_TIME * 0.7f &&
+               backlog == 0) {
+        world_set_render_distance(world, world->render_distance + 1);
+    }
+}
+
+/* TRUE if the block at LOCAL touches the neighbor chunk in direction
+   OFFSET. */
+static int is_on_border(const struct coord *local,
+                        const struct coord *offset) {
+    int edge_x = (offset->x < 0) ? 0 : CHUNK_SIZE - 1;
+    int edge_y = (offset->y < 0) ? 0 : CHUNK_SIZE - 1;
+    int edge_z = (offset->z < 0) ? 0 : CHUNK_SIZE - 1;
+
+    return (offset->x == 0 || local->x == edge_x) &&
+           (offset->y == 0 || local->y == edge_y) &&
+           (offset->z == 0 || local->z == edge_z);
+}
+
+/* Mark the generated chunks around COORD for remeshing, since the faces and
+   ambient occlusion of their border blocks depend on the chunk at COORD. If
+   LOCAL is set, only those whose border the block at LOCAL is next to. */
+static void mark_neighbors_dirty(struct world *world,
+                                 const struct coord *coord,
+                                 const struct coord *local) {
+    struct coord offset;
+
+    for (offset.z = -1; offset.z <= 1; offset.z++) {
+        for (offset.y = -1; offset.y <= 1; offset.y++) {
+            for (offset.x = -1; offset.x <= 1; offset.x++) {
+                struct coord neighbor_coord;
+                struct chunk *neighbor;
+
+                if (offset.x == 0 && offset.y == 0 && offset.z == 0) {
+                    continue;
+                }
+
+                if (local && !is_on_border(local, &offset)) {
+                    continue;
+                }
+
+                neighbor_coord = coord_add(coord, &offset);
+                neighbor       = get_chunk(world, &neighbor_coord);
+
+                if (neighbor && neighbor->is_generated) {
+                    neighbor->is_dirty = TRUE;
+                }
             }
         }
     }
+}
 
-    pthread_mutex_unlock(&task->world->mutex);
+static int floor_div(int value, int divisor) {
+    int quotient = value / divisor;
 
-    result = malloc(sizeof(struct meshing_result));
-    if (!result) {
-        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
-        exit(EXIT_FAILURE);
+    return (value % divisor < 0) ? quotient - 1 : quotient;
+}
+
+/* Chunk holding the block at world block coordinate BLOCK, and the block's
+   coordinate within it. */
+static void split_block_coord(const struct coord *block,
+                              struct coord *chunk_coord,
+                              struct coord *local) {
+    chunk_coord->x = floor_div(block->x, CHUNK_SIZE);
+    chunk_coord->y = floor_div(block->y, CHUNK_SIZE);
+    chunk_coord->z = floor_div(block->z, CHUNK_SIZE);
+
+    local->x = block->x - chunk_coord->x * CHUNK_SIZE;
+    local->y = block->y - chunk_coord->y * CHUNK_SIZE;
+    local->z = block->z - chunk_coord->z * CHUNK_SIZE;
+}
+
+unsigned char world_get_block(const struct world *world,
+                              const struct coord *coord) {
+    struct coord chunk_coord;
+    struct coord local;
+    struct chunk *chunk;
+
+    assert(world);
+    assert(coord);
+
+    split_block_coord(coord, &chunk_coord, &local);
+
+    chunk = get_chunk(world, &chunk_coord);
+    if (!chunk || !chunk->is_generated) {
+        return BLOCK_AIR;
     }
-    result->coord = task->coord;
 
-    /* Construct chunk mesh here... */
+    return chunk->blocks[INDEX_3D(local.x, local.y, local.z, CHUNK_SIZE)];
+}
 
-    pthread_mutex_lock(&task->world->mutex);
-    RING_BUFFER_PUSH(context->world->meshes, context->world->mesh_elems,
-                     &result);
-    pthread_mutex_unlock(&task->world->mutex);
+unsigned char world_get_light(const struct world *world,
+                              const struct coord *coord) {
+    struct coord chunk_coord;
+    struct coord local;
+    struct chunk *chunk;
 
-    free(context);
+    assert(world);
+    assert(coord);
+
+    split_block_coord(coord, &chunk_coord, &local);
+
+    chunk = get_chunk(world, &chunk_coord);
+    if (!chunk || !chunk->is_lit) {
+        return LIGHT_PACK(LIGHT_MAX, 0);
+    }
+
+    return chunk->light[INDEX_3D(local.x, local.y, local.z, CHUNK_SIZE)];
 }
 
-void world_init(struct world *world) {
+int world_set_block(struct world *world, const struct coord *coord,
+                    unsigned char block) {
+    struct coord chunk_coord;
+    struct coord local;
+    struct chunk *chunk;
+    struct block_edit edit;
+    unsigned char *blocks;
+    size_t index;
+
     assert(world);
+    assert(coord);
 
-    /* Setup thread pool. */
+    split_block_coord(coord, &chunk_coord, &local);
 
-    pthread_mutex_init(&world->mutex, NULL);
-    pthread_cond_init(&world->cond, NULL);
+    chunk = get_chunk(world, &chunk_coord);
+    if (!chunk || !chunk->is_generated) {
+        return FALSE;
+    }
+
+    index = (size_t)INDEX_3D(local.x, local.y, local.z, CHUNK_SIZE);
+    if (chunk->blocks[index] == block) {
+        return FALSE;
+    }
+
+    edit.coord     = *coord;
+    edit.old_block = chunk->blocks[index];
+    edit.block     = block;
+
+    /* Copy on write, workers may be gathering the current array. Several
+       edits to a chunk in one frame each copy it, which is cheap next to
+       the remesh they cause. */
+    blocks        = copy_array(chunk->blocks);
+    blocks[index] = block;
+    epoch_retire(&world->epoch, chunk->blocks, destroy_array, NULL);
+    ATOMIC_STORE_RELEASE(&chunk->blocks, blocks);
+    chunk->is_saved = FALSE;
+
+    ARRAY_APPEND(world->edits, world->edit_elems, edit);
+
+    return TRUE;
+}
+
+int world_raycast(const struct world *world, const struct vector3 *origin,
+                  const struct vector3 *direction, float distance,
+                  struct coord *hit, struct coord *before) {
+    int block[3];
+    int step[3];
+    float delta[3];
+    float next[3];
+    int axis;
+
+    assert(world);
+    assert(origin);
+    assert(direction);
+    assert(hit);
+    assert(before);
+
+    /* Amanatides and Woo: DELTA is the ray length across one block along
+       each axis, NEXT the length at which the ray crosses the next boundary
+       along it. Step across the nearest boundary each time. */
+    for (axis = 0; axis < 3; axis++) {
+        float pos = origin->elems[axis];
+        float dir = direction->elems[axis];
+
+        block[axis] = (int)floor((double)pos);
+
+        if (dir > 0.0f) {
+            step[axis]  = 1;
+            delta[axis] = 1.0f / dir;
+            next[axis]  = ((float)block[axis] + 1.0f - pos) * delta[axis];
+        } else if (dir < 0.0f) {
+            step[axis]  = -1;
+            delta[axis] = -1.0f / dir;
+            next[axis]  = (pos - (float)block[axis]) * delta[axis];
+        } else {
+            step[axis]  = 0;
+            delta[axis] = FLT_MAX;
+            next[axis]  = FLT_MAX;
+        }
+    }
+
+    before->x = block[0];
+    before->y = block[1];
+    before->z = block[2];
+
+    for (;;) {
+        hit->x = block[0];
+        hit->y = block[1];
+        hit->z = block[2];
+
+        if (world_get_block(world, hit) != BLOCK_AIR) {
+            return TRUE;
+        }
+
+        if (next[0] < next[1]) {
+            axis = next[0] < next[2] ? 0 : 2;
+        } else {
+            axis = next[1] < next[2] ? 1 : 2;
+        }
+
+        if (next[axis] > distance) {
+            return FALSE;
+        }
+
+        *before = *hit;
+        block[axis] += step[axis];
+        next[axis] += delta[axis];
+    }
+}
+
+/* Remesh the chunks an edit batch touched. Dirty flags coalesce any number
+   of edits into one remesh per chunk, and neighbors, edge and corner ones
+   included, are only remeshed if the edit is on their border and changed
+   whether a block is solid, which their faces and occlusion depend on. */
+static void apply_edits(struct world *world) {
+    size_t i;
+
+    for (i = 0; i < world->edits.size; i++) {
+        const struct block_edit *edit = &world->edit_elems[i];
+        struct coord chunk_coord;
+        struct coord local;
+        struct chunk *chunk;
+
+        split_block_coord(&edit->coord, &chunk_coord, &local);
+
+        chunk = get_chunk(world, &chunk_coord);
+        if (!chunk) {
+            continue;
+        }
+
+        chunk->is_dirty = TRUE;
+        add_light_edit(chunk,
+                       INDEX_3D(local.x, local.y, local.z, CHUNK_SIZE));
+
+        if ((edit->old_block == BLOCK_AIR) != (edit->block == BLOCK_AIR)) {
+            mark_neighbors_dirty(world, &chunk_coord, &local);
+        }
+    }
+
+    world->edits.size = 0;
 }
 
-void world_update(struct world *world, const struct camera *camera) {
+void world_update(struct world *world, const struct camera *camera,
+                  float delta_time) {
     struct coord camera_coord;
-    int i;
+    size_t i;
 
     assert(world);
     assert(camera);
 
-    camera_coord.x = (int)camera->pos.VEC_X / CHUNK_SIZE;
-    camera_coord.y = (int)camera->pos.VEC_Y / CHUNK_SIZE;
-    camera_coord.z = (int)camera->pos.VEC_Z / CHUNK_SIZE;
+    camera_coord.x = (int)floor((double)camera->pos.VEC_X / CHUNK_SIZE);
+    camera_coord.y = (int)floor((double)camera->pos.VEC_Y / CHUNK_SIZE);
+    camera_coord.z = (int)floor((double)camera->pos.VEC_Z / CHUNK_SIZE);
 
     /* Poll task results. */
 
+    PROFILE_BEGIN("poll_results");
     pthread_mutex_lock(&world->mutex);
 
-    while (world->generation_results_info.size > 0) {
-        struct generation_result *result;
-        QUEUE_POP(world->generation_results, world->generation_results_info,
-                  &result);
+    while (world->gens.size > 0) {
+        struct gen_result *result;
+        struct chunk *chunk;
 
-        /* Do something with the result... */
+        RING_BUFFER_POP(world->gens, world->gen_elems, result);
+
+        /* The chunk may have been unloaded, or reloaded and generated by a
+           later task, in the meantime. */
+        chunk = get_chunk(world, &result->coord);
+        if (chunk && !chunk->is_generated) {
+            chunk_init(chunk, result->blocks, result->light, &result->coord);
+            chunk->is_saved = result->is_saved;
+            mark_neighbors_dirty(world, &result->coord, NULL);
+
+            /* Saved chunks come with their light. */
+            ATOMIC_STORE_RELEASE(&chunk->is_lit, result->is_saved);
+            chunk->is_light_dirty = !result->is_saved;
+            if (chunk->is_lit) {
+                relight_neighbors(world, chunk, NULL);
+            }
+        }
 
         free(result);
     }
 
-    while (world->meshing_results_info.size > 0) {
-        struct generation_result *result;
-        QUEUE_POP(world->meshing_results, world->meshing_results_info,
-                  &result);
+    while (world->meshes.size > 0) {
+        struct mesh_result *result;
+        RING_BUFFER_POP(world->meshes, world->mesh_elems, result);
 
-        /* Do something with the result... */
+        apply_mesh(world, result);
+
+        free(result->vertex_elems);
+        free(result->index_elems);
+        free(result);
+    }
+
+    while (world->lights.size > 0) {
+        struct light_context *result;
+        RING_BUFFER_POP(world->lights, world->light_elems, result);
+
+        apply_light(world, result);
 
         free(result);
     }
 
     pthread_mutex_unlock(&world->mutex);
+    PROFILE_END();
+
+    PROFILE_BEGIN("apply_edits");
+    apply_edits(world);
+    PROFILE_END();
+
+    if (camera_coord.x != world->center.x ||
+        camera_coord.y != world->center.y ||
+        camera_coord.z != world->center.z) {
+        world->center = camera_coord;
+
+        PROFILE_BEGIN("sweep");
+        sweep(world);
+        PROFILE_END();
+    }
 
-    /* Update chunks. */
-    for (i = 0; i < LOADED_CHUNKS_TOTAL; i++) {
-        if (world->chunks[i]) {
-            chunk_update(world->chunks[i], world);
+    if (world->is_adaptive) {
+        adapt_render_distance(world, delta_time);
+    }
+
+    world->autosave_timer += delta_time;
+    if (world->autosave_timer >= AUTOSAVE_INTERVAL) {
+        world->autosave_timer = 0.0f;
+
+        PROFILE_BEGIN("autosave");
+        world_save(world);
+        PROFILE_END();
+    }
+
+    /* Relight and remesh chunks. The ring is walked in memory order. At
+       most one lighting and one meshing task run per chunk, edits made
+       meanwhile are batched into the next one. */
+    PROFILE_BEGIN("update_chunks");
+    for (i = 0; i < world->ring->total; i++) {
+        struct chunk *chunk = world->ring->slots[i];
+
+        if (!chunk || !chunk->is_generated) {
+            continue;
+        }
+
+        if ((chunk->is_light_dirty || chunk->light_edit_count > 0) &&
+            !chunk->light_task) {
+            submit_light(world, chunk);
+        }
+
+        if (chunk->is_lit && chunk->is_dirty && !chunk->mesh_task) {
+            submit_mesh(world, chunk);
+        }
+    }
+    PROFILE_END();
+
+    /* Free chunks unloaded in earlier frames that no worker still reads. */
+    epoch_reclaim(&world->epoch);
+}
+
+void world_save(struct world *world) {
+    struct chunk *chunk;
+    size_t i;
+
+    assert(world);
+
+    for (i = 0; i < world->ring->total; i++) {
+        if (world->ring->slots[i]) {
+            save_chunk(world, world->ring->slots[i]);
         }
     }
+
+    for (chunk = world->lru_head; chunk; chunk = chunk->lru_next) {
+        save_chunk(world, chunk);
+    }
+}
+
+void world_shutdown(struct world *world) {
+    assert(world);
+
+    world_save(world);
+
+    /* Completes the reads in flight, which only hand chunks to workers. */
+    region_io_free(&world->io);
 }
@@ -4,65 +4,169 @@
 #include <pthread.h>
 
 #include "array.h"
-#include "map.h"
+#include "epoch.h"
 #include "ring_buffer.h"
 #include "coord.h"
+#include "region.h"
+#include "region_io.h"
 #include "client/chunk.h"
+#include "client/chunk_map.h"
+#include "client/light.h"
 #include "client/camera.h"
+#include "client/client.h"
 
-#define RENDER_DISTANCE   4
-#define LOADED_CHUNKS_LEN (RENDER_DISTANCE * 2 + 1)
-#define LOADED_CHUNKS_TOTAL                                                   \
-    LOADED_CHUNKS_LEN * LOADED_CHUNKS_LEN * LOADED_CHUNKS_LEN
+/* Default, and bounds of, the runtime render distance in chunks. */
+#define RENDER_DISTANCE_DEFAULT 4
+#define RENDER_DISTANCE_MIN     2
+#define RENDER_DISTANCE_MAX     16
+
+/* Chunks are loaded within render distance but only unloaded once they are
+   this much further away, so moving back and forth across a chunk border
+   does not unload and reload the same chunks. */
+#define UNLOAD_MARGIN 1
+
+/* Recently unloaded chunks kept, meshes included, for instant reload. */
+#define CHUNK_CACHE_CAP 256
+
+/* Adaptive render distance aims for this frame time, and re-evaluates the
+   distance at most once per interval. */
+#define ADAPT_TARGET_FRAME_TIME (1.0f / 60.0f)
+#define ADAPT_INTERVAL          1.0f
+
+/* Loaded chunks that changed are saved this often, in seconds. Unloaded
+   ones are saved when they are evicted from the warm cache. */
+#define AUTOSAVE_INTERVAL 30.0f
+
+/* Terrain seed of generated chunks. */
+#define WORLD_SEED 0
+
+/* Stored chunk payload: blocks followed by light. */
+#define CHUNK_PAYLOAD_SIZE (2 * CHUNK_TOTAL)
 
 struct world;
 
-/* Task context for loading chunks within (and unloading chunks outside) render
-   distance. */
-struct sweep_context {
-    struct coord center;
-    struct world *world;
+/* Toroidal storage of the loaded volume: a chunk lives in the slot given by
+   its coordinate modulo len on each axis. Since the volume is len wide, no
+   two loaded chunks share a slot. Replaced as a whole when the render
+   distance changes, so readers always see a len matching the slots. */
+struct chunk_ring {
+    struct chunk **slots;
+    int len;      /* (render distance + UNLOAD_MARGIN) * 2 + 1. */
+    size_t total; /* len * len * len. */
 };
 
 /* Chunk block generation task context. */
 struct gen_context {
     struct coord coord;
-    const struct world *world;
+    struct world *world;
 };
 
 /* Chunk block generation task result. */
 struct gen_result {
     struct coord coord;
     unsigned char blocks[CHUNK_TOTAL];
+    unsigned char light[CHUNK_TOTAL];
+
+    /* TRUE if loaded from the region file rather than generated. */
+    int is_saved;
 };
 
 /* Chunk meshing task context. */
 struct mesh_context {
     struct coord coord;
-    const struct world *world;
+    struct world *world;
+    unsigned int serial;
 };
 
-/* Chunk meshing task result. */
+/* Chunk meshing task result, sized to the mesh. */
 struct mesh_result {
     struct coord coord;
+    unsigned int serial;
 
+    /* MESHER_VERTEX_FLOATS floats per vertex. */
     struct array vertices;
     float *vertex_elems;
 
+    /* Grouped by face direction, in mesher_face_dirs order. */
     struct array indices;
     unsigned int *index_elems;
+    size_t index_counts[6];
+};
+
+/* Chunk lighting task context, handed back as its result with the light
+   updated. */
+struct light_context {
+    struct coord coord;
+    struct world *world;
+    unsigned int serial;
+
+    unsigned char blocks[CHUNK_TOTAL];
+    unsigned char light[CHUNK_TOTAL];
+
+    /* Layers of the lit neighbors facing the chunk. */
+    unsigned char borders[6][LIGHT_BORDER_TOTAL];
+    int has_border[6];
+
+    /* Relight from scratch if TRUE, else update around the edits. */
+    int is_full;
+    unsigned short edits[LIGHT_EDITS_MAX];
+    size_t edit_count;
 };
 
-struct chunk_entry {
-    struct coord key;
-    struct chunk *value;
-    enum map_slot slot;
+/* Block change, in world block coordinates. */
+struct block_edit {
+    struct coord coord;
+    unsigned char old_block;
+    unsigned char block;
 };
 
 struct world {
-    /* Spatial hash-map of coordinates to loaded chunks. */
-    struct map chunks;
-    struct chunk_entry *chunk_entries;
+    /* Thread pool that runs generation and meshing tasks. */
+    struct client *client;
+
+    /* Saved chunks, loaded instead of generated. */
+    struct region_store *regions;
+    float autosave_timer;
+
+    /* Reads chunks off the workers, a sweep's loads in one batch. */
+    struct region_io io;
+    struct array loads;
+    struct region_read **load_elems;
+
+    /* Loaded volume. Only the render thread writes slots, workers read them
+       lock-free inside an epoch. */
+    struct chunk_ring *ring;
+
+    /* Chunks within this distance of the center are loaded. */
+    int render_distance;
+
+    /* TRUE to scale render distance with frame time and worker backlog. */
+    int is_adaptive;
+    float frame_time_avg;
+    float adapt_timer;
+
+    /* Warm cache of recently unloaded chunks, by coordinate. Lookups that
+       miss the ring fall back to it, and the sweep moves cached chunks back
+       into the ring when they re-enter render distance. */
+    struct chunk_map chunks;
+
+    /* Cached chunks from most to least recently unloaded. */
+    struct chunk *lru_head;
+    struct chunk *lru_tail;
+
+    /* Reclaims unloaded chunks once no worker can still be reading them. */
+    struct epoch epoch;
+
+    /* Serials of the last lighting and meshing tasks submitted. */
+    unsigned int light_serial;
+    unsigned int mesh_serial;
+
+    /* Edits since the last update, applied together as one batch. */
+    struct array edits;
+    struct block_edit *edit_elems;
+
+    /* Chunk coordinate the loaded volume is centered on. */
+    struct coord center;
 
     /* Task result mutex. */
     pthread_mutex_t mutex;
@@ -75,11 +179,53 @@ struct world {
     struct ring_buffer meshes;
     struct mesh_result **mesh_elems;
 
-    /* TRUE if a sweep task is enqueued or being processed. */
-    int is_sweep_active;
+    struct ring_buffer lights;
+    struct light_context **light_elems;
 };
 
-void world_init(struct world *world);
-void world_update(struct world *world, const struct camera *camera);
+void world_init(struct world *world, struct client *client,
+                struct region_store *regions, int render_distance,
+                int is_adaptive);
+void world_set_render_distance(struct world *world, int render_distance);
+void world_update(struct world *world, const struct camera *camera,
+                  float delta_time);
+
+/* Copies the blocks and light of the chunk at COORD into PADDED_BLOCKS and
+   PADDED_LIGHT, CHUNK_PADDED wide cubes, with a one block border from its
+   26 neighbors. See mesher_gather for neighbors that are missing. Returns
+   FALSE if the chunk is not loaded. Workers must call this between
+   epoch_enter and epoch_exit. */
+int world_gather(const struct world *world, const struct coord *coord,
+                 unsigned char *padded_blocks, unsigned char *padded_light);
+
+/* Block at world block coordinate COORD, air if its chunk is not loaded. */
+unsigned char world_get_block(const struct world *world,
+                              const struct coord *coord);
+
+/* Light at world block coordinate COORD, full skylight if its chunk is not
+   loaded or not lit yet. */
+unsigned char world_get_light(const struct world *world,
+                              const struct coord *coord);
+
+/* Changes the block at world block coordinate COORD right away, and records
+   the edit for the next world_update to remesh. Returns FALSE if the chunk
+   is not loaded or the block is unchanged. */
+int world_set_block(struct world *world, const struct coord *coord,
+                    unsigned char block);
+
+/* Walks the blocks along the ray from ORIGIN in unit DIRECTION, up to
+   DISTANCE blocks away. Returns TRUE with the first non air block in HIT and
+   the block the ray crossed just before it in BEFORE, HIT itself if ORIGIN
+   is inside it. Chunks not loaded count as air. */
+int world_raycast(const struct world *world, const struct vector3 *origin,
+                  const struct vector3 *direction, float distance,
+                  struct coord *hit, struct coord *before);
+
+/* Queue every changed chunk, loaded or cached, for saving. */
+void world_save(struct world *world);
+
+/* Saves, then stops reading chunks, before the region store is freed at
+   exit. Tasks may still be running on workers, so the world stays. */
+void world_shutdown(struct world *world);
 
 #endif
@@ -0,0 +1,356 @@
+#include "codec.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include "macros.h"
+
+#define LITERAL_MAX   64
+#define RUN_MIN       3
+#define RUN_SHORT_MAX (0x3E + RUN_MIN)
+#define RUN_LONG_MAX  0xFFFF
+#define MATCH_MIN     4
+#define MATCH_MAX     (0x7F + MATCH_MIN)
+#define OFFSET_MAX    0xFFFF
+
+#define TAG_RUN      0x40
+#define TAG_RUN_LONG 0x7F
+#define TAG_MATCH    0x80
+
+/* Match candidates are found through a table of the last position of each
+   4-byte sequence hash. */
+#define HASH_BITS 12
+#define HASH_SIZE (1 << HASH_BITS)
+
+static size_t hash4(const unsigned char *src) {
+    unsigned long bytes = (unsigned long)src[0] |
+                          (unsigned long)src[1] << 8 |
+                          (unsigned long)src[2] << 16 |
+                          (unsigned long)src[3] << 24;
+
+    return (size_t)(((bytes * 2654435761UL) & 0xFFFFFFFFUL) >>
+                    (32 - HASH_BITS));
+}
+
+/* Encoder output, with every write bounds checked. */
+struct writer {
+    unsigned char *dst;
+    size_t size;
+    size_t cap;
+};
+
+static int put(struct writer *writer, unsigned char byte) {
+    if (writer->size >= writer->cap) {
+        return FALSE;
+    }
+
+    writer->dst[writer->size++] = byte;
+    return TRUE;
+}
+
+static int put_literals(struct writer *writer, const unsigned char *src,
+                        size_t count, const unsigned char *index) {
+    size_t i;
+
+    if (count == 0) {
+        return TRUE;
+    }
+
+    assert(count <= LITERAL_MAX);
+
+    if (!put(writer, (unsigned char)(count - 1))) {
+        return FALSE;
+    }
+
+    if (!index) {
+        for (i = 0; i < count; i++) {
+            if (!put(writer, src[i])) {
+                return FALSE;
+            }
+        }
+
+        return TRUE;
+    }
+
+    for (i = 0; i < count; i += 2) {
+        unsigned char low  = index[src[i]];
+        unsigned char high = (i + 1 < count) ? index[src[i + 1]] : 0;
+
+        if (!put(writer, (unsigned char)(low | high << 4))) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+size_t codec_encode(const unsigned char *src, size_t size, unsigned char *dst,
+                    size_t cap) {
+    unsigned int table[HASH_SIZE];
+    unsigned char index[256];
+    int is_seen[256];
+    struct writer writer;
+    size_t palette_len;
+    size_t literal;
+    size_t i;
+
+    assert(src || size == 0);
+    assert(dst);
+    assert(size <= CODEC_INPUT_MAX);
+
+    writer.dst  = dst;
+    writer.size = 0;
+    writer.cap  = cap;
+
+    /* Palette. */
+
+    memset(is_seen, FALSE, sizeof(is_seen));
+    palette_len = 0;
+
+    for (i = 0; i < size && palette_len <= 16; i++) {
+        if (!is_seen[src[i]]) {
+            is_seen[src[i]] = TRUE;
+            index[src[i]]   = (unsigned char)palette_len++;
+        }
+    }
+
+    if (palette_len > 16) {
+        palette_len = 0;
+    }
+
+    if (!put(&writer, (unsigned char)palette_len)) {
+        return 0;
+    }
+
+    if (writer.cap - writer.size < palette_len) {
+        return 0;
+    }
+
+    /* Palette is stored in index order. */
+    for (i = 0; i < 256 && palette_len > 0; i++) {
+        if (is_seen[i]) {
+            dst[writer.size + index[i]] = (unsigned char)i;
+        }
+    }
+    writer.size += palette_len;
+
+    /* Tokens. Runs are preferred over matches since they decode to a single
+       memset, and literals are buffered until a run or match ends them. */
+
+    memset(table, 0xFF, sizeof(table));
+    literal = 0;
+    i       = 0;
+
+    while (i < size) {
+        size_t run = 1;
+        size_t match_len;
+        size_t match_pos;
+
+        while (i + run < size && src[i + run] == src[i] &&
+               run < RUN_LONG_MAX) {
+            run++;
+        }
+
+        if (run >= RUN_MIN) {
+            if (!put_literals(&writer, src + literal, i - literal,
+                              palette_len ? index : NULL)) {
+                return 0;
+            }
+
+            if (run <= RUN_SHORT_MAX) {
+                if (!put(&writer,
+                         (unsigned char)(TAG_RUN | (run - RUN_MIN)))) {
+                    return 0;
+                }
+            } else if (!put(&writer, TAG_RUN_LONG) ||
+                       !put(&writer, (unsigned char)(run & 0xFF)) ||
+                       !put(&writer, (unsigned char)(run >> 8))) {
+                return 0;
+            }
+
+            if (!put(&writer, src[i])) {
+                return 0;
+            }
+
+            i += run;
+            literal = i;
+            continue;
+        }
+
+        match_len = 0;
+        match_pos = 0;
+
+        if (i + MATCH_MIN <= size) {
+            size_t hash = hash4(src + i);
+
+            match_pos   = table[hash];
+            table[hash] = (unsigned int)i;
+
+            if (match_pos < i && i - match_pos <= OFFSET_MAX) {
+                while (i + match_len < size && match_len < MATCH_MAX &&
+                       src[match_pos + match_len] == src[i + match_len]) {
+                    match_len++;
+                }
+            }
+        }
+
+        if (match_len >= MATCH_MIN) {
+            size_t offset = i - match_pos;
+
+            if (!put_literals(&writer, src + literal, i - literal,
+                              palette_len ? index : NULL)) {
+                return 0;
+            }
+
+            if (!put(&writer,
+                     (unsigned char)(TAG_MATCH | (match_len - MATCH_MIN))) ||
+                !put(&writer, (unsigned char)(offset & 0xFF)) ||
+                !put(&writer, (unsigned char)(offset >> 8))) {
+                return 0;
+            }
+
+            i += match_len;
+            literal = i;
+            continue;
+        }
+
+        i++;
+
+        if (i - literal == LITERAL_MAX) {
+            if (!put_literals(&writer, src + literal, LITERAL_MAX,
+                              palette_len ? index : NULL)) {
+                return 0;
+            }
+            literal = i;
+        }
+    }
+
+    if (!put_literals(&writer, src + literal, i - literal,
+                      palette_len ? index : NULL)) {
+        return 0;
+    }
+
+    return writer.size;
+}
+
+size_t codec_decode(const unsigned char *src, size_t size, unsigned char *dst,
+                    size_t cap) {
+    unsigned char palette[16];
+    const unsigned char *end;
+    size_t palette_len;
+    size_t out;
+
+    assert(src || size == 0);
+    assert(dst);
+
+    if (size == 0) {
+        return 0;
+    }
+
+    end         = src + size;
+    palette_len = *src++;
+
+    if (palette_len > 16 || (size_t)(end - src) < palette_len) {
+        return 0;
+    }
+
+    /* Indices past the palette are malformed input. They decode to 0
+       instead of being checked per literal. */
+    memset(palette, 0, sizeof(palette));
+    memcpy(palette, src, palette_len);
+    src += palette_len;
+
+    out = 0;
+
+    while (src < end) {
+        unsigned int tag = *src++;
+
+        if (tag < TAG_RUN) {
+            size_t count = tag + 1;
+            size_t i;
+
+            if (cap - out < count) {
+                return 0;
+            }
+
+            if (palette_len == 0) {
+                if ((size_t)(end - src) < count) {
+                    return 0;
+                }
+
+                memcpy(dst + out, src, count);
+                src += count;
+            } else {
+                if ((size_t)(end - src) < (count + 1) / 2) {
+                    return 0;
+                }
+
+                for (i = 0; i + 1 < count; i += 2) {
+                    dst[out + i]     = palette[*src & 0x0F];
+                    dst[out + i + 1] = palette[*src >> 4];
+                    src++;
+                }
+
+                if (i < count) {
+                    dst[out + i] = palette[*src & 0x0F];
+                    src++;
+                }
+            }
+
+            out += count;
+        } else if (tag < TAG_MATCH) {
+            size_t count;
+
+            if (tag == TAG_RUN_LONG) {
+                if (end - src < 3) {
+                    return 0;
+                }
+
+                count = (size_t)src[0] | (size_t)src[1] << 8;
+                src += 2;
+            } else {
+                if (end - src < 1) {
+                    return 0;
+                }
+
+                count = (tag & 0x3F) + RUN_MIN;
+            }
+
+            if (cap - out < count) {
+                return 0;
+            }
+
+            memset(dst + out, *src++, count);
+            out += count;
+        } else {
+            size_t count = (tag & 0x7F) + MATCH_MIN;
+            size_t offset;
+
+            if (end - src < 2) {
+                return 0;
+            }
+
+            offset = (size_t)src[0] | (size_t)src[1] << 8;
+            src += 2;
+
+            if (offset == 0 || offset > out || cap - out < count) {
+                return 0;
+            }
+
+            if (offset >= count) {
+                memcpy(dst + out, dst + out - offset, count);
+            } else {
+                /* Overlapping copy repeats the last OFFSET bytes. */
+                size_t i;
+
+                for (i = 0; i < count; i++) {
+                    dst[out + i] = dst[out + i - offset];
+                }
+            }
+
+            out += count;
+        }
+    }
+
+    return out;
+}
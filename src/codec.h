@@ -0,0 +1,41 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+
+/* Worst case encoded size of SIZE bytes. */
+#define CODEC_BOUND(SIZE) ((SIZE) + (SIZE) / 64 + 258)
+
+/* Longest input the encoder accepts, so positions fit its match table. */
+#define CODEC_INPUT_MAX 0xFFFFFF
+
+/* Chunk codec tuned for decode speed over ratio. Stream layout:
+
+       u8  palette length, 0 if more than 16 distinct bytes
+       u8  palette[palette length]
+       tokens until the end of the stream
+
+   Token tags:
+
+       0x00-0x3F  tag + 1 literals follow, packed two palette indices per
+                  byte if there is a palette, raw bytes otherwise
+       0x40-0x7E  run of (tag & 0x3F) + 3 copies of the byte that follows
+       0x7F       run of u16 (little-endian) copies of the byte after it
+       0x80-0xFF  (tag & 0x7F) + 4 bytes copied from u16 (little-endian)
+                  bytes back in the output
+
+   Chunks in INDEX_3D order are mostly long runs of air and stone, repeated
+   rows of the same terrain layer, and few distinct block ids, which runs,
+   back-references and packed literals cover in that order. */
+
+/* Returns the encoded size, or 0 if it does not fit in CAP bytes. CAP of
+   CODEC_BOUND(SIZE) always fits. */
+size_t codec_encode(const unsigned char *src, size_t size, unsigned char *dst,
+                    size_t cap);
+
+/* Returns the decoded size, or 0 if SRC is malformed or decodes to more than
+   CAP bytes. Safe on untrusted input. */
+size_t codec_decode(const unsigned char *src, size_t size, unsigned char *dst,
+                    size_t cap);
+
+#endif
@@ -0,0 +1,131 @@
+#include "epoch.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include "macros.h"
+#include "atomic.h"
+
+void epoch_init(struct epoch *epoch) {
+    assert(epoch);
+
+    memset(epoch->readers, 0, sizeof(epoch->readers));
+
+    /* 0 is reserved for free reader slots. */
+    epoch->global = 1;
+
+    epoch->retired.size     = 0;
+    epoch->retired.capacity = 0;
+    epoch->retired_elems    = NULL;
+}
+
+void epoch_free(struct epoch *epoch) {
+    size_t i;
+
+    assert(epoch);
+
+    for (i = 0; i < epoch->retired.size; i++) {
+        struct epoch_retired *retired = &epoch->retired_elems[i];
+        retired->destroy(retired->ptr, retired->context);
+    }
+
+    free(epoch->retired_elems);
+    epoch->retired_elems    = NULL;
+    epoch->retired.size     = 0;
+    epoch->retired.capacity = 0;
+}
+
+size_t epoch_enter(struct epoch *epoch) {
+    unsigned long current;
+    size_t i;
+
+    assert(epoch);
+
+    current = ATOMIC_LOAD(&epoch->global);
+
+    /* Claim a free reader slot and announce the current epoch in one step. */
+    for (i = 0;; i = (i + 1) % EPOCH_MAX_READERS) {
+        unsigned long expected = 0;
+
+        if (ATOMIC_CAS(&epoch->readers[i].epoch, &expected, current)) {
+            break;
+        }
+    }
+
+    /* The writer may have advanced the epoch between our load and the
+       announcement. Re-announce until both agree, so that everything
+       unlinked before the announced epoch is guaranteed to be invisible. */
+    while (TRUE) {
+        unsigned long latest = ATOMIC_LOAD(&epoch->global);
+
+        if (latest == current) {
+            break;
+        }
+
+        current = latest;
+        ATOMIC_STORE(&epoch->readers[i].epoch, current);
+    }
+
+    return i;
+}
+
+void epoch_exit(struct epoch *epoch, size_t reader) {
+    assert(epoch);
+    assert(reader < EPOCH_MAX_READERS);
+
+    ATOMIC_STORE_RELEASE(&epoch->readers[reader].epoch, 0UL);
+}
+
+void epoch_retire(struct epoch *epoch, void *ptr,
+                  void (*destroy)(void *ptr, void *context), void *context) {
+    struct epoch_retired retired;
+
+    assert(epoch);
+    assert(destroy);
+
+    retired.ptr     = ptr;
+    retired.destroy = destroy;
+    retired.context = context;
+    retired.epoch   = ATOMIC_LOAD_RELAXED(&epoch->global);
+
+    ARRAY_APPEND(epoch->retired, epoch->retired_elems, retired);
+}
+
+void epoch_reclaim(struct epoch *epoch) {
+    unsigned long oldest;
+    size_t kept;
+    size_t i;
+
+    assert(epoch);
+
+    if (epoch->retired.size == 0) {
+        return;
+    }
+
+    /* Readers entering from now on cannot observe anything retired so far. */
+    oldest = ATOMIC_FETCH_ADD(&epoch->global, 1UL) + 1;
+
+    for (i = 0; i < EPOCH_MAX_READERS; i++) {
+        unsigned long reader = ATOMIC_LOAD(&epoch->readers[i].epoch);
+
+        if (reader != 0 && reader < oldest) {
+            oldest = reader;
+        }
+    }
+
+    /* Destroy everything retired before the oldest active reader entered. */
+
+    kept = 0;
+
+    for (i = 0; i < epoch->retired.size; i++) {
+        struct epoch_retired retired = epoch->retired_elems[i];
+
+        if (retired.epoch < oldest) {
+            retired.destroy(retired.ptr, retired.context);
+        } else {
+            epoch->retired_elems[kept++] = retired;
+        }
+    }
+
+    epoch->retired.size = kept;
+}
@@ -0,0 +1,53 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stddef.h>
+
+#include "array.h"
+
+#define EPOCH_MAX_READERS 64
+
+/* Reader announcement, padded to a cache line to avoid false sharing. 0 means
+   the slot is free. */
+struct epoch_reader {
+    unsigned long epoch;
+    char padding[64 - sizeof(unsigned long)];
+};
+
+/* Object unlinked by the writer, waiting for all readers that might still
+   see it to leave their read-side section. */
+struct epoch_retired {
+    void *ptr;
+    void (*destroy)(void *ptr, void *context);
+    void *context;
+    unsigned long epoch;
+};
+
+/* Epoch-based memory reclamation for single-writer, lock-free reader data
+   structures. Readers bracket their accesses with epoch_enter/epoch_exit.
+   The writer unlinks objects, hands them to epoch_retire, and periodically
+   calls epoch_reclaim to destroy the ones no reader can reference anymore. */
+struct epoch {
+    unsigned long global;
+
+    struct epoch_reader readers[EPOCH_MAX_READERS];
+
+    /* Writer only. */
+    struct array retired;
+    struct epoch_retired *retired_elems;
+};
+
+void epoch_init(struct epoch *epoch);
+
+/* Destroys all retired objects. No reader may be active. */
+void epoch_free(struct epoch *epoch);
+
+/* Returns a reader handle to pass to epoch_exit. */
+size_t epoch_enter(struct epoch *epoch);
+void epoch_exit(struct epoch *epoch, size_t reader);
+
+void epoch_retire(struct epoch *epoch, void *ptr,
+                  void (*destroy)(void *ptr, void *context), void *context);
+void epoch_reclaim(struct epoch *epoch);
+
+#endif
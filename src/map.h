@@ -6,9 +6,19 @@
 #include <string.h>
 #include <assert.h>
 
-enum map_slot { SLOT_EMPTY, SLOT_OCCUPIED, SLOT_DELETED };
+/* Bucket probe sequence length of an unoccupied bucket. */
+#define SLOT_EMPTY 0
 
-/* Flat hash-map with linear probing. */
+/* Flat hash-map with Robin Hood linear probing and backward-shift deletion.
+
+   Buckets are user structs with the members `key`, `value` and `size_t psl`.
+   psl is SLOT_EMPTY for free buckets, and otherwise the distance from the
+   bucket the key hashes to plus one. Insertion lets entries far from home
+   take the place of entries closer to theirs, and removal shifts the
+   following cluster back by one instead of leaving a tombstone, so probe
+   lengths stay short under constant insert/remove churn.
+
+   The bucket array has two extra buckets past capacity used as scratch. */
 struct map {
     size_t size;
     size_t capacity; /* Capacity must be a power of two! */
@@ -17,37 +27,48 @@ struct map {
 #define MAP_FIND_SLOT(BUCKETS, MAP, HASHED_KEY, KEY_PTR, CMP_FN, OUT_IDX,     \
                       FOUND_FLAG)                                             \
     do {                                                                      \
-        size_t _cap           = (MAP).capacity;                               \
-        size_t _mask          = _cap - 1;                                     \
-        size_t _idx           = (HASHED_KEY) & _mask;                         \
-        size_t _first_deleted = (size_t)-1;                                   \
-        (FOUND_FLAG)          = 0;                                            \
-        (OUT_IDX)             = (size_t)-1;                                   \
-        assert((_cap & (_cap - 1)) == 0);                                     \
-        assert(_cap > 0);                                                     \
+        size_t _fcap  = (MAP).capacity;                                       \
+        size_t _fmask = _fcap - 1;                                            \
+        size_t _fidx  = (HASHED_KEY) & _fmask;                                \
+        size_t _fpsl  = 1;                                                    \
+        (FOUND_FLAG)  = 0;                                                    \
+        (OUT_IDX)     = (size_t)-1;                                           \
+        assert((_fcap & (_fcap - 1)) == 0);                                   \
+        assert(_fcap > 0);                                                    \
                                                                               \
-        while (1) {                                                           \
-            if ((BUCKETS)[_idx].slot == SLOT_EMPTY) {                         \
-                if ((OUT_IDX) == (size_t)-1) {                                \
-                    (OUT_IDX) = _idx;                                         \
-                }                                                             \
+        /* An entry closer to home than we are means the key is absent. */    \
+        while ((BUCKETS)[_fidx].psl >= _fpsl) {                               \
+            if (CMP_FN(&(BUCKETS)[_fidx].key, (KEY_PTR))) {                   \
+                (OUT_IDX)    = _fidx;                                         \
+                (FOUND_FLAG) = 1;                                             \
                 break;                                                        \
-            } else if ((BUCKETS)[_idx].slot == SLOT_DELETED) {                \
-                if (_first_deleted == (size_t)-1) {                           \
-                    _first_deleted = _idx;                                    \
-                }                                                             \
-            } else if ((BUCKETS)[_idx].slot == SLOT_OCCUPIED) {               \
-                if (CMP_FN(&(BUCKETS)[_idx].key, (KEY_PTR))) {                \
-                    (OUT_IDX)    = _idx;                                      \
-                    (FOUND_FLAG) = 1;                                         \
-                    break;                                                    \
-                }                                                             \
             }                                                                 \
-            _idx = (_idx + 1) & _mask;                                        \
+            _fidx = (_fidx + 1) & _fmask;                                     \
+            _fpsl++;                                                          \
         }                                                                     \
-        if (!(FOUND_FLAG) && _first_deleted != (size_t)-1) {                  \
-            (OUT_IDX) = _first_deleted;                                       \
+    } while (0)
+
+/* Place the entry in scratch bucket [capacity], with psl set to 1, into the
+   table. Internal to MAP_INSERT. */
+#define MAP_PLACE_(BUCKETS, MAP, HASHED_KEY)                                  \
+    do {                                                                      \
+        size_t _pcap  = (MAP).capacity;                                       \
+        size_t _pmask = _pcap - 1;                                            \
+        size_t _pidx  = (HASHED_KEY) & _pmask;                                \
+                                                                              \
+        while ((BUCKETS)[_pidx].psl != SLOT_EMPTY) {                          \
+            /* Rob the richer entry and carry it on instead. */               \
+            if ((BUCKETS)[_pidx].psl < (BUCKETS)[_pcap].psl) {                \
+                (BUCKETS)[_pcap + 1] = (BUCKETS)[_pidx];                      \
+                (BUCKETS)[_pidx]     = (BUCKETS)[_pcap];                      \
+                (BUCKETS)[_pcap]     = (BUCKETS)[_pcap + 1];                  \
+            }                                                                 \
+            (BUCKETS)[_pcap].psl++;                                           \
+            _pidx = (_pidx + 1) & _pmask;                                     \
         }                                                                     \
+                                                                              \
+        (BUCKETS)[_pidx] = (BUCKETS)[_pcap];                                  \
+        (MAP).size++;                                                         \
     } while (0)
 
 /* Check if a key exists in the map. Sets OUT_EXISTS to 1 or 0. */
@@ -85,12 +106,26 @@ struct map {
    expansion. */
 #define MAP_INSERT(BUCKETS, MAP, KEY, VALUE, CMP_FN, HASH_FN)                 \
     do {                                                                      \
+        size_t _h = HASH_FN(&(KEY));                                          \
+        size_t _idx;                                                          \
+        int _found = 0;                                                       \
+                                                                              \
+        if ((BUCKETS) != NULL) {                                              \
+            MAP_FIND_SLOT(BUCKETS, MAP, _h, &(KEY), CMP_FN, _idx, _found);    \
+        }                                                                     \
+                                                                              \
+        if (_found) {                                                         \
+            (BUCKETS)[_idx].value = (VALUE);                                  \
+            break;                                                            \
+        }                                                                     \
+                                                                              \
         /* Grow at 70% load factor */                                         \
         if ((MAP).size * 10 >= (MAP).capacity * 7 || (BUCKETS) == NULL) {     \
             size_t _old_cap    = (MAP).capacity;                              \
             size_t _new_cap    = (_old_cap == 0) ? 16 : (_old_cap * 2);       \
+            size_t _e_size     = sizeof(*(BUCKETS));                          \
             void *_old_buckets = (BUCKETS);                                   \
-            size_t _b_size     = _new_cap * sizeof(*(BUCKETS));               \
+            size_t _b_size     = (_new_cap + 2) * _e_size;                    \
             void *_new_buckets = malloc(_b_size);                             \
             if (!_new_buckets) {                                              \
                 fprintf(stderr, "%s:%d Out of memory!\n", __FILE__,           \
@@ -102,47 +137,30 @@ struct map {
             (MAP).capacity = _new_cap;                                        \
             (MAP).size     = 0;                                               \
                                                                               \
-            /* Re-hash existing occupied slots into new bucket array. */      \
+            /* Re-hash existing occupied buckets into new bucket array. */    \
             if (_old_buckets) {                                               \
                 size_t _i;                                                    \
                 for (_i = 0; _i < _old_cap; _i++) {                           \
-                    if (((struct chunk_entry *)_old_buckets)[_i].slot ==      \
-                        SLOT_OCCUPIED) {                                      \
-                        size_t _h = HASH_FN(                                  \
-                            &((struct chunk_entry *)_old_buckets)[_i].key);   \
-                        size_t _dummy_idx;                                    \
-                        int _dummy_found;                                     \
-                        MAP_FIND_SLOT(                                        \
-                            (BUCKETS), (MAP), _h,                             \
-                            &((struct chunk_entry *)_old_buckets)[_i].key,    \
-                            CMP_FN, _dummy_idx, _dummy_found);                \
-                        (BUCKETS)[_dummy_idx].key =                           \
-                            ((struct chunk_entry *)_old_buckets)[_i].key;     \
-                        (BUCKETS)[_dummy_idx].value =                         \
-                            ((struct chunk_entry *)_old_buckets)[_i].value;   \
-                        (BUCKETS)[_dummy_idx].slot = SLOT_OCCUPIED;           \
-                        (MAP).size++;                                         \
+                    memcpy(&(BUCKETS)[_new_cap],                              \
+                           (char *)_old_buckets + _i * _e_size, _e_size);     \
+                    if ((BUCKETS)[_new_cap].psl != SLOT_EMPTY) {              \
+                        size_t _rh = HASH_FN(&(BUCKETS)[_new_cap].key);       \
+                        (BUCKETS)[_new_cap].psl = 1;                          \
+                        MAP_PLACE_(BUCKETS, MAP, _rh);                        \
                     }                                                         \
                 }                                                             \
                 free(_old_buckets);                                           \
             }                                                                 \
         }                                                                     \
                                                                               \
-        {                                                                     \
-            size_t _h = HASH_FN(&(KEY));                                      \
-            size_t _idx;                                                      \
-            int _found;                                                       \
-            MAP_FIND_SLOT(BUCKETS, MAP, _h, &(KEY), CMP_FN, _idx, _found);    \
-            (BUCKETS)[_idx].key   = (KEY);                                    \
-            (BUCKETS)[_idx].value = (VALUE);                                  \
-            (BUCKETS)[_idx].slot  = SLOT_OCCUPIED;                            \
-            if (!_found) {                                                    \
-                (MAP).size++;                                                 \
-            }                                                                 \
-        }                                                                     \
+        (BUCKETS)[(MAP).capacity].key   = (KEY);                              \
+        (BUCKETS)[(MAP).capacity].value = (VALUE);                            \
+        (BUCKETS)[(MAP).capacity].psl   = 1;                                  \
+        MAP_PLACE_(BUCKETS, MAP, _h);                                         \
     } while (0)
 
-/* Remove an element from the map by setting its slot to SLOT_DELETED. */
+/* Remove an element from the map, shifting the entries after it back
+   towards their home buckets. */
 #define MAP_REMOVE(BUCKETS, MAP, KEY, CMP_FN, HASH_FN, OUT_REMOVED)           \
     do {                                                                      \
         (OUT_REMOVED) = 0;                                                    \
@@ -152,11 +170,37 @@ struct map {
             int _found;                                                       \
             MAP_FIND_SLOT(BUCKETS, MAP, _h, &(KEY), CMP_FN, _idx, _found);    \
             if (_found) {                                                     \
-                (BUCKETS)[_idx].slot = SLOT_DELETED;                          \
+                size_t _mask = (MAP).capacity - 1;                            \
+                size_t _next = (_idx + 1) & _mask;                            \
+                                                                              \
+                while ((BUCKETS)[_next].psl > 1) {                            \
+                    (BUCKETS)[_idx] = (BUCKETS)[_next];                       \
+                    (BUCKETS)[_idx].psl--;                                    \
+                    _idx  = _next;                                            \
+                    _next = (_next + 1) & _mask;                              \
+                }                                                             \
+                                                                              \
+                (BUCKETS)[_idx].psl = SLOT_EMPTY;                             \
                 (MAP).size--;                                                 \
                 (OUT_REMOVED) = 1;                                            \
             }                                                                 \
         }                                                                     \
     } while (0)
 
-#endif
\ No newline at end of file
+/* Probe length statistics. OUT_MAX is the longest probe sequence of any
+   entry, OUT_TOTAL the sum over all entries (divide by size for the mean). */
+#define MAP_PROBE_STATS(BUCKETS, MAP, OUT_MAX, OUT_TOTAL)                     \
+    do {                                                                      \
+        size_t _i;                                                            \
+        (OUT_MAX)   = 0;                                                      \
+        (OUT_TOTAL) = 0;                                                      \
+        for (_i = 0; (BUCKETS) != NULL && _i < (MAP).capacity; _i++) {        \
+            size_t _psl = (BUCKETS)[_i].psl;                                  \
+            if (_psl > (OUT_MAX)) {                                           \
+                (OUT_MAX) = _psl;                                             \
+            }                                                                 \
+            (OUT_TOTAL) += _psl;                                              \
+        }                                                                     \
+    } while (0)
+
+#endif
@@ -4,7 +4,7 @@
 #include <string.h>
 #include <assert.h>
 
-struct matrix4 mat4x4_mul(const struct matrix4 *a, const struct matrix4 *b) {
+struct matrix4 matrix4_mul(const struct matrix4 *a, const struct matrix4 *b) {
     struct matrix4 result;
     int col;
     int row;
@@ -27,8 +27,8 @@ struct matrix4 mat4x4_mul(const struct matrix4 *a, const struct matrix4 *b) {
     return result;
 }
 
-struct matrix4 mat4x4_translate(const struct matrix4 *mat,
-                                const struct vector3 *pos) {
+struct matrix4 matrix4_translate(const struct matrix4 *mat,
+                                 const struct vector3 *pos) {
     struct matrix4 m = MATRIX4_IDENTITY;
 
     assert(mat);
@@ -38,10 +38,10 @@ struct matrix4 mat4x4_translate(const struct matrix4 *mat,
     m.MATRIX4_AT(3, 1) = pos->VEC_Y;
     m.MATRIX4_AT(3, 2) = pos->VEC_Z;
 
-    return mat4x4_mul(mat, &m);
+    return matrix4_mul(mat, &m);
 }
 
-struct matrix4 mat4x4_rotate_x(const struct matrix4 *mat, float angle) {
+struct matrix4 matrix4_rotate_x(const struct matrix4 *mat, float angle) {
     struct matrix4 rot = MATRIX4_IDENTITY;
     float c;
     float s;
@@ -56,10 +56,10 @@ struct matrix4 mat4x4_rotate_x(const struct matrix4 *mat, float angle) {
     rot.MATRIX4_AT(1, 2) = -s;
     rot.MATRIX4_AT(2, 2) = c;
 
-    return mat4x4_mul(mat, &rot);
+    return matrix4_mul(mat, &rot);
 }
 
-struct matrix4 mat4x4_rotate_y(const struct matrix4 *mat, float angle) {
+struct matrix4 matrix4_rotate_y(const struct matrix4 *mat, float angle) {
     struct matrix4 rot = MATRIX4_IDENTITY;
     float c;
     float s;
@@ -74,10 +74,10 @@ struct matrix4 mat4x4_rotate_y(const struct matrix4 *mat, float angle) {
     rot.MATRIX4_AT(0, 2) = s;
     rot.MATRIX4_AT(2, 2) = c;
 
-    return mat4x4_mul(mat, &rot);
+    return matrix4_mul(mat, &rot);
 }
 
-struct matrix4 mat4x4_rotate_z(const struct matrix4 *mat, float angle) {
+struct matrix4 matrix4_rotate_z(const struct matrix4 *mat, float angle) {
     struct matrix4 rot = MATRIX4_IDENTITY;
     float c;
     float s;
@@ -92,11 +92,11 @@ struct matrix4 mat4x4_rotate_z(const struct matrix4 *mat, float angle) {
     rot.MATRIX4_AT(0, 1) = -s;
     rot.MATRIX4_AT(1, 1) = c;
 
-    return mat4x4_mul(mat, &rot);
+    return matrix4_mul(mat, &rot);
 }
 
-struct matrix4 mat4x4_scale(const struct matrix4 *mat,
-                            const struct vector3 *scale) {
+struct matrix4 matrix4_scale(const struct matrix4 *mat,
+                             const struct vector3 *scale) {
     struct matrix4 s = MATRIX4_IDENTITY;
 
     assert(mat);
@@ -106,7 +106,7 @@ struct matrix4 mat4x4_scale(const struct matrix4 *mat,
     s.MATRIX4_AT(1, 1) = scale->VEC_Y;
     s.MATRIX4_AT(2, 2) = scale->VEC_Z;
 
-    return mat4x4_mul(mat, &s);
+    return matrix4_mul(mat, &s);
 }
 
 struct matrix4 invert_view(const struct matrix4 *view) {
@@ -0,0 +1,344 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#include "macros.h"
+#include "atomic.h"
+
+#define EVENT_MASK (PROFILER_EVENTS - 1)
+
+/* Events copied per validation when reading another thread's ring. */
+#define BATCH_EVENTS 256
+
+/* Distinct thread and zone pairs merged by profiler_summary. */
+#define SUMMARY_ZONES 256
+
+struct profiler_event {
+    const char *name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+struct profiler_open {
+    const char *name;
+    uint64_t begin;
+};
+
+/* Written only by its own thread. Readers copy events published by HEAD,
+   then discard those whose slots STARTED shows were reused meanwhile. */
+struct profiler_thread {
+    char name[32];
+
+    struct profiler_open stack[PROFILER_DEPTH];
+    int depth;
+
+    unsigned long started;
+    unsigned long head;
+    struct profiler_event events[PROFILER_EVENTS];
+};
+
+static uint64_t origin;
+
+static struct profiler_thread *threads[PROFILER_THREADS];
+static unsigned long thread_count;
+
+static __thread struct profiler_thread *current;
+
+static uint64_t get_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static struct profiler_thread *get_thread(void) {
+    struct profiler_thread *thread;
+    unsigned long idx;
+
+    if (current) {
+        return current;
+    }
+
+    thread = calloc(1, sizeof(struct profiler_thread));
+    if (!thread) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    idx = ATOMIC_FETCH_ADD(&thread_count, 1);
+    sprintf(thread->name, "thread %lu", idx);
+
+    /* Threads past PROFILER_THREADS record into a ring nobody reads. */
+    if (idx < PROFILER_THREADS) {
+        ATOMIC_STORE_RELEASE(&threads[idx], thread);
+    }
+
+    current = thread;
+
+    return thread;
+}
+
+/* Copies up to MAX events of THREAD from *NEXT on into EVENTS, skipping any
+   already overwritten, and advances *NEXT. Returns the number copied. */
+static size_t read_events(const struct profiler_thread *thread,
+                          unsigned long *next, struct profiler_event *events,
+                          size_t max) {
+    unsigned long head;
+    unsigned long started;
+    unsigned long first;
+    size_t copied;
+    size_t count;
+    size_t i;
+
+    /* Retry while whole batches turn out stale, so 0 means none left. */
+    do {
+        head = ATOMIC_LOAD_ACQUIRE(&thread->head);
+
+        if (head - *next > PROFILER_EVENTS) {
+            *next = head - PROFILER_EVENTS;
+        }
+
+        copied = MIN((size_t)(head - *next), max);
+
+        for (i = 0; i < copied; i++) {
+            events[i] = thread->events[(*next + i) & EVENT_MASK];
+        }
+
+        /* Slots of event N are reused by event N + PROFILER_EVENTS, so
+           drop what the writer may have started overwriting during the
+           copy. */
+        ATOMIC_FENCE_ACQUIRE();
+        started = ATOMIC_LOAD_RELAXED(&thread->started);
+
+        first = *next;
+        *next += copied;
+        count = copied;
+
+        if (started > first + PROFILER_EVENTS) {
+            size_t stale = MIN((size_t)(started - first - PROFILER_EVENTS),
+                               copied);
+
+            memmove(events, events + stale,
+                    (copied - stale) * sizeof(struct profiler_event));
+            count -= stale;
+        }
+    } while (count == 0 && copied > 0);
+
+    return count;
+}
+
+void profiler_init(void) {
+    origin = get_time();
+}
+
+void profiler_thread_name(const char *name) {
+    struct profiler_thread *thread;
+
+    assert(name);
+
+    thread = get_thread();
+
+    strncpy(thread->name, name, sizeof(thread->name) - 1);
+    thread->name[sizeof(thread->name) - 1] = '\0';
+}
+
+uint64_t profiler_now(void) {
+    return get_time() - origin;
+}
+
+void profiler_begin(const char *name) {
+    struct profiler_thread *thread;
+
+    assert(name);
+
+    thread = get_thread();
+
+    /* Zones nested too deep are counted but not recorded. */
+    if (thread->depth < PROFILER_DEPTH) {
+        thread->stack[thread->depth].name  = name;
+        thread->stack[thread->depth].begin = profiler_now();
+    }
+
+    thread->depth++;
+}
+
+void profiler_end(void) {
+    struct profiler_thread *thread;
+    struct profiler_event *event;
+    unsigned long head;
+
+    thread = get_thread();
+
+    assert(thread->depth > 0);
+
+    thread->depth--;
+
+    if (thread->depth >= PROFILER_DEPTH) {
+        return;
+    }
+
+    head = thread->head;
+
+    /* Announce the slot before writing it, see read_events. */
+    ATOMIC_STORE_RELAXED(&thread->started, head + 1);
+    ATOMIC_FENCE_RELEASE();
+
+    event        = &thread->events[head & EVENT_MASK];
+    event->name  = thread->stack[thread->depth].name;
+    event->begin = thread->stack[thread->depth].begin;
+    event->end   = profiler_now();
+
+    ATOMIC_STORE_RELEASE(&thread->head, head + 1);
+}
+
+int profiler_export(const char *path) {
+    struct profiler_event events[BATCH_EVENTS];
+    unsigned long count;
+    unsigned long i;
+    int is_first = TRUE;
+    FILE *file;
+
+    assert(path);
+
+    file = fopen(path, "w");
+    if (!file) {
+        return FALSE;
+    }
+
+    count = MIN(ATOMIC_LOAD(&thread_count), PROFILER_THREADS);
+
+    fprintf(file, "{\"traceEvents\":[\n");
+
+    for (i = 0; i < count; i++) {
+        const struct profiler_thread *thread;
+        unsigned long next = 0;
+        size_t batch;
+
+        thread = ATOMIC_LOAD_ACQUIRE(&threads[i]);
+        if (!thread) {
+            continue;
+        }
+
+        fprintf(file,
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+                is_first ? "" : ",\n", i, thread->name);
+        is_first = FALSE;
+
+        while ((batch = read_events(thread, &next, events, BATCH_EVENTS)) >
+               0) {
+            size_t j;
+
+            /* Timestamps are in microseconds. */
+            for (j = 0; j < batch; j++) {
+                fprintf(file,
+                        ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+                        "\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+                        events[j].name, i, (double)events[j].begin / 1e3,
+                        (double)(events[j].end - events[j].begin) / 1e3);
+            }
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static int compare_zones(const void *a, const void *b) {
+    double total_a = ((const struct profiler_zone *)a)->total_ms;
+    double total_b = ((const struct profiler_zone *)b)->total_ms;
+
+    return (total_a < total_b) - (total_a > total_b);
+}
+
+size_t profiler_summary(struct profiler_zone *zones, size_t max,
+                        double seconds) {
+    struct profiler_zone merged[SUMMARY_ZONES];
+    struct profiler_event events[BATCH_EVENTS];
+    size_t merged_count = 0;
+    unsigned long count;
+    unsigned long i;
+    uint64_t since;
+    uint64_t now;
+
+    assert(zones || max == 0);
+
+    now   = profiler_now();
+    since = (uint64_t)(seconds * 1e9);
+    since = (now > since) ? now - since : 0;
+
+    count = MIN(ATOMIC_LOAD(&thread_count), PROFILER_THREADS);
+
+    for (i = 0; i < count; i++) {
+        const struct profiler_thread *thread;
+        unsigned long next = 0;
+        size_t batch;
+
+        thread = ATOMIC_LOAD_ACQUIRE(&threads[i]);
+        if (!thread) {
+            continue;
+        }
+
+        /* Each thread's zones are merged after those of earlier threads. */
+        while ((batch = read_events(thread, &next, events, BATCH_EVENTS)) >
+               0) {
+            size_t j;
+
+            for (j = 0; j < batch; j++) {
+                struct profiler_zone *zone = NULL;
+                double ms;
+                size_t k;
+
+                if (events[j].end < since) {
+                    continue;
+                }
+
+                for (k = 0; k < merged_count; k++) {
+                    if (merged[k].thread == thread->name &&
+                        strcmp(merged[k].name, events[j].name) == 0) {
+                        zone = &merged[k];
+                        break;
+                    }
+                }
+
+                if (!zone) {
+                    if (merged_count == SUMMARY_ZONES) {
+                        continue;
+                    }
+
+                    zone           = &merged[merged_count++];
+                    zone->name     = events[j].name;
+                    zone->thread   = thread->name;
+                    zone->total_ms = 0.0;
+                    zone->max_ms   = 0.0;
+                    zone->count    = 0;
+                }
+
+                ms = (double)(events[j].end - events[j].begin) / 1e6;
+
+                zone->total_ms += ms;
+                zone->max_ms = MAX(zone->max_ms, ms);
+                zone->count++;
+            }
+        }
+    }
+
+    qsort(merged, merged_count, sizeof(struct profiler_zone), compare_zones);
+
+    merged_count = MIN(merged_count, max);
+    memcpy(zones, merged, merged_count * sizeof(struct profiler_zone));
+
+    return merged_count;
+}
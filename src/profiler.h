@@ -0,0 +1,58 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROFILER_THREADS 32
+#define PROFILER_DEPTH   32
+
+/* Events kept per thread, a power of two. Older ones are overwritten. */
+#define PROFILER_EVENTS 16384
+
+/* Zone statistics returned by profiler_summary. */
+struct profiler_zone {
+    const char *name;
+    const char *thread;
+    double total_ms;
+    double max_ms;
+    unsigned long count;
+};
+
+/* Scoped zones, nested per thread. NAME must be a string literal, or at
+   least outlive the profiler, and must not need escaping in JSON. Both
+   expand to a statement so they can go anywhere one can, and to nothing
+   when NPROFILE is defined. */
+#ifndef NPROFILE
+#define PROFILE_BEGIN(NAME) profiler_begin(NAME)
+#define PROFILE_END()       profiler_end()
+#else
+#define PROFILE_BEGIN(NAME) ((void)0)
+#define PROFILE_END()       ((void)0)
+#endif
+
+/* Sets the time origin. Call once, before any zone. */
+void profiler_init(void);
+
+/* Names the calling thread in exports and summaries. */
+void profiler_thread_name(const char *name);
+
+/* Nanoseconds since profiler_init, from the monotonic clock. */
+uint64_t profiler_now(void);
+
+/* Each thread records into its own ring, so these never lock. */
+void profiler_begin(const char *name);
+void profiler_end(void);
+
+/* Writes the events still held by every thread to PATH in Chrome trace
+   event format, for chrome://tracing or Perfetto. Returns FALSE if the
+   file could not be written. */
+int profiler_export(const char *path);
+
+/* Fills ZONES with up to MAX zones that ended in the last SECONDS, merged
+   by thread and name and sorted by total time, and returns their number.
+   May be called from any thread while the others record. */
+size_t profiler_summary(struct profiler_zone *zones, size_t max,
+                        double seconds);
+
+#endif
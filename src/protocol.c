@@ -0,0 +1,302 @@
+#include "protocol.h"
+
+#include <math.h>
+#include <assert.h>
+
+#define FIELDS_ALL 0x7F
+
+static double clamp(double value, double min, double max) {
+    return value < min ? min : (value > max ? max : value);
+}
+
+static int16_t quantize_i16(double value, double scale) {
+    return (int16_t)clamp(floor(value * scale + 0.5), -32768.0, 32767.0);
+}
+
+void protocol_quantize(struct player_state *state,
+                       const struct vector3 *position,
+                       const struct vector3 *velocity, float yaw,
+                       float pitch) {
+    double angle;
+    int i;
+
+    assert(state);
+    assert(position);
+    assert(velocity);
+
+    for (i = 0; i < 3; i++) {
+        double value = (double)position->elems[i];
+        double chunk = floor(value / PROTOCOL_CHUNK_SIZE);
+        double local;
+
+        local = floor((value - chunk * PROTOCOL_CHUNK_SIZE) *
+                          PROTOCOL_POSITION_SCALE +
+                      0.5);
+
+        /* Rounding up to the next chunk. */
+        if (local >= 65536.0) {
+            local -= 65536.0;
+            chunk += 1.0;
+        }
+
+        state->chunk[i] =
+            (int32_t)clamp(chunk, -2147483647.0 - 1.0, 2147483647.0);
+        state->position[i] = (uint16_t)clamp(local, 0.0, 65535.0);
+        state->velocity[i] =
+            quantize_i16((double)velocity->elems[i], PROTOCOL_VELOCITY_SCALE);
+    }
+
+    angle = fmod((double)yaw, 360.0);
+    if (angle < 0.0) {
+        angle += 360.0;
+    }
+
+    state->yaw =
+        (uint16_t)((unsigned long)floor(angle * PROTOCOL_ANGLE_SCALE + 0.5) &
+                   0xFFFF);
+    state->pitch = quantize_i16((double)pitch, PROTOCOL_ANGLE_SCALE);
+}
+
+void protocol_dequantize(const struct player_state *state,
+                         struct vector3 *position, struct vector3 *velocity,
+                         float *yaw, float *pitch) {
+    int i;
+
+    assert(state);
+    assert(position);
+    assert(velocity);
+    assert(yaw);
+    assert(pitch);
+
+    *position = protocol_position(state);
+
+    for (i = 0; i < 3; i++) {
+        velocity->elems[i] =
+            (float)(state->velocity[i] / PROTOCOL_VELOCITY_SCALE);
+    }
+
+    *yaw   = (float)(state->yaw / PROTOCOL_ANGLE_SCALE);
+    *pitch = (float)(state->pitch / PROTOCOL_ANGLE_SCALE);
+}
+
+struct vector3 protocol_position(const struct player_state *state) {
+    struct vector3 position;
+    int i;
+
+    assert(state);
+
+    for (i = 0; i < 3; i++) {
+        position.elems[i] =
+            (float)((double)state->chunk[i] * PROTOCOL_CHUNK_SIZE +
+                    state->position[i] / PROTOCOL_POSITION_SCALE);
+    }
+
+    return position;
+}
+
+size_t protocol_write_varint(unsigned char *dst, uint32_t value) {
+    size_t size = 0;
+
+    assert(dst);
+
+    while (value >= 0x80) {
+        dst[size++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+
+    dst[size++] = (unsigned char)value;
+
+    return size;
+}
+
+size_t protocol_read_varint(const unsigned char *src, size_t size,
+                            uint32_t *value) {
+    uint32_t result = 0;
+    size_t i;
+
+    assert(src);
+    assert(value);
+
+    for (i = 0; i < PROTOCOL_VARINT_MAX; i++) {
+        if (i == size) {
+            return 0;
+        }
+
+        /* The last byte holds the top 4 bits. */
+        if (i == PROTOCOL_VARINT_MAX - 1 && src[i] > 0x0F) {
+            return PROTOCOL_MALFORMED;
+        }
+
+        result |= (uint32_t)(src[i] & 0x7F) << (7 * i);
+
+        if (!(src[i] & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+
+    return PROTOCOL_MALFORMED;
+}
+
+static void put_u16(unsigned char *dst, uint16_t value) {
+    dst[0] = (unsigned char)(value & 0xFF);
+    dst[1] = (unsigned char)(value >> 8);
+}
+
+static uint16_t get_u16(const unsigned char *src) {
+    return (uint16_t)(src[0] | src[1] << 8);
+}
+
+size_t protocol_write_state(unsigned char *dst,
+                            const struct player_state *state,
+                            const struct player_state *base) {
+    unsigned char mask = 0;
+    size_t size        = 1;
+    int i;
+
+    assert(dst);
+    assert(state);
+    assert(base);
+
+    for (i = 0; i < 3; i++) {
+        if (state->chunk[i] != base->chunk[i]) {
+            mask |= PROTOCOL_CHUNK;
+        }
+        if (state->position[i] != base->position[i]) {
+            mask |= (unsigned char)(PROTOCOL_X << i);
+        }
+        if (state->velocity[i] != base->velocity[i]) {
+            mask |= PROTOCOL_VELOCITY;
+        }
+    }
+
+    if (state->yaw != base->yaw) {
+        mask |= PROTOCOL_YAW;
+    }
+    if (state->pitch != base->pitch) {
+        mask |= PROTOCOL_PITCH;
+    }
+
+    dst[0] = mask;
+
+    if (mask & PROTOCOL_CHUNK) {
+        for (i = 0; i < 3; i++) {
+            /* Wrapping difference, zigzagged so small steps either way
+               take a byte. */
+            uint32_t diff =
+                (uint32_t)state->chunk[i] - (uint32_t)base->chunk[i];
+
+            size += protocol_write_varint(dst + size,
+                                          diff << 1 ^ (0u - (diff >> 31)));
+        }
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (mask & (PROTOCOL_X << i)) {
+            put_u16(dst + size, state->position[i]);
+            size += 2;
+        }
+    }
+
+    if (mask & PROTOCOL_VELOCITY) {
+        for (i = 0; i < 3; i++) {
+            put_u16(dst + size, (uint16_t)state->velocity[i]);
+            size += 2;
+        }
+    }
+
+    if (mask & PROTOCOL_YAW) {
+        put_u16(dst + size, state->yaw);
+        size += 2;
+    }
+    if (mask & PROTOCOL_PITCH) {
+        put_u16(dst + size, (uint16_t)state->pitch);
+        size += 2;
+    }
+
+    assert(size <= PROTOCOL_STATE_MAX);
+
+    return size;
+}
+
+size_t protocol_read_state(const unsigned char *src, size_t size,
+                           struct player_state *state) {
+    struct player_state result;
+    unsigned char mask;
+    size_t used = 1;
+    size_t need;
+    int i;
+
+    assert(src);
+    assert(state);
+
+    if (size == 0) {
+        return 0;
+    }
+
+    mask = src[0];
+    if (mask & ~FIELDS_ALL) {
+        return PROTOCOL_MALFORMED;
+    }
+
+    result = *state;
+
+    if (mask & PROTOCOL_CHUNK) {
+        for (i = 0; i < 3; i++) {
+            uint32_t zigzag;
+            uint32_t diff;
+            size_t n;
+
+            n = protocol_read_varint(src + used, size - used, &zigzag);
+            if (n == 0 || n == PROTOCOL_MALFORMED) {
+                return n;
+            }
+            used += n;
+
+            diff = zigzag >> 1 ^ (0u - (zigzag & 1));
+            result.chunk[i] = (int32_t)((uint32_t)result.chunk[i] + diff);
+        }
+    }
+
+    /* The rest is fixed size. */
+    need = 0;
+    for (i = 0; i < 3; i++) {
+        if (mask & (PROTOCOL_X << i)) {
+            need += 2;
+        }
+    }
+    need += (mask & PROTOCOL_VELOCITY) ? 6 : 0;
+    need += (mask & PROTOCOL_YAW) ? 2 : 0;
+    need += (mask & PROTOCOL_PITCH) ? 2 : 0;
+
+    if (size - used < need) {
+        return 0;
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (mask & (PROTOCOL_X << i)) {
+            result.position[i] = get_u16(src + used);
+            used += 2;
+        }
+    }
+
+    if (mask & PROTOCOL_VELOCITY) {
+        for (i = 0; i < 3; i++) {
+            result.velocity[i] = (int16_t)get_u16(src + used);
+            used += 2;
+        }
+    }
+
+    if (mask & PROTOCOL_YAW) {
+        result.yaw = get_u16(src + used);
+        used += 2;
+    }
+    if (mask & PROTOCOL_PITCH) {
+        result.pitch = (int16_t)get_u16(src + used);
+        used += 2;
+    }
+
+    *state = result;
+
+    return used;
+}
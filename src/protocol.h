@@ -0,0 +1,127 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vector.h"
+
+/* Bumped on any change to the layouts below. */
+#define PROTOCOL_VERSION 4
+
+/* Packet opcodes, sent over the channels of transport.h. Integers are
+   little-endian, and varints are unsigned LEB128 of at most 32 bits.
+
+   Client to server:
+
+       PACKET_HELLO     u16 version, first reliable message
+       PACKET_STATE     u8 base, state delta, the unreliable payload of
+                        each datagram
+
+   Server to client:
+
+       PACKET_SNAPSHOT  u8 base, varint time, varint leave count, varint
+                        update count, the varint ids of players that
+                        left, then each update as varint id and state
+                        delta
+
+   A state is a delta against the state the client sent BASE datagrams
+   back, the newest the server acked, or against the zero state if BASE is
+   0. Servers keep the last TRANSPORT_WINDOW states to decode the next, and
+   leave those whose base is gone unacked.
+
+   A snapshot is the unreliable payload of each server datagram, one a
+   tick. It holds the players in range of the client, as changes to an
+   earlier snapshot the client acked, its base, BASE datagrams back, or to
+   the empty snapshot if BASE is 0. Clients keep the last TRANSPORT_WINDOW
+   snapshots to decode the next. Leaves apply first. Updates are deltas
+   against the state of the player in the base, or against the zero state
+   for players not in it. A player appears at most once in each list. Time
+   is in server ticks, PROTOCOL_TICK_RATE a second, so clients place the
+   states in time however late they arrive. */
+#define PACKET_HELLO    0
+#define PACKET_STATE    1
+#define PACKET_SNAPSHOT 2
+
+/* Server ticks a second. */
+#define PROTOCOL_TICK_RATE 20
+
+/* State delta layout. A u8 mask of the fields that differ from the base,
+   then each field set, in bit order:
+
+       CHUNK     3 varint zigzag differences of the chunk coordinates
+       X, Y, Z   u16 position within the chunk
+       VELOCITY  3 i16
+       YAW       u16
+       PITCH     i16
+
+   Players walking through a chunk send two or three u16 a tick. */
+#define PROTOCOL_CHUNK    0x01
+#define PROTOCOL_X        0x02
+#define PROTOCOL_Y        0x04
+#define PROTOCOL_Z        0x08
+#define PROTOCOL_VELOCITY 0x10
+#define PROTOCOL_YAW      0x20
+#define PROTOCOL_PITCH    0x40
+
+/* Quantization steps per block, per block per second, and per degree.
+   Chunks are 16 blocks wide, so positions within them fill a u16. */
+#define PROTOCOL_CHUNK_SIZE     16
+#define PROTOCOL_POSITION_SCALE 4096.0
+#define PROTOCOL_VELOCITY_SCALE 256.0
+#define PROTOCOL_ANGLE_SCALE    (65536.0 / 360.0)
+
+#define PROTOCOL_VARINT_MAX 5
+#define PROTOCOL_STATE_MAX  (1 + 3 * PROTOCOL_VARINT_MAX + 3 * 2 + 3 * 2 + 4)
+
+/* Returned by the read functions for input that is not valid protocol. */
+#define PROTOCOL_MALFORMED ((size_t)-1)
+
+/* Player state as sent. The zero state is the base of players new in
+   range. */
+struct player_state {
+    int32_t chunk[3];
+    uint16_t position[3]; /* Within the chunk. */
+    int16_t velocity[3];  /* Clamped to 128 blocks per second. */
+    uint16_t yaw;         /* Wrapped to a full turn. */
+    int16_t pitch;
+};
+
+void protocol_quantize(struct player_state *state,
+                       const struct vector3 *position,
+                       const struct vector3 *velocity, float yaw,
+                       float pitch);
+void protocol_dequantize(const struct player_state *state,
+                         struct vector3 *position, struct vector3 *velocity,
+                         float *yaw, float *pitch);
+
+/* Player in a snapshot. */
+struct player_update {
+    unsigned int id;
+    struct player_state state;
+};
+
+struct vector3 protocol_position(const struct player_state *state);
+
+/* DST must hold PROTOCOL_VARINT_MAX bytes. Returns the bytes written. */
+size_t protocol_write_varint(unsigned char *dst, uint32_t value);
+
+/* Returns the bytes read from the SIZE bytes at SRC, 0 if more are needed,
+   or PROTOCOL_MALFORMED. */
+size_t protocol_read_varint(const unsigned char *src, size_t size,
+                            uint32_t *value);
+
+/* Writes the delta of STATE against BASE to DST, which must hold
+   PROTOCOL_STATE_MAX bytes. Returns the bytes written, 1 if nothing
+   changed. */
+size_t protocol_write_state(unsigned char *dst,
+                            const struct player_state *state,
+                            const struct player_state *base);
+
+/* Applies the delta in the SIZE bytes at SRC to STATE, which holds the
+   base. Returns like protocol_read_varint, and leaves STATE unchanged
+   unless the delta is complete. */
+size_t protocol_read_state(const unsigned char *src, size_t size,
+                           struct player_state *state);
+
+#endif
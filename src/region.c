@@ -0,0 +1,762 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "region.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "macros.h"
+#include "codec.h"
+
+static int floor_div(int value, int divisor) {
+    int quotient = value / divisor;
+
+    return (value % divisor < 0) ? quotient - 1 : quotient;
+}
+
+static int floor_mod(int value, int divisor) {
+    int mod = value % divisor;
+
+    return (mod < 0) ? mod + divisor : mod;
+}
+
+/* Header fields are little-endian regardless of the host. */
+
+static unsigned int get_u32(const unsigned char *src) {
+    return (unsigned int)src[0] | (unsigned int)src[1] << 8 |
+           (unsigned int)src[2] << 16 | (unsigned int)src[3] << 24;
+}
+
+static void put_u32(unsigned char *dst, unsigned int value) {
+    dst[0] = (unsigned char)(value & 0xFF);
+    dst[1] = (unsigned char)((value >> 8) & 0xFF);
+    dst[2] = (unsigned char)((value >> 16) & 0xFF);
+    dst[3] = (unsigned char)((value >> 24) & 0xFF);
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t size,
+                     size_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, buf, size, (off_t)offset);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return FALSE;
+        }
+
+        buf += written;
+        size -= (size_t)written;
+        offset += (size_t)written;
+    }
+
+    return TRUE;
+}
+
+/* Resize the file to SECTOR_COUNT sectors and remap it. */
+static int region_resize(struct region *region, size_t sector_count) {
+    unsigned char *map;
+    unsigned char *used;
+
+    if (ftruncate(region->fd, (off_t)(sector_count * REGION_SECTOR_SIZE))) {
+        return FALSE;
+    }
+
+    map = mmap(NULL, sector_count * REGION_SECTOR_SIZE, PROT_READ, MAP_SHARED,
+               region->fd, 0);
+    if (map == MAP_FAILED) {
+        return FALSE;
+    }
+
+    used = realloc(region->used, sector_count);
+    if (!used) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    if (sector_count > region->sector_count) {
+        memset(used + region->sector_count, FALSE,
+               sector_count - region->sector_count);
+    }
+
+    if (region->map) {
+        munmap(region->map, region->sector_count * REGION_SECTOR_SIZE);
+    }
+
+    region->map          = map;
+    region->used         = used;
+    region->sector_count = sector_count;
+
+    return TRUE;
+}
+
+static void region_close(struct region *region) {
+    if (region->map) {
+        munmap(region->map, region->sector_count * REGION_SECTOR_SIZE);
+    }
+
+    close(region->fd);
+    free(region->replaced_elems);
+    free(region->used);
+    free(region);
+}
+
+/* Returns NULL if the file does not exist and CREATE is FALSE, or on I/O
+   errors. Store mutex must be held. */
+static struct region *region_open(struct region_store *store,
+                                  const struct coord *coord, int create) {
+    char path[sizeof(store->path) + 64];
+    struct region *region;
+    struct stat info;
+    size_t sector_count;
+    int fd;
+    int i;
+
+    sprintf(path, "%s/r.%d.%d.%d.bin", store->path, coord->x, coord->y,
+            coord->z);
+
+    fd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            printf("Failed to open region file %s.\r\n", path);
+        }
+        return NULL;
+    }
+
+    if (fstat(fd, &info)) {
+        printf("Failed to stat region file %s.\r\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    region = calloc(1, sizeof(struct region));
+    if (!region) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    region->coord = *coord;
+    region->fd    = fd;
+
+    /* A trailing partial sector can only come from an interrupted write. */
+    sector_count = (size_t)info.st_size / REGION_SECTOR_SIZE;
+    sector_count = MAX(sector_count, REGION_HEADER_SECTORS);
+
+    if (!region_resize(region, sector_count)) {
+        printf("Failed to map region file %s.\r\n", path);
+        region_close(region);
+        return NULL;
+    }
+
+    memset(region->used, TRUE, REGION_HEADER_SECTORS);
+
+    /* Load the header, dropping locations that point outside the file. */
+    for (i = 0; i < REGION_CHUNKS; i++) {
+        unsigned int location = get_u32(region->map + i * 4);
+        size_t sector         = location >> 8;
+        size_t count          = location & 0xFF;
+
+        if (location == 0) {
+            continue;
+        }
+
+        if (sector < REGION_HEADER_SECTORS || count == 0 ||
+            sector + count > sector_count) {
+            continue;
+        }
+
+        region->locations[i] = location;
+        memset(region->used + sector, TRUE, count);
+    }
+
+    return region;
+}
+
+/* Store mutex must be held. */
+static struct region *region_get(struct region_store *store,
+                                 const struct coord *chunk_coord, int create) {
+    struct region *region;
+    struct coord coord;
+    size_t i;
+
+    coord.x = floor_div(chunk_coord->x, REGION_SIZE);
+    coord.y = floor_div(chunk_coord->y, REGION_SIZE);
+    coord.z = floor_div(chunk_coord->z, REGION_SIZE);
+
+    store->clock++;
+
+    for (i = 0; i < store->regions.size; i++) {
+        region = store->region_elems[i];
+
+        if (region->coord.x == coord.x && region->coord.y == coord.y &&
+            region->coord.z == coord.z) {
+            region->last_use = store->clock;
+            return region;
+        }
+    }
+
+    region = region_open(store, &coord, create);
+    if (!region) {
+        return NULL;
+    }
+    region->last_use = store->clock;
+
+    /* Close the least recently used region to make room. Pinned and dirty
+       ones are skipped, even if that means going over the cap for a
+       while. */
+    if (store->regions.size >= REGION_OPEN_CAP) {
+        size_t oldest = store->regions.size;
+
+        for (i = 0; i < store->regions.size; i++) {
+            if (store->region_elems[i]->pins == 0 &&
+                !store->region_elems[i]->is_dirty &&
+                (oldest == store->regions.size ||
+                 store->region_elems[i]->last_use <
+                     store->region_elems[oldest]->last_use)) {
+                oldest = i;
+            }
+        }
+
+        if (oldest < store->regions.size) {
+            region_close(store->region_elems[oldest]);
+            ARRAY_REMOVE(store->regions, store->region_elems, oldest);
+        }
+    }
+
+    ARRAY_APPEND(store->regions, store->region_elems, region);
+
+    return region;
+}
+
+static size_t region_index(const struct coord *chunk_coord) {
+    return (size_t)INDEX_3D(floor_mod(chunk_coord->x, REGION_SIZE),
+                            floor_mod(chunk_coord->y, REGION_SIZE),
+                            floor_mod(chunk_coord->z, REGION_SIZE),
+                            REGION_SIZE);
+}
+
+/* First fit, growing the file if no free run is long enough. Returns 0 on
+   failure, which is never a payload sector. */
+static size_t region_allocate(struct region *region, size_t count) {
+    while (TRUE) {
+        size_t run = 0;
+        size_t i;
+
+        for (i = REGION_HEADER_SECTORS; i < region->sector_count; i++) {
+            run = region->used[i] ? 0 : run + 1;
+
+            if (run == count) {
+                memset(region->used + i + 1 - count, TRUE, count);
+                return i + 1 - count;
+            }
+        }
+
+        if (!region_resize(region, region->sector_count +
+                                       MAX(count, REGION_GROW_SECTORS))) {
+            return 0;
+        }
+    }
+}
+
+/* Payloads are written to fresh sectors, and the header on disk only points
+   at them once region_sync has made them durable, so a crash leaves either
+   the previous or the new payload intact. Only the writer thread calls
+   this. */
+static void region_write_record(struct region_store *store,
+                                const struct region_write *write) {
+    unsigned char record[REGION_RECORD_HEADER];
+    struct region *region;
+    unsigned int location;
+    unsigned int old_location;
+    size_t count;
+    size_t sector;
+    size_t idx;
+
+    pthread_mutex_lock(&store->mutex);
+
+    region = region_get(store, &write->coord, TRUE);
+    if (!region) {
+        pthread_mutex_unlock(&store->mutex);
+        return;
+    }
+
+    idx    = region_index(&write->coord);
+    count  = (REGION_RECORD_HEADER + write->size + REGION_SECTOR_SIZE - 1) /
+            REGION_SECTOR_SIZE;
+    sector = region_allocate(region, count);
+
+    put_u32(record, (unsigned int)write->size);
+    record[4] = (unsigned char)write->compression;
+
+    location = (unsigned int)(sector << 8 | count);
+
+    if (sector == 0 ||
+        !write_all(region->fd, record, REGION_RECORD_HEADER,
+                   sector * REGION_SECTOR_SIZE) ||
+        !write_all(region->fd, write->payload, write->size,
+                   sector * REGION_SECTOR_SIZE + REGION_RECORD_HEADER)) {
+        printf("Failed to write chunk %d %d %d.\r\n", write->coord.x,
+               write->coord.y, write->coord.z);
+
+        if (sector != 0) {
+            memset(region->used + sector, FALSE, count);
+        }
+
+        pthread_mutex_unlock(&store->mutex);
+        return;
+    }
+
+    /* Reads use the new location right away, the payload is in the page
+       cache. */
+    old_location = region->locations[idx];
+    if (old_location != 0) {
+        ARRAY_APPEND(region->replaced, region->replaced_elems, old_location);
+    }
+
+    region->locations[idx] = location;
+    region->generations[idx]++;
+    region->is_dirty = TRUE;
+
+    pthread_mutex_unlock(&store->mutex);
+}
+
+/* Syncs the payloads written to REGION, then writes and syncs the header
+   pointing at them, and only then frees the sectors they replaced. Store
+   mutex must be held, it is released during the I/O, with the region
+   pinned. Only the writer thread calls this. */
+static void region_sync(struct region_store *store, struct region *region) {
+    unsigned char header[REGION_CHUNKS * 4];
+    unsigned int *replaced_elems;
+    size_t replaced_count;
+    int is_synced;
+    size_t i;
+
+    for (i = 0; i < REGION_CHUNKS; i++) {
+        put_u32(header + i * 4, region->locations[i]);
+    }
+
+    replaced_elems = region->replaced_elems;
+    replaced_count = region->replaced.size;
+
+    region->replaced.size     = 0;
+    region->replaced.capacity = 0;
+    region->replaced_elems    = NULL;
+    region->is_dirty          = FALSE;
+    region->pins++;
+
+    pthread_mutex_unlock(&store->mutex);
+
+    is_synced = fdatasync(region->fd) == 0 &&
+                write_all(region->fd, header, sizeof(header), 0) &&
+                fdatasync(region->fd) == 0;
+
+    pthread_mutex_lock(&store->mutex);
+
+    region->pins--;
+
+    /* Otherwise the header on disk may still point at the replaced sectors.
+       They stay allocated until the file is opened again. */
+    if (is_synced) {
+        for (i = 0; i < replaced_count; i++) {
+            memset(region->used + (replaced_elems[i] >> 8), FALSE,
+                   replaced_elems[i] & 0xFF);
+        }
+    } else {
+        printf("Failed to sync region %d %d %d.\r\n", region->coord.x,
+               region->coord.y, region->coord.z);
+    }
+
+    free(replaced_elems);
+}
+
+/* Syncs every dirty region. Only the writer thread calls this. */
+static void region_store_sync(struct region_store *store) {
+    size_t i = 0;
+
+    pthread_mutex_lock(&store->mutex);
+
+    /* Regions may be closed while the mutex is released, so start over
+       after each. */
+    while (i < store->regions.size) {
+        if (store->region_elems[i]->is_dirty) {
+            region_sync(store, store->region_elems[i]);
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    pthread_mutex_unlock(&store->mutex);
+}
+
+static void *writer(void *context) {
+    struct region_store *store;
+    unsigned char *encoded = NULL;
+    size_t encoded_cap     = 0;
+
+    assert(context);
+
+    store = (struct region_store *)context;
+
+    while (TRUE) {
+        struct region_write *first;
+        struct region_write *last;
+        struct region_write *write;
+        struct region_write *next;
+
+        pthread_mutex_lock(&store->write_mutex);
+
+        while (!store->write_head && !store->is_stopping) {
+            pthread_cond_wait(&store->write_cond, &store->write_mutex);
+        }
+
+        first = store->write_head;
+        last  = store->write_tail;
+
+        pthread_mutex_unlock(&store->write_mutex);
+
+        if (!first) {
+            break;
+        }
+
+        /* Everything queued so far is written as one batch, synced once per
+           region rather than per record. */
+        for (write = first;; write = write->next) {
+            struct region_write record = *write;
+
+            /* Compressed here rather than by the caller, which is usually
+               the render thread. The queued entry is left as is, reads may
+               be copying it. */
+            if (write->compression == REGION_COMPRESSION_NONE &&
+                write->size <= CODEC_INPUT_MAX) {
+                size_t size;
+
+                if (CODEC_BOUND(write->size) > encoded_cap) {
+                    encoded_cap = CODEC_BOUND(write->size);
+                    encoded     = realloc(encoded, encoded_cap);
+                    if (!encoded) {
+                        printf("%s:%d Out of memory!\r\n", __FILE__,
+                               __LINE__);
+                        exit(EXIT_FAILURE);
+                    }
+                }
+
+                size = codec_encode(write->payload, write->size, encoded,
+                                    encoded_cap);
+                if (size > 0 && size < write->size) {
+                    record.compression = REGION_COMPRESSION_CODEC;
+                    record.payload     = encoded;
+                    record.size        = size;
+                }
+            }
+
+            region_write_record(store, &record);
+
+            if (write == last) {
+                break;
+            }
+        }
+
+        region_store_sync(store);
+
+        /* Dequeue only now that reads find the payloads on disk. */
+        pthread_mutex_lock(&store->write_mutex);
+
+        store->write_head = last->next;
+        if (!store->write_head) {
+            store->write_tail = NULL;
+            pthread_cond_broadcast(&store->flush_cond);
+        }
+
+        pthread_mutex_unlock(&store->write_mutex);
+
+        for (write = first; write != last; write = next) {
+            next = write->next;
+            free(write->payload);
+            free(write);
+        }
+
+        free(last->payload);
+        free(last);
+    }
+
+    free(encoded);
+
+    return NULL;
+}
+
+void region_store_init(struct region_store *store, const char *path) {
+    assert(store);
+    assert(path);
+    assert(strlen(path) < sizeof(store->path));
+
+    strcpy(store->path, path);
+
+    if (mkdir(path, 0755) && errno != EEXIST) {
+        printf("Failed to create world directory %s.\r\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_init(&store->mutex, NULL);
+    store->regions.size     = 0;
+    store->regions.capacity = 0;
+    store->region_elems     = NULL;
+    store->clock            = 0;
+
+    pthread_mutex_init(&store->write_mutex, NULL);
+    pthread_cond_init(&store->write_cond, NULL);
+    pthread_cond_init(&store->flush_cond, NULL);
+    store->write_head  = NULL;
+    store->write_tail  = NULL;
+    store->is_stopping = FALSE;
+
+    pthread_create(&store->writer, NULL, writer, store);
+}
+
+void region_store_free(struct region_store *store) {
+    size_t i;
+
+    assert(store);
+
+    pthread_mutex_lock(&store->write_mutex);
+    store->is_stopping = TRUE;
+    pthread_cond_signal(&store->write_cond);
+    pthread_mutex_unlock(&store->write_mutex);
+
+    pthread_join(store->writer, NULL);
+
+    for (i = 0; i < store->regions.size; i++) {
+        region_close(store->region_elems[i]);
+    }
+
+    free(store->region_elems);
+    store->region_elems     = NULL;
+    store->regions.size     = 0;
+    store->regions.capacity = 0;
+
+    pthread_cond_destroy(&store->flush_cond);
+    pthread_cond_destroy(&store->write_cond);
+    pthread_mutex_destroy(&store->write_mutex);
+    pthread_mutex_destroy(&store->mutex);
+}
+
+size_t region_store_read(struct region_store *store, const struct coord *coord,
+                         int *compression, unsigned char *buf, size_t cap) {
+    const struct region_write *pending = NULL;
+    const struct region_write *write;
+    struct region *region;
+    unsigned int location;
+    const unsigned char *record;
+    size_t size;
+
+    assert(store);
+    assert(coord);
+    assert(compression);
+    assert(buf);
+
+    /* The most recently queued payload wins over the file. */
+    pthread_mutex_lock(&store->write_mutex);
+
+    for (write = store->write_head; write; write = write->next) {
+        if (write->coord.x == coord->x && write->coord.y == coord->y &&
+            write->coord.z == coord->z) {
+            pending = write;
+        }
+    }
+
+    if (pending) {
+        size = (pending->size <= cap) ? pending->size : 0;
+
+        memcpy(buf, pending->payload, size);
+        *compression = pending->compression;
+
+        pthread_mutex_unlock(&store->write_mutex);
+        return size;
+    }
+
+    pthread_mutex_unlock(&store->write_mutex);
+
+    /* Copy out of the mapping. Holding the store mutex keeps the writer
+       from freeing, reusing or unmapping the sectors meanwhile. */
+    pthread_mutex_lock(&store->mutex);
+
+    region = region_get(store, coord, FALSE);
+    if (!region) {
+        pthread_mutex_unlock(&store->mutex);
+        return 0;
+    }
+
+    location = region->locations[region_index(coord)];
+    if (location == 0) {
+        pthread_mutex_unlock(&store->mutex);
+        return 0;
+    }
+
+    record = region->map + (size_t)(location >> 8) * REGION_SECTOR_SIZE;
+    size   = get_u32(record);
+
+    if (size > cap || REGION_RECORD_HEADER + size >
+                          (size_t)(location & 0xFF) * REGION_SECTOR_SIZE) {
+        pthread_mutex_unlock(&store->mutex);
+        return 0;
+    }
+
+    memcpy(buf, record + REGION_RECORD_HEADER, size);
+    *compression = record[4];
+
+    pthread_mutex_unlock(&store->mutex);
+    return size;
+}
+
+void region_store_write(struct region_store *store, const struct coord *coord,
+                        int compression, const unsigned char *payload,
+                        size_t size) {
+    struct region_write *write;
+
+    assert(store);
+    assert(coord);
+    assert(payload);
+    assert(size <= REGION_PAYLOAD_MAX);
+
+    write = malloc(sizeof(struct region_write));
+    if (!write) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    write->payload = malloc(size);
+    if (!write->payload) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    write->coord       = *coord;
+    write->compression = compression;
+    write->size        = size;
+    write->next        = NULL;
+    memcpy(write->payload, payload, size);
+
+    pthread_mutex_lock(&store->write_mutex);
+
+    if (store->write_tail) {
+        store->write_tail->next = write;
+    } else {
+        store->write_head = write;
+    }
+    store->write_tail = write;
+
+    pthread_cond_signal(&store->write_cond);
+    pthread_mutex_unlock(&store->write_mutex);
+}
+
+int region_store_locate(struct region_store *store, const struct coord *coord,
+                        struct region_location *location) {
+    const struct region_write *write;
+    struct region *region;
+    unsigned int stored;
+
+    assert(store);
+    assert(coord);
+    assert(location);
+
+    pthread_mutex_lock(&store->write_mutex);
+
+    for (write = store->write_head; write; write = write->next) {
+        if (write->coord.x == coord->x && write->coord.y == coord->y &&
+            write->coord.z == coord->z) {
+            pthread_mutex_unlock(&store->write_mutex);
+            return REGION_PENDING;
+        }
+    }
+
+    pthread_mutex_unlock(&store->write_mutex);
+
+    pthread_mutex_lock(&store->mutex);
+
+    region = region_get(store, coord, FALSE);
+    if (!region) {
+        pthread_mutex_unlock(&store->mutex);
+        return REGION_MISSING;
+    }
+
+    location->idx = region_index(coord);
+    stored        = region->locations[location->idx];
+
+    if (stored == 0) {
+        pthread_mutex_unlock(&store->mutex);
+        return REGION_MISSING;
+    }
+
+    region->pins++;
+
+    location->region     = region;
+    location->location   = stored;
+    location->generation = region->generations[location->idx];
+    location->fd       = region->fd;
+    location->offset   = (size_t)(stored >> 8) * REGION_SECTOR_SIZE;
+    location->length   = (size_t)(stored & 0xFF) * REGION_SECTOR_SIZE;
+
+    pthread_mutex_unlock(&store->mutex);
+    return REGION_STORED;
+}
+
+int region_store_unpin(struct region_store *store,
+                       const struct region_location *location) {
+    int is_current;
+
+    assert(store);
+    assert(location);
+
+    /* Records are never rewritten in place, and their sectors are only
+       reused once the chunk was written again. Comparing locations would
+       miss a chunk written twice that got its old sectors back. */
+    pthread_mutex_lock(&store->mutex);
+
+    location->region->pins--;
+    is_current = location->region->generations[location->idx] ==
+                 location->generation;
+
+    pthread_mutex_unlock(&store->mutex);
+    return is_current;
+}
+
+size_t region_record_parse(const unsigned char *record, size_t length,
+                           int *compression) {
+    size_t size;
+
+    assert(record);
+    assert(compression);
+
+    if (length < REGION_RECORD_HEADER) {
+        return 0;
+    }
+
+    size = get_u32(record);
+    if (size > length - REGION_RECORD_HEADER) {
+        return 0;
+    }
+
+    *compression = record[4];
+    return size;
+}
+
+void region_store_flush(struct region_store *store) {
+    assert(store);
+
+    pthread_mutex_lock(&store->write_mutex);
+
+    while (store->write_head) {
+        pthread_cond_wait(&store->flush_cond, &store->write_mutex);
+    }
+
+    pthread_mutex_unlock(&store->write_mutex);
+}
@@ -0,0 +1,153 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "array.h"
+#include "coord.h"
+
+/* Chunks per region file along each axis. */
+#define REGION_SIZE   16
+#define REGION_CHUNKS (REGION_SIZE * REGION_SIZE * REGION_SIZE)
+
+/* Payloads are allocated in whole sectors, after a header holding a 4-byte
+   location per chunk: the first sector in the upper 24 bits and the sector
+   count in the lower 8, or 0 if the chunk is not stored. */
+#define REGION_SECTOR_SIZE    4096
+#define REGION_HEADER_SECTORS (REGION_CHUNKS * 4 / REGION_SECTOR_SIZE)
+
+/* Every payload is prefixed with its length and compression. */
+#define REGION_RECORD_HEADER 5
+#define REGION_PAYLOAD_MAX   (255 * REGION_SECTOR_SIZE - REGION_RECORD_HEADER)
+
+/* Files grow by this many sectors at a time, to remap less often. */
+#define REGION_GROW_SECTORS 64
+
+/* Region files kept open and mapped at once. */
+#define REGION_OPEN_CAP 32
+
+/* Payload compression tags. */
+#define REGION_COMPRESSION_NONE  0
+#define REGION_COMPRESSION_CODEC 1 /* codec.h */
+
+/* Open region file. The whole file is mapped read-only, payloads are written
+   with pwrite, which the shared mapping observes. */
+struct region {
+    struct coord coord;
+    int fd;
+
+    unsigned char *map;
+    size_t sector_count;
+
+    /* Chunk locations, mirroring the header. */
+    unsigned int locations[REGION_CHUNKS];
+
+    /* Bumped on every write of each chunk. A location can come back once
+       its sectors are freed and reallocated, a generation cannot. */
+    unsigned int generations[REGION_CHUNKS];
+
+    /* One byte per sector, TRUE if allocated. */
+    unsigned char *used;
+
+    unsigned long last_use;
+
+    /* Located records being read outside the mapping. Pinned regions are not
+       closed, so their fd stays valid. */
+    int pins;
+
+    /* Locations replaced since the header was last synced. Their sectors
+       stay allocated until then, so after a crash the header on disk still
+       points at intact payloads. Dirty regions are not closed. */
+    int is_dirty;
+    struct array replaced;
+    unsigned int *replaced_elems;
+};
+
+/* Payload waiting for the writer thread. */
+struct region_write {
+    struct coord coord;
+    int compression;
+    unsigned char *payload;
+    size_t size;
+    struct region_write *next;
+};
+
+/* Result of region_store_locate. */
+#define REGION_MISSING 0
+#define REGION_STORED  1
+#define REGION_PENDING 2 /* Queued for writing, use region_store_read. */
+
+/* Where a stored record is in its region file, for reading it with pread or
+   asynchronous I/O instead of through the mapping. */
+struct region_location {
+    struct region *region;
+    size_t idx;
+    unsigned int location;
+    unsigned int generation;
+
+    int fd;
+    size_t offset;
+    size_t length; /* Whole sectors, record header included. */
+};
+
+/* Directory of region files. Reads are served from the mapped files on the
+   calling thread, writes are queued for a background writer thread and are
+   visible to reads as soon as they are queued. */
+struct region_store {
+    char path[256];
+
+    /* Open regions, least recently used is closed first. */
+    pthread_mutex_t mutex;
+    struct array regions;
+    struct region **region_elems;
+    unsigned long clock;
+
+    /* Writer thread. Entries stay queued until written, so reads never miss
+       a payload in flight. */
+    pthread_t writer;
+    pthread_mutex_t write_mutex;
+    pthread_cond_t write_cond;
+    pthread_cond_t flush_cond;
+    struct region_write *write_head;
+    struct region_write *write_tail;
+    int is_stopping;
+};
+
+void region_store_init(struct region_store *store, const char *path);
+
+/* Writes everything queued, then stops the writer and closes all files. */
+void region_store_free(struct region_store *store);
+
+/* Thread-safe. Copies the payload of the chunk at COORD into BUF and returns
+   its size, or 0 if the chunk is not stored or larger than CAP. */
+size_t region_store_read(struct region_store *store, const struct coord *coord,
+                         int *compression, unsigned char *buf, size_t cap);
+
+/* Thread-safe. Queues a copy of PAYLOAD to be stored for the chunk at
+   COORD. Uncompressed payloads are compressed with codec.h by the writer
+   thread when that makes them smaller, reads return them as queued until
+   they are written. */
+void region_store_write(struct region_store *store, const struct coord *coord,
+                        int compression, const unsigned char *payload,
+                        size_t size);
+
+/* Thread-safe. Finds and pins the record of the chunk at COORD if it is
+   REGION_STORED, to be released with region_store_unpin once read. */
+int region_store_locate(struct region_store *store, const struct coord *coord,
+                        struct region_location *location);
+
+/* Thread-safe. Returns TRUE if the record has not been rewritten since it
+   was located, so the bytes read from it are valid. */
+int region_store_unpin(struct region_store *store,
+                       const struct region_location *location);
+
+/* Returns the payload size of a record read from a location, with the
+   payload starting REGION_RECORD_HEADER bytes in, or 0 if malformed. */
+size_t region_record_parse(const unsigned char *record, size_t length,
+                           int *compression);
+
+/* Thread-safe. Blocks until everything queued so far is written. */
+void region_store_flush(struct region_store *store);
+
+#endif
@@ -0,0 +1,395 @@
+#define _GNU_SOURCE
+
+#include "region_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "macros.h"
+#include "atomic.h"
+
+/* Sets UURING->fd to -1 if io_uring is unavailable. There is no liburing
+   dependency, the rings are mapped by hand. */
+static void uring_init(struct region_uring *uring, unsigned int entries) {
+    struct io_uring_params params;
+    long fd;
+
+    memset(uring, 0, sizeof(*uring));
+    memset(&params, 0, sizeof(params));
+
+    uring->fd = -1;
+
+    fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return;
+    }
+
+    uring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cq_size = params.cq_off.cqes +
+                     params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        uring->sq_size = MAX(uring->sq_size, uring->cq_size);
+        uring->cq_size = 0;
+    }
+
+    uring->sq_ptr = mmap(NULL, uring->sq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, (int)fd, IORING_OFF_SQ_RING);
+
+    uring->cq_ptr = uring->sq_ptr;
+    if (uring->cq_size > 0 && uring->sq_ptr != MAP_FAILED) {
+        uring->cq_ptr = mmap(NULL, uring->cq_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, (int)fd, IORING_OFF_CQ_RING);
+    }
+
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes      = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, (int)fd, IORING_OFF_SQES);
+
+    if (uring->sq_ptr == MAP_FAILED || uring->cq_ptr == MAP_FAILED ||
+        uring->sqes == MAP_FAILED) {
+        if (uring->sqes != MAP_FAILED) {
+            munmap(uring->sqes, uring->sqes_size);
+        }
+        if (uring->cq_size > 0 && uring->cq_ptr != MAP_FAILED) {
+            munmap(uring->cq_ptr, uring->cq_size);
+        }
+        if (uring->sq_ptr != MAP_FAILED) {
+            munmap(uring->sq_ptr, uring->sq_size);
+        }
+
+        close((int)fd);
+        memset(uring, 0, sizeof(*uring));
+        uring->fd = -1;
+        return;
+    }
+
+    uring->fd = (int)fd;
+
+    uring->sq_tail  = (unsigned int *)(void *)((char *)uring->sq_ptr +
+                                              params.sq_off.tail);
+    uring->sq_mask  = (unsigned int *)(void *)((char *)uring->sq_ptr +
+                                              params.sq_off.ring_mask);
+    uring->sq_array = (unsigned int *)(void *)((char *)uring->sq_ptr +
+                                               params.sq_off.array);
+
+    uring->cq_head = (unsigned int *)(void *)((char *)uring->cq_ptr +
+                                              params.cq_off.head);
+    uring->cq_tail = (unsigned int *)(void *)((char *)uring->cq_ptr +
+                                              params.cq_off.tail);
+    uring->cq_mask = (unsigned int *)(void *)((char *)uring->cq_ptr +
+                                              params.cq_off.ring_mask);
+    uring->cqes    = (char *)uring->cq_ptr + params.cq_off.cqes;
+}
+
+static void uring_free(struct region_uring *uring) {
+    if (uring->fd == -1) {
+        return;
+    }
+
+    munmap(uring->sqes, uring->sqes_size);
+    if (uring->cq_size > 0) {
+        munmap(uring->cq_ptr, uring->cq_size);
+    }
+    munmap(uring->sq_ptr, uring->sq_size);
+    close(uring->fd);
+
+    uring->fd = -1;
+}
+
+/* Submit COUNT reads, at most the ring size, and wait for all of them. */
+static void uring_read(struct region_uring *uring, struct region_read **reads,
+                       size_t count) {
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned int tail;
+    size_t submitted;
+    size_t completed;
+    size_t i;
+
+    sqes = (struct io_uring_sqe *)uring->sqes;
+    cqes = (struct io_uring_cqe *)uring->cqes;
+
+    /* The kernel only reads the tail, we are the only producer. */
+    tail = *uring->sq_tail;
+
+    for (i = 0; i < count; i++) {
+        struct region_read *read = reads[i];
+        unsigned int idx         = tail & *uring->sq_mask;
+        struct io_uring_sqe *sqe = &sqes[idx];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode    = IORING_OP_READ;
+        sqe->fd        = read->location.fd;
+        sqe->addr      = (unsigned long)read->buffer;
+        sqe->len       = (unsigned int)read->location.length;
+        sqe->off       = read->location.offset;
+        sqe->user_data = (unsigned long)read;
+
+        uring->sq_array[idx] = idx;
+        tail++;
+    }
+
+    ATOMIC_STORE_RELEASE(uring->sq_tail, tail);
+
+    submitted = 0;
+    completed = 0;
+
+    while (completed < count) {
+        unsigned int head;
+        long ret;
+
+        ret = syscall(__NR_io_uring_enter, uring->fd, count - submitted,
+                      count - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+
+            /* Buffers may still be in flight, nothing safe to fall back to. */
+            printf("%s:%d io_uring_enter failed!\r\n", __FILE__, __LINE__);
+            exit(EXIT_FAILURE);
+        }
+        submitted += (size_t)ret;
+
+        head = *uring->cq_head;
+
+        while (head != ATOMIC_LOAD_ACQUIRE(uring->cq_tail)) {
+            struct io_uring_cqe *cqe = &cqes[head & *uring->cq_mask];
+            struct region_read *read;
+
+            read         = (struct region_read *)(size_t)cqe->user_data;
+            read->result = cqe->res;
+
+            head++;
+            completed++;
+        }
+
+        ATOMIC_STORE_RELEASE(uring->cq_head, head);
+    }
+}
+
+static int pread_all(struct region_read *read) {
+    size_t done = 0;
+
+    while (done < read->location.length) {
+        ssize_t ret = pread(read->location.fd, read->buffer + done,
+                            read->location.length - done,
+                            (off_t)(read->location.offset + done));
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (ret <= 0) {
+            return -1;
+        }
+
+        done += (size_t)ret;
+    }
+
+    return (int)done;
+}
+
+static void *alloc_buffer(size_t size) {
+    void *buffer = malloc(MAX(size, 1));
+
+    if (!buffer) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    return buffer;
+}
+
+/* Through the mapping, for records waiting to be written or that moved
+   while being read. */
+static void read_mapped(struct region_io *io, struct region_read *read) {
+    free(read->buffer);
+
+    read->buffer  = alloc_buffer(read->cap);
+    read->size    = region_store_read(io->store, &read->coord,
+                                      &read->compression, read->buffer,
+                                      read->cap);
+    read->payload = read->buffer;
+}
+
+static void read_batch(struct region_io *io, struct region_read *batch) {
+    struct region_read *located[REGION_IO_DEPTH];
+    struct region_read *read;
+
+    while (batch) {
+        size_t count = 0;
+        size_t i;
+
+        /* Locate up to a ring's worth of records. */
+        while (batch && count < REGION_IO_DEPTH) {
+            int status;
+
+            read  = batch;
+            batch = batch->next;
+
+            read->buffer     = NULL;
+            read->payload    = NULL;
+            read->size       = 0;
+            read->is_located = FALSE;
+
+            status = region_store_locate(io->store, &read->coord,
+                                         &read->location);
+
+            if (status == REGION_STORED) {
+                read->buffer     = alloc_buffer(read->location.length);
+                read->is_located = TRUE;
+                located[count++] = read;
+            } else if (status == REGION_PENDING) {
+                read_mapped(io, read);
+            }
+
+            /* Missing and pending ones need no I/O, complete them first. */
+            if (!read->is_located) {
+                unsigned char *buffer = read->buffer;
+
+                read->complete(read);
+                free(buffer);
+            }
+        }
+
+        if (io->uring.fd != -1) {
+            uring_read(&io->uring, located, count);
+        } else {
+            for (i = 0; i < count; i++) {
+                located[i]->result = pread_all(located[i]);
+            }
+        }
+
+        for (i = 0; i < count; i++) {
+            unsigned char *buffer;
+            int is_current;
+
+            read       = located[i];
+            is_current = region_store_unpin(io->store, &read->location);
+
+            if (is_current &&
+                read->result == (int)read->location.length) {
+                read->size = region_record_parse(read->buffer,
+                                                 read->location.length,
+                                                 &read->compression);
+                read->payload = read->buffer + REGION_RECORD_HEADER;
+            }
+
+            if (!is_current || read->size == 0 || read->size > read->cap) {
+                read_mapped(io, read);
+            }
+
+            buffer = read->buffer;
+            read->complete(read);
+            free(buffer);
+        }
+    }
+}
+
+static void *io_thread(void *context) {
+    struct region_io *io;
+
+    assert(context);
+
+    io = (struct region_io *)context;
+
+    while (TRUE) {
+        struct region_read *batch;
+
+        pthread_mutex_lock(&io->mutex);
+
+        while (!io->head && !io->is_stopping) {
+            pthread_cond_wait(&io->cond, &io->mutex);
+        }
+
+        batch    = io->head;
+        io->head = NULL;
+        io->tail = NULL;
+
+        pthread_mutex_unlock(&io->mutex);
+
+        if (!batch) {
+            break;
+        }
+
+        read_batch(io, batch);
+    }
+
+    return NULL;
+}
+
+void region_io_init(struct region_io *io, struct region_store *store) {
+    assert(io);
+    assert(store);
+
+    io->store = store;
+
+    uring_init(&io->uring, REGION_IO_DEPTH);
+
+    if (io->uring.fd == -1) {
+        printf("io_uring unavailable, reading region files with pread.\r\n");
+    }
+
+    pthread_mutex_init(&io->mutex, NULL);
+    pthread_cond_init(&io->cond, NULL);
+    io->head        = NULL;
+    io->tail        = NULL;
+    io->is_stopping = FALSE;
+
+    pthread_create(&io->thread, NULL, io_thread, io);
+}
+
+void region_io_free(struct region_io *io) {
+    assert(io);
+
+    pthread_mutex_lock(&io->mutex);
+    io->is_stopping = TRUE;
+    pthread_cond_signal(&io->cond);
+    pthread_mutex_unlock(&io->mutex);
+
+    pthread_join(io->thread, NULL);
+
+    uring_free(&io->uring);
+
+    pthread_cond_destroy(&io->cond);
+    pthread_mutex_destroy(&io->mutex);
+}
+
+void region_io_submit(struct region_io *io, struct region_read **reads,
+                      size_t count) {
+    size_t i;
+
+    assert(io);
+    assert(reads || count == 0);
+
+    if (count == 0) {
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        assert(reads[i]->complete);
+        reads[i]->next = (i + 1 < count) ? reads[i + 1] : NULL;
+    }
+
+    pthread_mutex_lock(&io->mutex);
+
+    if (io->tail) {
+        io->tail->next = reads[0];
+    } else {
+        io->head = reads[0];
+    }
+    io->tail = reads[count - 1];
+
+    pthread_cond_signal(&io->cond);
+    pthread_mutex_unlock(&io->mutex);
+}
@@ -0,0 +1,81 @@
+#ifndef REGION_IO_H
+#define REGION_IO_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "coord.h"
+#include "region.h"
+
+/* Reads submitted to the kernel at once. */
+#define REGION_IO_DEPTH 64
+
+/* Asynchronous chunk read. Filled in by the caller up to context, the rest
+   is set before complete is called on the I/O thread. */
+struct region_read {
+    struct coord coord;
+    size_t cap; /* Largest payload accepted. */
+    void (*complete)(struct region_read *read);
+    void *context;
+
+    /* Result, size 0 if the chunk is not stored. The payload is freed after
+       complete returns. */
+    int compression;
+    const unsigned char *payload;
+    size_t size;
+
+    /* Internal. */
+    struct region_location location;
+    unsigned char *buffer;
+    int is_located;
+    int result;
+    struct region_read *next;
+};
+
+/* io_uring submission and completion rings, set up with raw syscalls. */
+struct region_uring {
+    int fd;
+
+    void *sq_ptr;
+    size_t sq_size;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    void *sqes;
+    size_t sqes_size;
+
+    void *cq_ptr;
+    size_t cq_size;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    void *cqes;
+};
+
+/* Reads region records off the calling threads. An I/O thread takes every
+   read queued since its last batch and has them all in flight at once with
+   io_uring, or with sequential preads where io_uring is unavailable. */
+struct region_io {
+    struct region_store *store;
+
+    /* fd -1 if io_uring is unavailable. */
+    struct region_uring uring;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct region_read *head;
+    struct region_read *tail;
+    int is_stopping;
+};
+
+void region_io_init(struct region_io *io, struct region_store *store);
+
+/* Completes everything queued, then stops the I/O thread. */
+void region_io_free(struct region_io *io);
+
+/* Thread-safe. Queues COUNT reads, each completed exactly once. */
+void region_io_submit(struct region_io *io, struct region_read **reads,
+                      size_t count);
+
+#endif
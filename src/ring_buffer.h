@@ -2,6 +2,7 @@
 #define RING_BUFFER_H
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
 
@@ -93,4 +94,32 @@ struct ring_buffer {
         }                                                                     \
     } while (0)
 
+/* Grow capacity to CAP (a power of two) if smaller, keeping queued elements
+   in order. */
+#define RING_BUFFER_RESERVE(QUEUE, ELEMS, CAP)                                \
+    do {                                                                      \
+        size_t _rcap = (CAP);                                                 \
+        assert((_rcap & (_rcap - 1)) == 0);                                   \
+                                                                              \
+        if (_rcap > (QUEUE).capacity) {                                       \
+            size_t _rsize = (QUEUE).size;                                     \
+            void *_relems = malloc(_rcap * sizeof(*(ELEMS)));                 \
+            if (!_relems) {                                                   \
+                printf("%s:%d Out of memory!\n", __FILE__, __LINE__);         \
+                exit(EXIT_FAILURE);                                           \
+            }                                                                 \
+                                                                              \
+            if (_rsize > 0) {                                                 \
+                RING_BUFFER_POP_N(QUEUE, ELEMS, _rsize, _relems);             \
+            }                                                                 \
+            free(ELEMS);                                                      \
+                                                                              \
+            (ELEMS)           = _relems;                                      \
+            (QUEUE).head      = 0;                                            \
+            (QUEUE).tail      = _rsize;                                       \
+            (QUEUE).size      = _rsize;                                       \
+            (QUEUE).capacity  = _rcap;                                        \
+        }                                                                     \
+    } while (0)
+
 #endif
\ No newline at end of file
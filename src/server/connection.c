@@ -0,0 +1,198 @@
+#include "server/connection.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "atomic.h"
+#include "macros.h"
+
+/* Generations fill the bits above the index. */
+#define GENERATION_MAX ((~0u) >> CONNECTION_INDEX_BITS)
+
+/* Created by the listener, destroyed by shards. */
+static size_t total_count;
+static size_t pending_count;
+
+void connection_table_init(struct connection_table *table) {
+    assert(table);
+
+    table->slots.size     = 0;
+    table->slots.capacity = 0;
+    table->slot_elems     = NULL;
+
+    table->free.size     = 0;
+    table->free.capacity = 0;
+    table->free_elems    = NULL;
+
+    table->live.size     = 0;
+    table->live.capacity = 0;
+    table->live_elems    = NULL;
+}
+
+void connection_table_free(struct connection_table *table) {
+    size_t i;
+
+    assert(table);
+
+    for (i = 0; i < table->live.size; i++) {
+        connection_destroy(table->live_elems[i]);
+    }
+
+    free(table->slot_elems);
+    free(table->free_elems);
+    free(table->live_elems);
+
+    connection_table_init(table);
+}
+
+int connection_table_attach(struct connection_table *table,
+                            struct connection *connection) {
+    struct connection_slot *slot;
+    unsigned int idx;
+
+    assert(table);
+    assert(connection);
+
+    if (table->free.size > 0) {
+        ARRAY_POP(table->free, table->free_elems, idx);
+    } else if (table->slots.size < CONNECTIONS_MAX) {
+        struct connection_slot empty;
+
+        empty.connection = NULL;
+        empty.generation = 1;
+        empty.live_idx   = 0;
+
+        idx = (unsigned int)table->slots.size;
+        ARRAY_APPEND(table->slots, table->slot_elems, empty);
+    } else {
+        return FALSE;
+    }
+
+    slot = &table->slot_elems[idx];
+
+    connection->handle = slot->generation << CONNECTION_INDEX_BITS | idx;
+
+    slot->connection = connection;
+    slot->live_idx   = table->live.size;
+
+    ARRAY_APPEND(table->live, table->live_elems, connection);
+
+    return TRUE;
+}
+
+struct connection *connection_table_get(const struct connection_table *table,
+                                        unsigned int handle) {
+    const struct connection_slot *slot;
+    unsigned int idx;
+
+    assert(table);
+
+    idx = CONNECTION_INDEX(handle);
+
+    if (idx >= table->slots.size) {
+        return NULL;
+    }
+
+    slot = &table->slot_elems[idx];
+
+    if (!slot->connection ||
+        slot->generation != CONNECTION_GENERATION(handle)) {
+        return NULL;
+    }
+
+    return slot->connection;
+}
+
+void connection_table_detach(struct connection_table *table,
+                             unsigned int handle) {
+    struct connection_slot *slot;
+    struct connection *connection;
+    struct connection *last;
+    unsigned int idx;
+
+    assert(table);
+
+    connection = connection_table_get(table, handle);
+    assert(connection);
+
+    idx  = CONNECTION_INDEX(handle);
+    slot = &table->slot_elems[idx];
+
+    /* Keep the live array packed. */
+    ARRAY_POP(table->live, table->live_elems, last);
+    if (last != connection) {
+        table->live_elems[slot->live_idx] = last;
+        table->slot_elems[CONNECTION_INDEX(last->handle)].live_idx =
+            slot->live_idx;
+    }
+
+    /* Invalidate outstanding handles. 0 is never a generation. */
+    slot->connection = NULL;
+    slot->generation = (slot->generation == GENERATION_MAX)
+                           ? 1
+                           : slot->generation + 1;
+
+    ARRAY_APPEND(table->free, table->free_elems, idx);
+}
+
+struct connection *connection_create(int socket,
+                                     const struct sockaddr_in *addr) {
+    struct connection *connection;
+
+    assert(addr);
+
+    connection = calloc(1, sizeof(struct connection));
+    if (!connection) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    connection->socket = socket;
+    connection->addr   = *addr;
+
+    transport_init(&connection->transport);
+    send_queue_init(&connection->out);
+
+    ATOMIC_FETCH_ADD(&total_count, 1);
+    ATOMIC_FETCH_ADD(&pending_count, 1);
+
+    return connection;
+}
+
+void connection_destroy(struct connection *connection) {
+    size_t i;
+
+    assert(connection);
+
+    transport_free(&connection->transport);
+    send_queue_free(&connection->out);
+
+    for (i = 0; i < TRANSPORT_WINDOW; i++) {
+        free(connection->snapshots[i].player_elems);
+    }
+
+    if (!connection->has_hello) {
+        ATOMIC_FETCH_SUB(&pending_count, 1);
+    }
+    ATOMIC_FETCH_SUB(&total_count, 1);
+
+    free(connection);
+}
+
+void connection_set_hello(struct connection *connection) {
+    assert(connection);
+    assert(!connection->has_hello);
+
+    connection->has_hello = TRUE;
+    ATOMIC_FETCH_SUB(&pending_count, 1);
+}
+
+size_t connection_count(void) {
+    return ATOMIC_LOAD_RELAXED(&total_count);
+}
+
+size_t connection_pending_count(void) {
+    return ATOMIC_LOAD_RELAXED(&pending_count);
+}
@@ -0,0 +1,151 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <arpa/inet.h>
+
+#include "array.h"
+#include "protocol.h"
+#include "transport.h"
+#include "server/interest.h"
+#include "server/send_queue.h"
+
+/* Handles pack a slot index in the low bits and the slot's generation in
+   the high bits. Generations start at 1, so handles below
+   CONNECTIONS_MAX are never valid and free for other uses. */
+#define CONNECTION_INDEX_BITS 16
+#define CONNECTIONS_MAX       (1u << CONNECTION_INDEX_BITS)
+
+#define CONNECTION_INDEX(HANDLE) ((HANDLE) & (CONNECTIONS_MAX - 1))
+#define CONNECTION_GENERATION(HANDLE) ((HANDLE) >> CONNECTION_INDEX_BITS)
+
+/* States of a player at the last TRANSPORT_WINDOW ticks of its shard, at
+   the tick modulo the window. Updates against them are shared between the
+   clients whose snapshot bases hold them. */
+struct player_history {
+    unsigned long ticks[TRANSPORT_WINDOW];
+    struct player_state states[TRANSPORT_WINDOW];
+};
+
+/* State received from a client, kept as the base of later ones. */
+struct received_state {
+    int is_used;
+    uint16_t sequence; /* Of the datagram it came in. */
+    struct player_state state;
+};
+
+/* Snapshot sent to a client, with its players sorted by id. */
+struct snapshot {
+    int is_used;
+    uint16_t sequence; /* Of the datagram it was sent in. */
+    unsigned long tick;
+    struct array players;
+    struct player_update *player_elems;
+};
+
+struct connection {
+    /* Handle in the table of the owning shard, valid until detached, and
+       never reused by another connection until its slot generation
+       wraps. */
+    unsigned int handle;
+
+    /* Player id seen by clients, stable across shards. */
+    unsigned int id;
+
+    /* Connected to the client, so the kernel routes its datagrams here.
+       Datagrams to it go out through the listening socket. */
+    int socket;
+    struct sockaddr_in addr;
+
+    struct transport transport;
+
+    /* TRUE once the client sent a hello of this protocol version, set by
+       connection_set_hello. Until then the server sends it nothing on
+       ticks, and drops it after a short time. */
+    int has_hello;
+    unsigned long hello_ticks;
+
+    /* Latest state, from datagram STATE_SEQUENCE, so older ones are
+       dropped. The player joins the interest grid with its first one. */
+    struct player_state state;
+    int has_state;
+    uint16_t state_sequence;
+    unsigned long update_tick;
+    struct player_history history;
+    struct interest_member member;
+
+    /* States received, at their sequence modulo the window. */
+    struct received_state received[TRANSPORT_WINDOW];
+
+    /* Last snapshots sent, at their sequence modulo the window. */
+    struct snapshot snapshots[TRANSPORT_WINDOW];
+
+    /* Datagram of this tick, its own bytes and the blocks it shares. */
+    struct send_queue out;
+
+    /* Shards other than the owner that hold a ghost of this player. */
+    unsigned long ghost_mask;
+
+    unsigned long idle_ticks;
+
+    char ip[INET_ADDRSTRLEN];
+};
+
+struct connection_slot {
+    struct connection *connection;
+    unsigned int generation;
+
+    /* Position in the table's live array. */
+    size_t live_idx;
+};
+
+/* Slot map of connections with generation-checked handles. Lookup by
+   handle is O(1) and the live connections are packed for iteration. */
+struct connection_table {
+    struct array slots;
+    struct connection_slot *slot_elems;
+
+    /* Indices of unused slots. */
+    struct array free;
+    unsigned int *free_elems;
+
+    /* Removal swaps the last connection into the hole, so iterate
+       backwards when removing. */
+    struct array live;
+    struct connection **live_elems;
+};
+
+void connection_table_init(struct connection_table *table);
+
+/* Destroys all attached connections without closing their sockets. */
+void connection_table_free(struct connection_table *table);
+
+/* Sets the handle of CONNECTION. Returns FALSE if all CONNECTIONS_MAX slots
+   are in use. */
+int connection_table_attach(struct connection_table *table,
+                            struct connection *connection);
+
+/* Returns NULL if HANDLE was detached. */
+struct connection *connection_table_get(const struct connection_table *table,
+                                        unsigned int handle);
+
+/* Invalidates HANDLE. The connection can be attached to another table. */
+void connection_table_detach(struct connection_table *table,
+                             unsigned int handle);
+
+/* Returns a zeroed connection for SOCKET, connected to the client at
+   ADDR. */
+struct connection *connection_create(int socket,
+                                     const struct sockaddr_in *addr);
+void connection_destroy(struct connection *connection);
+
+void connection_set_hello(struct connection *connection);
+
+/* Connections created and not destroyed yet, and those of them still
+   waiting for a hello, across all threads. */
+size_t connection_count(void);
+size_t connection_pending_count(void);
+
+#endif
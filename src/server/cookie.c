@@ -0,0 +1,113 @@
+#include "server/cookie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "macros.h"
+
+#define U64(HIGH, LOW) ((uint64_t)(HIGH) << 32 | (uint64_t)(LOW))
+
+#define ROTATE(X, BITS) ((X) << (BITS) | (X) >> (64 - (BITS)))
+
+static void sip_round(uint64_t *v) {
+    v[0] += v[1];
+    v[1] = ROTATE(v[1], 13);
+    v[1] ^= v[0];
+    v[0] = ROTATE(v[0], 32);
+    v[2] += v[3];
+    v[3] = ROTATE(v[3], 16);
+    v[3] ^= v[2];
+    v[0] += v[3];
+    v[3] = ROTATE(v[3], 21);
+    v[3] ^= v[0];
+    v[2] += v[1];
+    v[1] = ROTATE(v[1], 17);
+    v[1] ^= v[2];
+    v[2] = ROTATE(v[2], 32);
+}
+
+/* SipHash-2-4 of the COUNT words at WORDS, as their little-endian
+   bytes. */
+static uint64_t sip_hash(const struct cookie_key *key,
+                         const uint64_t *words, size_t count) {
+    uint64_t v[4];
+    uint64_t last;
+    size_t i;
+
+    v[0] = key->k0 ^ U64(0x736F6D65UL, 0x70736575UL);
+    v[1] = key->k1 ^ U64(0x646F7261UL, 0x6E646F6DUL);
+    v[2] = key->k0 ^ U64(0x6C796765UL, 0x6E657261UL);
+    v[3] = key->k1 ^ U64(0x74656462UL, 0x79746573UL);
+
+    for (i = 0; i < count; i++) {
+        v[3] ^= words[i];
+        sip_round(v);
+        sip_round(v);
+        v[0] ^= words[i];
+    }
+
+    /* The length in bytes, in the top byte of a last empty word. */
+    last = (uint64_t)(count * 8 & 0xFF) << 56;
+
+    v[3] ^= last;
+    sip_round(v);
+    sip_round(v);
+    v[0] ^= last;
+
+    v[2] ^= 0xFF;
+    for (i = 0; i < 4; i++) {
+        sip_round(v);
+    }
+
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+void cookie_key_init(struct cookie_key *key) {
+    unsigned char bytes[16];
+    FILE *file;
+    size_t read;
+    int i;
+
+    assert(key);
+
+    file = fopen("/dev/urandom", "rb");
+    if (!file) {
+        printf("Failed to open /dev/urandom.\r\n");
+        exit(EXIT_FAILURE);
+    }
+
+    read = fread(bytes, 1, sizeof(bytes), file);
+    fclose(file);
+
+    if (read != sizeof(bytes)) {
+        printf("Failed to read /dev/urandom.\r\n");
+        exit(EXIT_FAILURE);
+    }
+
+    key->k0 = 0;
+    key->k1 = 0;
+
+    for (i = 0; i < 8; i++) {
+        key->k0 |= (uint64_t)bytes[i] << (8 * i);
+        key->k1 |= (uint64_t)bytes[8 + i] << (8 * i);
+    }
+}
+
+uint64_t cookie_make(const struct cookie_key *key,
+                     const struct sockaddr_in *addr, unsigned long window) {
+    uint64_t words[2];
+    uint64_t cookie;
+
+    assert(key);
+    assert(addr);
+
+    words[0] = (uint64_t)addr->sin_addr.s_addr |
+               (uint64_t)addr->sin_port << 32;
+    words[1] = (uint64_t)window;
+
+    cookie = sip_hash(key, words, 2);
+
+    /* 0 stands for no cookie in connects. */
+    return cookie ? cookie : 1;
+}
@@ -0,0 +1,23 @@
+#ifndef COOKIE_H
+#define COOKIE_H
+
+#include <stdint.h>
+
+#include <arpa/inet.h>
+
+/* Secret of the connect cookies, random for each run of the server. */
+struct cookie_key {
+    uint64_t k0;
+    uint64_t k1;
+};
+
+/* Reads a random key from the system, exits if there is none. */
+void cookie_key_init(struct cookie_key *key);
+
+/* Cookie of the client at ADDR during time window WINDOW, a SipHash-2-4 of
+   both under KEY, so the server checks an echoed cookie without keeping
+   any state for the connect it answered. Never 0. */
+uint64_t cookie_make(const struct cookie_key *key,
+                     const struct sockaddr_in *addr, unsigned long window);
+
+#endif
@@ -0,0 +1,167 @@
+#include "server/interest.h"
+
+#include <math.h>
+
+#include "macros.h"
+
+size_t interest_hash_cell(const struct interest_cell *cell) {
+    size_t h;
+
+    assert(cell);
+
+    h = ((size_t)(unsigned int)cell->x * 73856093UL) ^
+        ((size_t)(unsigned int)cell->z * 83492791UL);
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bUL;
+    h ^= h >> 13;
+
+    return h;
+}
+
+#define CELL_EQ(A, B) ((A)->x == (B)->x && (A)->z == (B)->z)
+
+void interest_init(struct interest_grid *grid) {
+    assert(grid);
+
+    grid->map.size     = 0;
+    grid->map.capacity = 0;
+    grid->buckets      = NULL;
+}
+
+void interest_free(struct interest_grid *grid) {
+    assert(grid);
+
+    free(grid->buckets);
+    interest_init(grid);
+}
+
+struct interest_cell interest_cell_of(const struct vector3 *position) {
+    struct interest_cell cell;
+
+    assert(position);
+
+    cell.x = (int)floor((double)position->VEC_X / INTEREST_CELL_SIZE);
+    cell.z = (int)floor((double)position->VEC_Z / INTEREST_CELL_SIZE);
+
+    return cell;
+}
+
+int interest_is_visible(const struct interest_cell *a,
+                        const struct interest_cell *b) {
+    assert(a);
+    assert(b);
+
+    return abs(a->x - b->x) <= INTEREST_RADIUS &&
+           abs(a->z - b->z) <= INTEREST_RADIUS;
+}
+
+void interest_place(struct interest_grid *grid, struct interest_member *member,
+                    const struct interest_cell *cell) {
+    struct interest_cell key;
+    struct interest_member *head;
+
+    assert(grid);
+    assert(member);
+    assert(cell);
+
+    if (member->is_placed) {
+        if (CELL_EQ(&member->cell, cell)) {
+            return;
+        }
+
+        interest_remove(grid, member);
+    }
+
+    key  = *cell;
+    head = interest_get(grid, cell);
+
+    member->cell      = *cell;
+    member->is_placed = TRUE;
+    member->prev      = NULL;
+    member->next      = head;
+
+    if (head) {
+        head->prev = member;
+    }
+
+    MAP_INSERT(grid->buckets, grid->map, key, member, CELL_EQ,
+               interest_hash_cell);
+}
+
+void interest_remove(struct interest_grid *grid,
+                     struct interest_member *member) {
+    assert(grid);
+    assert(member);
+
+    if (!member->is_placed) {
+        return;
+    }
+
+    if (member->next) {
+        member->next->prev = member->prev;
+    }
+
+    if (member->prev) {
+        member->prev->next = member->next;
+    } else {
+        struct interest_cell key = member->cell;
+
+        /* Member was the head. Empty cells are dropped from the map. */
+        if (member->next) {
+            MAP_INSERT(grid->buckets, grid->map, key, member->next, CELL_EQ,
+                       interest_hash_cell);
+        } else {
+            int removed;
+
+            MAP_REMOVE(grid->buckets, grid->map, key, CELL_EQ,
+                       interest_hash_cell, removed);
+            assert(removed);
+            (void)removed;
+        }
+    }
+
+    member->is_placed = FALSE;
+    member->prev      = NULL;
+    member->next      = NULL;
+}
+
+struct interest_member *interest_get(const struct interest_grid *grid,
+                                     const struct interest_cell *cell) {
+    struct interest_cell key;
+    struct interest_member *head = NULL;
+    int found;
+
+    assert(grid);
+    assert(cell);
+
+    key = *cell;
+    MAP_GET(grid->buckets, grid->map, key, CELL_EQ, interest_hash_cell,
+            head, found);
+    (void)found;
+
+    return head;
+}
+
+void interest_query(const struct interest_grid *grid,
+                    const struct interest_cell *cell, struct array *members,
+                    struct interest_member ***member_elems) {
+    struct interest_cell key;
+
+    assert(grid);
+    assert(cell);
+    assert(members);
+    assert(member_elems);
+
+    for (key.z = cell->z - INTEREST_RADIUS;
+         key.z <= cell->z + INTEREST_RADIUS; key.z++) {
+        for (key.x = cell->x - INTEREST_RADIUS;
+             key.x <= cell->x + INTEREST_RADIUS; key.x++) {
+            struct interest_member *member = interest_get(grid, &key);
+
+            for (; member; member = member->next) {
+                ARRAY_APPEND(*members, *member_elems, member);
+            }
+        }
+    }
+}
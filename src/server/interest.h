@@ -0,0 +1,73 @@
+#ifndef INTEREST_H
+#define INTEREST_H
+
+#include <stddef.h>
+
+#include "array.h"
+#include "map.h"
+#include "vector.h"
+
+/* Cells are columns this many blocks wide along x and z, 4 chunks. */
+#define INTEREST_CELL_SIZE 64
+
+/* Players see each other within this many cells along x and z. */
+#define INTEREST_RADIUS 2
+
+struct interest_cell {
+    int x;
+    int z;
+};
+
+/* A player in the grid, embedded in its owner and linked into the list of
+   its cell. */
+struct interest_member {
+    void *owner;
+    int is_ghost; /* Owned by a ghost rather than a connection. */
+
+    struct interest_cell cell;
+    int is_placed;
+
+    struct interest_member *prev;
+    struct interest_member *next;
+};
+
+struct interest_bucket {
+    struct interest_cell key;
+    struct interest_member *value; /* List head. */
+    size_t psl;
+};
+
+/* Spatial hash of players by cell. Only occupied cells have buckets. */
+struct interest_grid {
+    struct map map;
+    struct interest_bucket *buckets;
+};
+
+void interest_init(struct interest_grid *grid);
+void interest_free(struct interest_grid *grid);
+
+size_t interest_hash_cell(const struct interest_cell *cell);
+
+struct interest_cell interest_cell_of(const struct vector3 *position);
+
+/* TRUE if players in cells A and B see each other. */
+int interest_is_visible(const struct interest_cell *a,
+                        const struct interest_cell *b);
+
+/* Places MEMBER, or moves it if placed already, into CELL. */
+void interest_place(struct interest_grid *grid, struct interest_member *member,
+                    const struct interest_cell *cell);
+
+void interest_remove(struct interest_grid *grid,
+                     struct interest_member *member);
+
+/* First member in CELL, linked through next, or NULL if it is empty. */
+struct interest_member *interest_get(const struct interest_grid *grid,
+                                     const struct interest_cell *cell);
+
+/* Appends the members that see CELL to MEMBERS. */
+void interest_query(const struct interest_grid *grid,
+                    const struct interest_cell *cell, struct array *members,
+                    struct interest_member ***member_elems);
+
+#endif
@@ -1,44 +1,47 @@
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <arpa/inet.h>
-#include <sys/poll.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <errno.h>
 
 #include "macros.h"
-#include "array.h"
-#include "vector.h"
+#include "protocol.h"
+#include "server/connection.h"
+#include "server/cookie.h"
+#include "server/shard.h"
+#include "transport.h"
 
 #define PORT 2000
 
-#pragma pack(push, 1)
-typedef struct client_update_pkt_s {
-    int sender_socket;
-    struct vector3 position;
-    struct vector3 velocity;
-    float head_yaw;
-    float head_pitch;
-} client_update_pkt_t;
-#pragma pack(pop)
+/* Datagrams read per recvmmsg. */
+#define RECEIVE_BATCH 16
 
-typedef struct client_s {
-    int socket;
+/* Clients accepted lately, whose connects still in flight are not new
+   clients. After the window their connected socket gets them. */
+#define RECENT_MAX  64
+#define RECENT_TIME 2.0
 
-    unsigned char *in;
-    size_t in_count;
-    size_t in_cap;
+/* Cookies are made for time windows this many seconds long, and accepted
+   during their window and the next. */
+#define COOKIE_WINDOW 10.0
 
-    unsigned char *out;
-    size_t out_count;
-    size_t out_cap;
+/* Connections at most, and at most waiting for their hello. Connects past
+   either are refused. */
+#define CONNECTIONS_LIMIT 1024
+#define PENDING_LIMIT     64
 
-    char ip[INET_ADDRSTRLEN];
-} client_t;
+struct recent {
+    struct sockaddr_in addr;
+    double time;
+};
 
 static int set_nonblocking(int socket) {
     int flags = fcntl(socket, F_GETFL, 0);
@@ -56,42 +59,124 @@ static int set_nonblocking(int socket) {
     return TRUE;
 }
 
-int main(int argc, char **argv) {
-    int listener;
+static double get_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/* Sends a datagram of TYPE other than DATAGRAM_DATA to ADDR. */
+static void send_control(int socket, const struct sockaddr_in *addr,
+                         int type, uint64_t cookie) {
+    unsigned char datagram[TRANSPORT_CONNECT_SIZE];
+    size_t size = transport_write_control(datagram, type, cookie);
+
+    sendto(socket, datagram, size, MSG_DONTWAIT,
+           (const struct sockaddr *)addr, sizeof(*addr));
+}
+
+/* TRUE if the connect at SRC echoes a cookie made for ADDR in WINDOW or
+   the one before. */
+static int has_cookie(const struct cookie_key *key,
+                      const struct sockaddr_in *addr,
+                      const unsigned char *src, unsigned long window) {
+    uint64_t cookie = transport_cookie(src);
+
+    return cookie != 0 && (cookie == cookie_make(key, addr, window) ||
+                           cookie == cookie_make(key, addr, window - 1));
+}
+
+static int is_same_addr(const struct sockaddr_in *a,
+                        const struct sockaddr_in *b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr &&
+           a->sin_port == b->sin_port;
+}
+
+/* Returns a socket bound to PORT and connected to the client at ADDR, so
+   the kernel routes its datagrams there rather than to the listener, or
+   -1. */
+static int open_client_socket(const struct sockaddr_in *addr) {
+    struct sockaddr_in local;
+    int yes = 1;
+    int client;
 
-    client_t *clients   = NULL;
-    size_t client_count = 0;
-    size_t client_cap   = 0;
+    client = socket(AF_INET, SOCK_DGRAM, 0);
 
+    if (client == -1) {
+        return -1;
+    }
+
+    setsockopt(client, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    setsockopt(client, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family      = AF_INET;
+    local.sin_port        = htons(PORT);
+    local.sin_addr.s_addr = INADDR_ANY;
+
+    if (!set_nonblocking(client) ||
+        bind(client, (struct sockaddr *)&local, sizeof(local)) == -1 ||
+        connect(client, (const struct sockaddr *)addr, sizeof(*addr)) ==
+            -1) {
+        close(client);
+        return -1;
+    }
+
+    return client;
+}
+
+int main(int argc, char **argv) {
+    struct shard *shards;
+    unsigned int shard_count = 0;
+    unsigned int next_shard  = 0;
+    unsigned int next_id     = 1;
+
+    int listener;
     int yes = 1;
     struct sockaddr_in addr;
 
-    struct pollfd *polled_sockets = NULL;
-    size_t polled_sockets_count   = 0;
-    size_t polled_sockets_cap     = 0;
+    unsigned char buffers[RECEIVE_BATCH][TRANSPORT_CONNECT_SIZE];
+    struct sockaddr_in addrs[RECEIVE_BATCH];
+    struct iovec parts[RECEIVE_BATCH];
+    struct mmsghdr messages[RECEIVE_BATCH];
 
-    struct pollfd fd;
+    struct recent recent[RECENT_MAX];
+    unsigned int next_recent = 0;
 
-    size_t i;
+    struct cookie_key key;
 
-    (void)argc;
-    (void)argv;
+    unsigned int i;
+    int argi;
 
-    listener = socket(AF_INET, SOCK_STREAM, 0);
+    for (argi = 1; argi < argc; argi++) {
+        if (strcmp(argv[argi], "--shards") == 0 && argi + 1 < argc) {
+            shard_count = (unsigned int)atoi(argv[++argi]);
+        }
+    }
 
-    if (!listener) {
-        printf("Failed to create listener socket.\r\n");
-        exit(EXIT_FAILURE);
+    /* A shard per core by default. */
+    if (shard_count == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+        shard_count = cores > 0 ? (unsigned int)cores : 1;
     }
+    shard_count = MIN(shard_count, SHARDS_MAX);
 
-    if (!set_nonblocking(listener)) {
-        printf("Failed to set listener socket to non-blocking.\r\n");
+    listener = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (listener == -1) {
+        printf("Failed to create listener socket.\r\n");
         exit(EXIT_FAILURE);
     }
 
-    /* Allow socket to be reusable. Avoids address-in-use error. */
+    /* Allow socket to be reusable. Avoids address-in-use error. Client
+       sockets share the port. */
     setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
 
+    memset(&addr, 0, sizeof(addr));
     addr.sin_family      = AF_INET;
     addr.sin_port        = htons(PORT);
     addr.sin_addr.s_addr = INADDR_ANY;
@@ -101,155 +186,146 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    if (listen(listener, 999) == -1) {
-        printf("Failed to listen.\r\n");
+    shards = calloc(shard_count, sizeof(struct shard));
+    if (!shards) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
         exit(EXIT_FAILURE);
     }
 
-    printf("Listening on port %d...\r\n", PORT);
-
-    while (TRUE) {
-        fd.fd     = listener;
-        fd.events = POLLIN;
+    /* All shards exist before any thread posts to another. */
+    for (i = 0; i < shard_count; i++) {
+        shard_init(&shards[i], i, shards, shard_count, listener);
+    }
 
-        ARR_APPEND(polled_sockets, polled_sockets_count, polled_sockets_cap,
-                   &fd);
+    for (i = 0; i < shard_count; i++) {
+        shard_start(&shards[i]);
+    }
 
-        for (i = 0; i < client_count; i++) {
-            fd.fd = clients[i].socket;
+    printf("Listening on port %d with %u shards...\r\n", PORT, shard_count);
 
-            ARR_APPEND(polled_sockets, polled_sockets_count,
-                       polled_sockets_cap, &fd);
-        }
+    memset(recent, 0, sizeof(recent));
+    cookie_key_init(&key);
 
-        /* While there are no connected clients, wait indefinitely (-1). */
-        switch (poll(polled_sockets, (nfds_t)polled_sockets_count,
-                     client_count == 0 ? -1 : 0)) {
-            case -1:
-                printf("Poll error.\r\n");
-                exit(EXIT_FAILURE);
+    for (i = 0; i < RECEIVE_BATCH; i++) {
+        parts[i].iov_base = buffers[i];
+        parts[i].iov_len  = TRANSPORT_CONNECT_SIZE;
+    }
 
-            /* Timeout. No events. */
-            case 0:
-                goto no_events;
+    /* This thread only accepts, connects that echo their challenge. New
+       players go to any shard, which hands them to the owner of their
+       region with their first update. */
+    while (TRUE) {
+        double now;
+        unsigned long window;
+        int count;
+        int j;
+
+        memset(messages, 0, sizeof(messages));
+
+        for (i = 0; i < RECEIVE_BATCH; i++) {
+            messages[i].msg_hdr.msg_name    = &addrs[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            messages[i].msg_hdr.msg_iov     = &parts[i];
+            messages[i].msg_hdr.msg_iovlen  = 1;
         }
 
-        /* Check listener socket for incoming connection. */
-        if (polled_sockets[0].revents & POLLIN) {
-            struct sockaddr_storage addr_storage;
-            socklen_t len = sizeof addr_storage;
-            int socket;
-            client_t client;
-
-            /* Accept connection. */
-
-            socket = accept(listener, (struct sockaddr *)&addr_storage, &len);
+        count = recvmmsg(listener, messages, RECEIVE_BATCH, MSG_WAITFORONE,
+                         NULL);
 
-            if (socket == -1) {
-                goto skip_new_connection;
+        if (count == -1) {
+            if (errno == EINTR || errno == ECONNREFUSED) {
+                continue;
             }
 
-            if (!set_nonblocking(socket)) {
-                printf("Failed to set client socket to non-blocking. "
-                       "Disconnecting client.");
-                close(socket);
-                goto skip_new_connection;
-            }
-
-            /* Add client to array. */
-
-            client.socket = socket;
-
-            if (!inet_ntop(addr_storage.ss_family,
-                           &(((struct sockaddr_in *)&addr_storage)->sin_addr),
-                           client.ip, INET_ADDRSTRLEN)) {
-                close(socket);
-                printf("inet_ntop() failed.\r\n");
-                goto skip_new_connection;
-            }
-
-            client.in        = NULL;
-            client.in_count  = 0;
-            client.in_cap    = 0;
-            client.out       = NULL;
-            client.out_count = 0;
-            client.out_cap   = 0;
-
-            ARR_APPEND(clients, client_count, client_cap, &client);
-
-            printf("Client connected (%s).\r\n", client.ip);
+            printf("Failed to receive.\r\n");
+            exit(EXIT_FAILURE);
         }
 
-    skip_new_connection:
-
-        for (i = 1; i < polled_sockets_count; i++) {
-            if (polled_sockets[i].revents & POLLIN) {
-                char buf[1024];
-                int len;
-                client_t *client = NULL;
-                size_t j;
+        now    = get_time();
+        window = (unsigned long)(now / COOKIE_WINDOW);
+
+        for (j = 0; j < count; j++) {
+            const struct sockaddr_in *client_addr = &addrs[j];
+            struct shard_message message;
+            struct connection *connection;
+            int client;
+            int is_recent = FALSE;
+
+            /* Anything else that reaches the listener is a stray. */
+            if (addrs[j].sin_family != AF_INET ||
+                transport_type(buffers[j], messages[j].msg_len) !=
+                    DATAGRAM_CONNECT) {
+                continue;
+            }
 
-                len = (int)recv(polled_sockets[i].fd, buf, sizeof buf, 0);
+            /* Only a client receiving at its address can echo the cookie,
+               so nothing is kept for a connect before it does. */
+            if (!has_cookie(&key, client_addr, buffers[j], window)) {
+                send_control(listener, client_addr, DATAGRAM_CHALLENGE,
+                             cookie_make(&key, client_addr, window));
+                continue;
+            }
 
-                /* No data to read. */
-                if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                    continue;
+            for (i = 0; i < RECENT_MAX; i++) {
+                if (now - recent[i].time < RECENT_TIME &&
+                    is_same_addr(&recent[i].addr, client_addr)) {
+                    is_recent = TRUE;
+                    break;
                 }
+            }
 
-                /* Find client. */
-
-                for (j = 0; j < client_count; j++) {
-                    if (clients[j].socket == polled_sockets[i].fd) {
-                        client = &clients[j];
-                    }
-                }
+            if (is_recent) {
+                continue;
+            }
 
-                assert(client);
+            if (connection_count() >= CONNECTIONS_LIMIT ||
+                connection_pending_count() >= PENDING_LIMIT) {
+                send_control(listener, client_addr, DATAGRAM_CLOSE, 0);
+                continue;
+            }
 
-                ARR_APPEND_N(client->in, client->in_count, client->in_cap,
-                             (size_t)len, buf);
+            client = open_client_socket(client_addr);
 
-                /* Handle packets. */
-                while (client->in_count >= sizeof(client_update_pkt_t)) {
-                    client_update_pkt_t pkt;
-                    size_t k;
+            if (client == -1) {
+                printf("Failed to open client socket.\r\n");
+                continue;
+            }
 
-                    memcpy(&pkt, client->in, sizeof(client_update_pkt_t));
+            connection = connection_create(client, client_addr);
 
-                    pkt.sender_socket = client->socket;
+            if (!inet_ntop(AF_INET, &client_addr->sin_addr, connection->ip,
+                           INET_ADDRSTRLEN)) {
+                close(client);
+                connection_destroy(connection);
+                printf("inet_ntop() failed.\r\n");
+                continue;
+            }
 
-                    for (k = 0; k < client_count; k++) {
-                        if (clients[k].socket != client->socket) {
-                            ARR_APPEND_N(clients[k].out, clients[k].out_count,
-                                         clients[k].out_cap,
-                                         sizeof(client_update_pkt_t), &pkt);
-                        }
-                    }
+            connection->id           = next_id++;
+            connection->member.owner = connection;
 
-                    ARR_REMOVE_N(client->in, client->in_count, 0,
-                                 sizeof(client_update_pkt_t));
-                }
+            /* Ids stay unique after ports are reused, 0 is never one. */
+            if (next_id == 0) {
+                next_id = 1;
             }
-        }
 
-    no_events:
+            recent[next_recent].addr = *client_addr;
+            recent[next_recent].time = now;
+            next_recent              = (next_recent + 1) % RECENT_MAX;
 
-        polled_sockets_count = 0;
+            printf("Client connected (%s).\r\n", connection->ip);
 
-        /* Send outgoing data to clients. */
-        for (i = 0; i < client_count; i++) {
-            if (clients[i].out_count > 0) {
-                ssize_t num_bytes_sent =
-                    send(clients[i].socket, clients[i].out,
-                         clients[i].out_count, 0);
+            send_control(listener, client_addr, DATAGRAM_ACCEPT, 0);
 
-                if (num_bytes_sent != -1) {
-                    ARR_REMOVE_N(clients[i].out, clients[i].out_count, 0,
-                                 (size_t)num_bytes_sent);
-                }
-            }
+            memset(&message, 0, sizeof(message));
+            message.type       = SHARD_ADOPT;
+            message.connection = connection;
+            message.id         = connection->id;
+
+            shard_post(&shards[next_shard], &message);
+            next_shard = (next_shard + 1) % shard_count;
         }
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,103 @@
+#include "server/send_queue.h"
+
+#include "atomic.h"
+#include "macros.h"
+
+struct buffer *buffer_create(size_t size) {
+    struct buffer *buffer;
+
+    buffer = malloc(sizeof(struct buffer) + size);
+    if (!buffer) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    buffer->refs = 1;
+    buffer->size = size;
+    buffer->data = (unsigned char *)(buffer + 1);
+
+    return buffer;
+}
+
+void buffer_acquire(struct buffer *buffer) {
+    assert(buffer);
+
+    ATOMIC_FETCH_ADD(&buffer->refs, 1);
+}
+
+void buffer_release(struct buffer *buffer) {
+    assert(buffer);
+
+    if (ATOMIC_FETCH_SUB(&buffer->refs, 1) == 1) {
+        free(buffer);
+    }
+}
+
+void send_queue_init(struct send_queue *queue) {
+    assert(queue);
+
+    queue->slices.size     = 0;
+    queue->slices.capacity = 0;
+    queue->slice_elems     = NULL;
+}
+
+void send_queue_free(struct send_queue *queue) {
+    assert(queue);
+
+    send_queue_clear(queue);
+
+    free(queue->slice_elems);
+    send_queue_init(queue);
+}
+
+void send_queue_push(struct send_queue *queue, struct buffer *buffer,
+                     size_t offset, size_t size) {
+    struct buffer_slice slice;
+
+    assert(queue);
+    assert(buffer);
+    assert(offset + size <= buffer->size);
+
+    if (size == 0) {
+        return;
+    }
+
+    buffer_acquire(buffer);
+
+    slice.buffer = buffer;
+    slice.offset = offset;
+    slice.size   = size;
+
+    ARRAY_APPEND(queue->slices, queue->slice_elems, slice);
+}
+
+void send_queue_gather(const struct send_queue *queue, struct array *parts,
+                       struct iovec **part_elems) {
+    size_t i;
+
+    assert(queue);
+    assert(parts);
+    assert(part_elems);
+
+    for (i = 0; i < queue->slices.size; i++) {
+        const struct buffer_slice *slice = &queue->slice_elems[i];
+        struct iovec part;
+
+        part.iov_base = slice->buffer->data + slice->offset;
+        part.iov_len  = slice->size;
+
+        ARRAY_APPEND(*parts, *part_elems, part);
+    }
+}
+
+void send_queue_clear(struct send_queue *queue) {
+    size_t i;
+
+    assert(queue);
+
+    for (i = 0; i < queue->slices.size; i++) {
+        buffer_release(queue->slice_elems[i].buffer);
+    }
+
+    queue->slices.size = 0;
+}
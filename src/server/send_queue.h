@@ -0,0 +1,57 @@
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+#include <stddef.h>
+
+#include <sys/uio.h>
+
+#include "array.h"
+
+/* Immutable bytes queued to any number of connections, freed with the last
+   reference. Connections carry their queues between shards, so references
+   are counted atomically. */
+struct buffer {
+    size_t refs;
+    size_t size;
+    unsigned char *data; /* Follows the struct in the same allocation. */
+};
+
+/* Returns SIZE uninitialized bytes with one reference, to be filled before
+   they are shared. The size may be lowered to what was filled. */
+struct buffer *buffer_create(size_t size);
+void buffer_acquire(struct buffer *buffer);
+void buffer_release(struct buffer *buffer);
+
+/* SIZE bytes from OFFSET in BUFFER. Holds a reference once queued. */
+struct buffer_slice {
+    struct buffer *buffer;
+    size_t offset;
+    size_t size;
+};
+
+/* Slices of the next datagram of a connection, in order. Queuing copies no
+   bytes, the datagram is gathered from the slices when it is sent. */
+struct send_queue {
+    struct array slices;
+    struct buffer_slice *slice_elems;
+};
+
+void send_queue_init(struct send_queue *queue);
+
+/* Releases the slices still queued. */
+void send_queue_free(struct send_queue *queue);
+
+/* Queues SIZE bytes from OFFSET in BUFFER, with a new reference to it.
+   Empty slices are not queued. */
+void send_queue_push(struct send_queue *queue, struct buffer *buffer,
+                     size_t offset, size_t size);
+
+/* Appends an iovec per queued slice to PARTS, for sendmsg. They stay valid
+   until the queue is cleared. */
+void send_queue_gather(const struct send_queue *queue, struct array *parts,
+                       struct iovec **part_elems);
+
+/* Releases the queued slices, once the datagram was sent or dropped. */
+void send_queue_clear(struct send_queue *queue);
+
+#endif
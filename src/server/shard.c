@@ -0,0 +1,1402 @@
+#define _GNU_SOURCE
+
+#include "server/shard.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <errno.h>
+
+#include "macros.h"
+
+/* Events handled per epoll_wait. */
+#define EVENTS_MAX 64
+
+/* Datagrams read per recvmmsg, and sent per sendmmsg. */
+#define RECEIVE_BATCH 16
+#define SEND_BATCH    64
+
+/* Players are updated and snapshots sent at this rate, in Hz. */
+#define TICK_RATE PROTOCOL_TICK_RATE
+
+/* Connections silent for this many ticks are dropped. Clients send a
+   datagram every tick, so this is long only for lossy links. */
+#define TIMEOUT_TICKS (10 * TICK_RATE)
+
+/* Connections whose client has not said hello within this many ticks are
+   dropped. Clients send it right after the accept, and resend it until
+   acked. */
+#define HELLO_TIMEOUT_TICKS (2 * TICK_RATE)
+
+/* Epoll data of the timer and inbox. Never valid connection handles. */
+#define EVENT_TIMER 0
+#define EVENT_INBOX 1
+
+/* Histories and snapshots are kept modulo the transport window. */
+#define WINDOW_MASK (TRANSPORT_WINDOW - 1)
+
+/* Room for the fixed part of a snapshot. */
+#define SNAPSHOT_HEADER_MAX (1 + 1 + 3 * PROTOCOL_VARINT_MAX)
+
+static size_t hash_id(const unsigned int *id) {
+    size_t h = (size_t)*id * 0x9e3779b1UL;
+
+    h ^= h >> 16;
+
+    return h;
+}
+
+#define ID_EQ(A, B) (*(A) == *(B))
+
+static size_t hash_block_key(const struct block_key *key) {
+    size_t h = interest_hash_cell(&key->cell);
+
+    h ^= (size_t)key->tick * 0x85ebca6bUL;
+    h ^= h >> 16;
+
+    return h;
+}
+
+#define BLOCK_KEY_EQ(A, B)                                                    \
+    ((A)->cell.x == (B)->cell.x && (A)->cell.z == (B)->cell.z &&              \
+     (A)->tick == (B)->tick)
+
+static int compare_ids(const void *a, const void *b) {
+    unsigned int x = *(const unsigned int *)a;
+    unsigned int y = *(const unsigned int *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int compare_updates(const void *a, const void *b) {
+    return compare_ids(&((const struct player_update *)a)->id,
+                       &((const struct player_update *)b)->id);
+}
+
+static int floor_div(int value, int divisor) {
+    int quotient = value / divisor;
+
+    if (value % divisor != 0 && (value < 0) != (divisor < 0)) {
+        quotient--;
+    }
+
+    return quotient;
+}
+
+unsigned int shard_owner(const struct interest_cell *cell,
+                         unsigned int shard_count) {
+    unsigned int x;
+    unsigned int z;
+    unsigned int h;
+
+    assert(cell);
+    assert(shard_count > 0);
+
+    x = (unsigned int)floor_div(cell->x, SHARD_REGION_CELLS);
+    z = (unsigned int)floor_div(cell->z, SHARD_REGION_CELLS);
+
+    /* Hashed so that load spreads evenly wherever players gather. */
+    h = (x * 73856093u) ^ (z * 83492791u);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+
+    return h % shard_count;
+}
+
+static void watch(struct shard *shard, int fd, unsigned int events,
+                  unsigned int data) {
+    struct epoll_event event;
+
+    event.events   = events;
+    event.data.u64 = data;
+
+    if (epoll_ctl(shard->epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+        printf("Failed to add socket to epoll.\r\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Sends a datagram of TYPE, other than DATAGRAM_DATA, to the client of
+   CONNECTION. Lost like any other, or dropped if the socket buffer is
+   full, the client retries. */
+static void send_control(const struct shard *shard,
+                         const struct connection *connection, int type) {
+    unsigned char datagram[TRANSPORT_CONNECT_SIZE];
+    size_t size = transport_write_control(datagram, type, 0);
+
+    sendto(shard->socket, datagram, size, MSG_DONTWAIT,
+           (const struct sockaddr *)&connection->addr,
+           sizeof(connection->addr));
+}
+
+static const struct player_state *get_state(
+    const struct interest_member *member) {
+    if (member->is_ghost) {
+        return &((const struct ghost *)member->owner)->state;
+    }
+
+    return &((const struct connection *)member->owner)->state;
+}
+
+static struct player_history *get_history(
+    const struct interest_member *member) {
+    if (member->is_ghost) {
+        return &((struct ghost *)member->owner)->history;
+    }
+
+    return &((struct connection *)member->owner)->history;
+}
+
+static unsigned int get_id(const struct interest_member *member) {
+    if (member->is_ghost) {
+        return ((const struct ghost *)member->owner)->id;
+    }
+
+    return ((const struct connection *)member->owner)->id;
+}
+
+static struct interest_cell get_cell(const struct player_state *state) {
+    struct vector3 position = protocol_position(state);
+
+    return interest_cell_of(&position);
+}
+
+/* Records the state of MEMBER at this tick. */
+static void record_history(const struct shard *shard,
+                           const struct interest_member *member) {
+    struct player_history *history = get_history(member);
+    size_t i                       = shard->tick & WINDOW_MASK;
+
+    history->ticks[i]  = shard->tick;
+    history->states[i] = *get_state(member);
+}
+
+/* State of MEMBER at TICK, NULL if it was not in the grid then, or that
+   was too long ago. */
+static const struct player_state *get_past_state(
+    const struct interest_member *member, unsigned long tick) {
+    const struct player_history *history = get_history(member);
+    size_t i                             = tick & WINDOW_MASK;
+
+    return history->ticks[i] == tick ? &history->states[i] : NULL;
+}
+
+/* Fills the shard's nearby array with the players that see CELL. */
+static void query_nearby(struct shard *shard,
+                         const struct interest_cell *cell) {
+    shard->nearby.size = 0;
+    interest_query(&shard->grid, cell, &shard->nearby, &shard->nearby_elems);
+}
+
+static int is_visible(const struct shard *shard, unsigned int id) {
+    return shard->visible.size > 0 &&
+           bsearch(&id, shard->visible_elems, shard->visible.size,
+                   sizeof(unsigned int), compare_ids) != NULL;
+}
+
+/* State of player ID in SNAPSHOT, NULL if it is not there. */
+static const struct player_state *find_player(
+    const struct snapshot *snapshot, unsigned int id) {
+    size_t low  = 0;
+    size_t high = snapshot->players.size;
+
+    while (low < high) {
+        size_t mid                         = low + (high - low) / 2;
+        const struct player_update *update = &snapshot->player_elems[mid];
+
+        if (update->id == id) {
+            return &update->state;
+        }
+
+        if (update->id < id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return NULL;
+}
+
+static void add_player(struct snapshot *snapshot, unsigned int id,
+                       const struct player_state *state) {
+    struct player_update update;
+
+    update.id    = id;
+    update.state = *state;
+
+    ARRAY_APPEND(snapshot->players, snapshot->player_elems, update);
+}
+
+/* Newest snapshot the client of CONNECTION acked, NULL if none. */
+static const struct snapshot *get_base(const struct connection *connection) {
+    const struct snapshot *base = NULL;
+    size_t i;
+
+    for (i = 0; i < TRANSPORT_WINDOW; i++) {
+        const struct snapshot *snapshot = &connection->snapshots[i];
+
+        if (snapshot->is_used &&
+            transport_is_acked(&connection->transport, snapshot->sequence) &&
+            (!base ||
+             transport_is_newer(snapshot->sequence, base->sequence))) {
+            base = snapshot;
+        }
+    }
+
+    return base;
+}
+
+/* TRUE if each player in the cell of HEAD has a state at the tick of the
+   snapshot BASE, which is the one in BASE for all but the client's own, so
+   the block of the cell against that tick applies to it. */
+static int can_share(const struct connection *connection,
+                     const struct snapshot *base,
+                     const struct interest_member *head) {
+    for (; head; head = head->next) {
+        const struct player_state *past;
+        const struct player_state *known;
+
+        past = get_past_state(head, base->tick);
+        if (!past) {
+            return FALSE;
+        }
+
+        /* Cut out of the block for its own client. */
+        if (head == &connection->member) {
+            continue;
+        }
+
+        known = find_player(base, get_id(head));
+        if (!known || memcmp(known, past, sizeof(*past)) != 0) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Returns the block of CELL, whose first member is HEAD, against the
+   states at TICK, encoded for the first snapshot that needs it. */
+static struct block get_block(struct shard *shard,
+                              const struct interest_cell *cell,
+                              const struct interest_member *head,
+                              unsigned long tick) {
+    unsigned char entry[PROTOCOL_VARINT_MAX + PROTOCOL_STATE_MAX];
+    struct block_key key;
+    struct block block;
+    int found;
+
+    key.cell = *cell;
+    key.tick = tick;
+
+    MAP_GET(shard->block_buckets, shard->blocks, key, BLOCK_KEY_EQ,
+            hash_block_key, block, found);
+
+    if (found) {
+        return block;
+    }
+
+    block.entry_idx        = shard->block_entries.size;
+    block.count            = 0;
+    shard->block_data.size = 0;
+
+    for (; head; head = head->next) {
+        const struct player_state *past = get_past_state(head, tick);
+        struct block_entry block_entry;
+        size_t size;
+        size_t delta;
+
+        assert(past);
+
+        size  = protocol_write_varint(entry, get_id(head));
+        delta = protocol_write_state(entry + size, get_state(head), past);
+
+        if (delta == 1) {
+            continue;
+        }
+
+        block_entry.id     = get_id(head);
+        block_entry.offset = shard->block_data.size;
+        block_entry.size   = size + delta;
+
+        ARRAY_APPEND_N(shard->block_data, shard->block_data_elems,
+                       size + delta, entry);
+        ARRAY_APPEND(shard->block_entries, shard->block_entry_elems,
+                     block_entry);
+        block.count++;
+    }
+
+    block.buffer = buffer_create(shard->block_data.size);
+    if (shard->block_data.size > 0) {
+        memcpy(block.buffer->data, shard->block_data_elems,
+               shard->block_data.size);
+    }
+
+    MAP_INSERT(shard->block_buckets, shard->blocks, key, block, BLOCK_KEY_EQ,
+               hash_block_key);
+
+    return block;
+}
+
+/* Adds SIZE bytes from OFFSET in BUFFER to the slices of the snapshot
+   being written. The block map holds BUFFER until they are queued. */
+static void add_slice(struct shard *shard, struct buffer *buffer,
+                      size_t offset, size_t size) {
+    struct buffer_slice slice;
+
+    if (size == 0) {
+        return;
+    }
+
+    slice.buffer = buffer;
+    slice.offset = offset;
+    slice.size   = size;
+
+    ARRAY_APPEND(shard->slices, shard->slice_elems, slice);
+}
+
+/* Adds the block of CELL, whose first member is HEAD, to the datagram of
+   CONNECTION if it fits in BUDGET bytes, cutting out the client's own
+   update. Returns the updates added, or -1 if it does not fit. */
+static long share_block(struct shard *shard,
+                        const struct connection *connection,
+                        const struct snapshot *base,
+                        const struct interest_cell *cell,
+                        const struct interest_member *head,
+                        size_t *budget) {
+    struct block block = get_block(shard, cell, head, base->tick);
+    struct block_entry own;
+    uint32_t count = block.count;
+    size_t size    = block.buffer->size;
+    size_t i;
+
+    own.offset = size;
+    own.size   = 0;
+
+    for (i = 0; i < block.count; i++) {
+        const struct block_entry *block_entry =
+            &shard->block_entry_elems[block.entry_idx + i];
+
+        if (block_entry->id == connection->id) {
+            own = *block_entry;
+            count--;
+            break;
+        }
+    }
+
+    if (size - own.size > *budget) {
+        return -1;
+    }
+
+    add_slice(shard, block.buffer, 0, own.offset);
+    add_slice(shard, block.buffer, own.offset + own.size,
+              size - own.offset - own.size);
+
+    *budget -= size - own.size;
+
+    return (long)count;
+}
+
+/* Adds the players in CELL but the client's own to SNAPSHOT, the next of
+   CONNECTION, as far as BUDGET bytes allow. Cells whose block applies are
+   added by reference, the rest is encoded for this client alone into the
+   shard's packet. Players left out keep their state in BASE, to be sent
+   with a later snapshot. Returns the updates added. */
+static uint32_t add_cell(struct shard *shard,
+                         const struct connection *connection,
+                         const struct snapshot *base,
+                         struct snapshot *snapshot,
+                         const struct interest_cell *cell, size_t *budget) {
+    unsigned char entry[PROTOCOL_VARINT_MAX + PROTOCOL_STATE_MAX];
+    const struct interest_member *head;
+    const struct interest_member *other;
+    uint32_t count = 0;
+
+    head = interest_get(&shard->grid, cell);
+
+    /* Nobody else there. */
+    if (!head || (head == &connection->member && !head->next)) {
+        return 0;
+    }
+
+    if (base && can_share(connection, base, head)) {
+        long shared = share_block(shard, connection, base, cell, head,
+                                  budget);
+
+        if (shared >= 0) {
+            for (other = head; other; other = other->next) {
+                if (other != &connection->member) {
+                    add_player(snapshot, get_id(other), get_state(other));
+                }
+            }
+
+            return (uint32_t)shared;
+        }
+    }
+
+    for (other = head; other; other = other->next) {
+        const struct player_state *state = get_state(other);
+        const struct player_state *known = NULL;
+        struct player_state zero;
+        unsigned int id;
+        size_t size;
+        size_t delta;
+
+        if (other == &connection->member) {
+            continue;
+        }
+
+        id = get_id(other);
+
+        if (base) {
+            known = find_player(base, id);
+        }
+
+        memset(&zero, 0, sizeof(zero));
+
+        size  = protocol_write_varint(entry, id);
+        delta = protocol_write_state(entry + size, state,
+                                     known ? known : &zero);
+
+        /* Unchanged since the base. */
+        if (known && delta == 1) {
+            add_player(snapshot, id, state);
+            continue;
+        }
+
+        if (size + delta > *budget) {
+            if (known) {
+                add_player(snapshot, id, known);
+            }
+            continue;
+        }
+
+        ARRAY_APPEND_N(shard->packet, shard->packet_elems, size + delta,
+                       entry);
+        add_player(snapshot, id, state);
+
+        *budget -= size + delta;
+        count++;
+    }
+
+    return count;
+}
+
+/* Writes the snapshot of the players in range of CONNECTION to DATAGRAM,
+   after the transport header, and adds the slices of the blocks it shares
+   to the shard's slices. Nearer cells go first, so those beyond the
+   datagram's room are the ones to wait. */
+static void write_snapshot(struct shard *shard,
+                           struct connection *connection,
+                           struct buffer *datagram, uint16_t sequence) {
+    const struct interest_member *member = &connection->member;
+    unsigned char entry[PROTOCOL_VARINT_MAX];
+    const struct snapshot *base;
+    struct snapshot *snapshot;
+    unsigned char *header;
+    uint32_t leave_count  = 0;
+    uint32_t update_count = 0;
+    size_t budget;
+    size_t size;
+    size_t i;
+
+    /* The slot of this sequence held a snapshot too old to be the base. */
+    base     = get_base(connection);
+    snapshot = &connection->snapshots[sequence & WINDOW_MASK];
+
+    snapshot->is_used      = TRUE;
+    snapshot->sequence     = sequence;
+    snapshot->tick         = shard->tick;
+    snapshot->players.size = 0;
+
+    budget = TRANSPORT_MTU - datagram->size - SNAPSHOT_HEADER_MAX;
+
+    shard->packet.size  = 0;
+    shard->visible.size = 0;
+
+    if (member->is_placed) {
+        query_nearby(shard, &member->cell);
+
+        for (i = 0; i < shard->nearby.size; i++) {
+            if (shard->nearby_elems[i] != member) {
+                unsigned int id = get_id(shard->nearby_elems[i]);
+
+                ARRAY_APPEND(shard->visible, shard->visible_elems, id);
+            }
+        }
+
+        if (shard->visible.size > 0) {
+            qsort(shard->visible_elems, shard->visible.size,
+                  sizeof(unsigned int), compare_ids);
+        }
+    }
+
+    /* Players that do not fit leave with a later snapshot. */
+    for (i = 0; base && i < base->players.size; i++) {
+        const struct player_update *known = &base->player_elems[i];
+
+        if (is_visible(shard, known->id)) {
+            continue;
+        }
+
+        size = protocol_write_varint(entry, known->id);
+
+        if (size > budget) {
+            add_player(snapshot, known->id, &known->state);
+            continue;
+        }
+
+        ARRAY_APPEND_N(shard->packet, shard->packet_elems, size, entry);
+
+        budget -= size;
+        leave_count++;
+    }
+
+    if (member->is_placed) {
+        int ring;
+
+        for (ring = 0; ring <= INTEREST_RADIUS; ring++) {
+            struct interest_cell cell;
+
+            for (cell.z = member->cell.z - ring;
+                 cell.z <= member->cell.z + ring; cell.z++) {
+                for (cell.x = member->cell.x - ring;
+                     cell.x <= member->cell.x + ring; cell.x++) {
+                    if (abs(cell.x - member->cell.x) != ring &&
+                        abs(cell.z - member->cell.z) != ring) {
+                        continue;
+                    }
+
+                    update_count += add_cell(shard, connection, base,
+                                             snapshot, &cell, &budget);
+                }
+            }
+        }
+    }
+
+    if (snapshot->players.size > 0) {
+        qsort(snapshot->player_elems, snapshot->players.size,
+              sizeof(struct player_update), compare_updates);
+    }
+
+    header    = datagram->data + datagram->size;
+    header[0] = PACKET_SNAPSHOT;
+    header[1] = base ? (unsigned char)(uint16_t)(sequence - base->sequence)
+                     : 0;
+    size      = 2;
+    size += protocol_write_varint(header + size, (uint32_t)shard->time);
+    size += protocol_write_varint(header + size, leave_count);
+    size += protocol_write_varint(header + size, update_count);
+
+    if (shard->packet.size > 0) {
+        memcpy(header + size, shard->packet_elems, shard->packet.size);
+    }
+
+    datagram->size += size + shard->packet.size;
+}
+
+/* Writes the datagram of CONNECTION this tick, and queues it with the
+   others: acks and the snapshot. Its own bytes are a buffer of their own,
+   the blocks it shares are queued by reference. */
+static void write_datagram(struct shard *shard,
+                           struct connection *connection) {
+    struct buffer *datagram;
+    uint16_t sequence;
+    size_t i;
+
+    /* Filled in place, its size is then what was written. */
+    datagram       = buffer_create(TRANSPORT_MTU);
+    datagram->size = transport_write(&connection->transport, datagram->data,
+                                     (double)shard->tick / TICK_RATE,
+                                     &sequence);
+
+    shard->slices.size = 0;
+
+    write_snapshot(shard, connection, datagram, sequence);
+
+    send_queue_push(&connection->out, datagram, 0, datagram->size);
+    buffer_release(datagram);
+
+    for (i = 0; i < shard->slices.size; i++) {
+        const struct buffer_slice *slice = &shard->slice_elems[i];
+
+        send_queue_push(&connection->out, slice->buffer, slice->offset,
+                        slice->size);
+    }
+
+    ARRAY_APPEND(shard->outgoing, shard->outgoing_elems, connection);
+}
+
+/* Sends the datagrams of this tick, each gathered from the queue of its
+   connection, then releases the queues. Datagrams the socket refuses are
+   dropped like those lost on the way. */
+static void send_datagrams(struct shard *shard) {
+    struct mmsghdr messages[SEND_BATCH];
+    size_t first = 0;
+    size_t part  = 0;
+    size_t i;
+
+    /* All parts first, as the array moves when it grows. */
+    shard->parts.size = 0;
+
+    for (i = 0; i < shard->outgoing.size; i++) {
+        send_queue_gather(&shard->outgoing_elems[i]->out, &shard->parts,
+                          &shard->part_elems);
+    }
+
+    while (first < shard->outgoing.size) {
+        unsigned int count =
+            (unsigned int)MIN(shard->outgoing.size - first, SEND_BATCH);
+        size_t next = part;
+        int sent;
+
+        memset(messages, 0, count * sizeof(messages[0]));
+
+        for (i = 0; i < count; i++) {
+            struct connection *connection = shard->outgoing_elems[first + i];
+            struct msghdr *header         = &messages[i].msg_hdr;
+
+            header->msg_name    = &connection->addr;
+            header->msg_namelen = sizeof(connection->addr);
+            header->msg_iov     = shard->part_elems + next;
+            header->msg_iovlen  = connection->out.slices.size;
+
+            next += connection->out.slices.size;
+        }
+
+        /* The socket is shared by all shards and the listener, so none
+           waits on it. */
+        sent = sendmmsg(shard->socket, messages, count, MSG_DONTWAIT);
+
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            /* The rest of the tick would not fit either. */
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            sent = 1;
+        }
+
+        for (i = 0; i < (unsigned int)sent; i++) {
+            part += shard->outgoing_elems[first + i]->out.slices.size;
+        }
+        first += (unsigned int)sent;
+    }
+
+    for (i = 0; i < shard->outgoing.size; i++) {
+        send_queue_clear(&shard->outgoing_elems[i]->out);
+    }
+}
+
+static void clear_blocks(struct shard *shard) {
+    size_t i;
+
+    for (i = 0; i < shard->blocks.capacity; i++) {
+        if (shard->block_buckets[i].psl != SLOT_EMPTY) {
+            buffer_release(shard->block_buckets[i].value.buffer);
+            shard->block_buckets[i].psl = SLOT_EMPTY;
+        }
+    }
+
+    shard->blocks.size        = 0;
+    shard->block_entries.size = 0;
+}
+
+/* Ghosts CONNECTION on the shards in MASK, with its latest state, and
+   removes it from those it left. */
+static void set_ghosts(struct shard *shard, struct connection *connection,
+                       unsigned long mask) {
+    struct shard_message message;
+    unsigned int i;
+
+    message.connection = NULL;
+    message.state      = connection->state;
+    message.id         = connection->id;
+
+    for (i = 0; i < shard->shard_count; i++) {
+        unsigned long bit = 1ul << i;
+
+        if (mask & bit) {
+            message.type = SHARD_GHOST_UPDATE;
+            shard_post(&shard->shards[i], &message);
+        } else if (connection->ghost_mask & bit) {
+            message.type = SHARD_GHOST_REMOVE;
+            shard_post(&shard->shards[i], &message);
+        }
+    }
+
+    connection->ghost_mask = mask;
+}
+
+/* Shards other than this one owning cells in range of CELL. */
+static unsigned long get_border_shards(const struct shard *shard,
+                                       const struct interest_cell *cell) {
+    unsigned long mask = 0;
+    int i;
+
+    /* Regions are wider than the range, so checking its corners finds
+       every region it overlaps. */
+    for (i = 0; i < 4; i++) {
+        struct interest_cell corner;
+        unsigned int owner;
+
+        corner.x = cell->x + ((i & 1) ? INTEREST_RADIUS : -INTEREST_RADIUS);
+        corner.z = cell->z + ((i & 2) ? INTEREST_RADIUS : -INTEREST_RADIUS);
+
+        owner = shard_owner(&corner, shard->shard_count);
+        if (owner != shard->idx) {
+            mask |= 1ul << owner;
+        }
+    }
+
+    return mask;
+}
+
+static struct ghost *get_ghost(const struct shard *shard, unsigned int id) {
+    struct ghost *ghost = NULL;
+    int found;
+
+    MAP_GET(shard->ghost_buckets, shard->ghosts, id, ID_EQ, hash_id, ghost,
+            found);
+    (void)found;
+
+    return ghost;
+}
+
+static struct ghost *add_ghost(struct shard *shard, unsigned int id) {
+    struct ghost *ghost;
+
+    ghost = calloc(1, sizeof(struct ghost));
+    if (!ghost) {
+        printf("%s:%d Out of memory!\r\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    ghost->id              = id;
+    ghost->member.owner    = ghost;
+    ghost->member.is_ghost = TRUE;
+
+    MAP_INSERT(shard->ghost_buckets, shard->ghosts, id, ghost, ID_EQ,
+               hash_id);
+
+    return ghost;
+}
+
+/* Frees GHOST, which must be out of the grid. */
+static void free_ghost(struct shard *shard, struct ghost *ghost) {
+    unsigned int id = ghost->id;
+    int removed;
+
+    assert(!ghost->member.is_placed);
+
+    MAP_REMOVE(shard->ghost_buckets, shard->ghosts, id, ID_EQ, hash_id,
+               removed);
+    assert(removed);
+    (void)removed;
+
+    free(ghost);
+}
+
+/* Records the states of the players in the grid at this tick, the bases
+   of the blocks of later ticks. */
+static void record_histories(struct shard *shard) {
+    size_t i;
+
+    for (i = 0; i < shard->connections.live.size; i++) {
+        const struct interest_member *member =
+            &shard->connections.live_elems[i]->member;
+
+        if (member->is_placed) {
+            record_history(shard, member);
+        }
+    }
+
+    for (i = 0; i < shard->ghosts.capacity; i++) {
+        const struct ghost_bucket *bucket = &shard->ghost_buckets[i];
+
+        if (bucket->psl != SLOT_EMPTY && bucket->value->member.is_placed) {
+            record_history(shard, &bucket->value->member);
+        }
+    }
+}
+
+/* Moves MEMBER out of the grid and OTHER into its cell. */
+static void swap_member(struct shard *shard, struct interest_member *member,
+                        struct interest_member *other) {
+    struct interest_cell cell = member->cell;
+
+    if (!member->is_placed) {
+        return;
+    }
+
+    interest_remove(&shard->grid, member);
+    interest_place(&shard->grid, other, &cell);
+}
+
+static void disconnect(struct shard *shard, struct connection *connection) {
+    printf("Client disconnected (%s).\r\n", connection->ip);
+
+    /* In case the client is still there. */
+    send_control(shard, connection, DATAGRAM_CLOSE);
+
+    if (connection->member.is_placed) {
+        interest_remove(&shard->grid, &connection->member);
+    }
+    set_ghosts(shard, connection, 0);
+
+    /* Closing removes the socket from epoll. */
+    close(connection->socket);
+    connection_table_detach(&shard->connections, connection->handle);
+    connection_destroy(connection);
+}
+
+/* Passes CONNECTION to shard OWNER, which handles its latest state. Its
+   place here is taken by a ghost, so players nearby keep seeing it until
+   the new owner updates or removes the ghost. */
+static void hand_off(struct shard *shard, struct connection *connection,
+                     unsigned int owner) {
+    struct interest_member *member = &connection->member;
+    struct shard_message message;
+    struct ghost *ghost;
+
+    if (member->is_placed) {
+        ghost          = add_ghost(shard, connection->id);
+        ghost->state   = connection->state;
+        ghost->history = connection->history;
+
+        swap_member(shard, member, &ghost->member);
+
+        connection->ghost_mask |= 1ul << shard->idx;
+    }
+
+    epoll_ctl(shard->epoll, EPOLL_CTL_DEL, connection->socket, NULL);
+    connection_table_detach(&shard->connections, connection->handle);
+
+    memset(&message, 0, sizeof(message));
+    message.type       = SHARD_ADOPT;
+    message.connection = connection;
+    message.id         = connection->id;
+    shard_post(&shard->shards[owner], &message);
+}
+
+/* Handles the latest state of a local player, received this tick. */
+static void update_player(struct shard *shard,
+                          struct connection *connection) {
+    struct interest_cell cell;
+    unsigned int owner;
+
+    cell  = get_cell(&connection->state);
+    owner = shard_owner(&cell, shard->shard_count);
+
+    if (owner != shard->idx) {
+        hand_off(shard, connection, owner);
+        return;
+    }
+
+    interest_place(&shard->grid, &connection->member, &cell);
+    set_ghosts(shard, connection, get_border_shards(shard, &cell));
+}
+
+/* Handles the data datagram of SIZE bytes at SRC from the client of
+   CONNECTION: acks, the hello, and the latest state, handled with the next
+   tick. Returns FALSE if the client does not speak this protocol. */
+static int handle_data(struct shard *shard, struct connection *connection,
+                       const unsigned char *src, size_t size) {
+    unsigned char message[TRANSPORT_MESSAGE_MAX];
+    struct received_state *received;
+    struct player_state state;
+    uint16_t sequence;
+    size_t used;
+    size_t n;
+    long len;
+
+    used = transport_read(&connection->transport, src, size, &sequence);
+
+    if (used == TRANSPORT_MALFORMED) {
+        return FALSE;
+    }
+
+    /* The hello is the only reliable message clients send. */
+    while ((len = transport_receive(&connection->transport, message)) >= 0) {
+        unsigned int version;
+
+        if (connection->has_hello || len < 3 || message[0] != PACKET_HELLO) {
+            return FALSE;
+        }
+
+        version = (unsigned int)(message[1] | message[2] << 8);
+        if (version != PROTOCOL_VERSION) {
+            return FALSE;
+        }
+
+        connection_set_hello(connection);
+    }
+
+    if (used == size) {
+        transport_ack(&connection->transport, sequence);
+        return TRUE;
+    }
+
+    if (size - used < 2 || src[used] != PACKET_STATE) {
+        return FALSE;
+    }
+
+    memset(&state, 0, sizeof(state));
+
+    if (src[used + 1] > 0) {
+        const struct received_state *base;
+        uint16_t base_sequence = (uint16_t)(sequence - src[used + 1]);
+
+        base = &connection->received[base_sequence & WINDOW_MASK];
+
+        /* The base is gone, so the datagram is not acked, and the client
+           sends the next against an older one. */
+        if (src[used + 1] >= TRANSPORT_WINDOW || !base->is_used ||
+            base->sequence != base_sequence) {
+            return TRUE;
+        }
+
+        state = base->state;
+    }
+
+    n = protocol_read_state(src + used + 2, size - used - 2, &state);
+
+    if (n == 0 || n == PROTOCOL_MALFORMED) {
+        return FALSE;
+    }
+
+    /* Kept whether it is applied or not, later states may build on it. */
+    received           = &connection->received[sequence & WINDOW_MASK];
+    received->is_used  = TRUE;
+    received->sequence = sequence;
+    received->state    = state;
+
+    transport_ack(&connection->transport, sequence);
+
+    /* States sent before the hello arrived are ignored, as are those older
+       than the latest. */
+    if (!connection->has_hello ||
+        (connection->has_state &&
+         !transport_is_newer(sequence, connection->state_sequence))) {
+        return TRUE;
+    }
+
+    connection->state          = state;
+    connection->has_state      = TRUE;
+    connection->state_sequence = sequence;
+    connection->update_tick    = shard->tick;
+
+    return TRUE;
+}
+
+static void receive(struct shard *shard, struct connection *connection) {
+    unsigned char buffers[RECEIVE_BATCH][TRANSPORT_MTU];
+    struct mmsghdr messages[RECEIVE_BATCH];
+    struct iovec parts[RECEIVE_BATCH];
+    int is_lost = FALSE;
+    int count;
+    int i;
+
+    /* Edge triggered, so read until the socket is drained. */
+    while (!is_lost) {
+        memset(messages, 0, sizeof(messages));
+
+        for (i = 0; i < RECEIVE_BATCH; i++) {
+            parts[i].iov_base = buffers[i];
+            parts[i].iov_len  = TRANSPORT_MTU;
+
+            messages[i].msg_hdr.msg_iov    = &parts[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        count = recvmmsg(connection->socket, messages, RECEIVE_BATCH, 0, NULL);
+
+        if (count == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            /* Refused when the client's port is closed. */
+            if (errno != EINTR) {
+                is_lost = TRUE;
+            }
+            continue;
+        }
+
+        connection->idle_ticks = 0;
+
+        for (i = 0; i < count && !is_lost; i++) {
+            const unsigned char *datagram = buffers[i];
+            size_t size                   = messages[i].msg_len;
+
+            if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                continue;
+            }
+
+            switch (transport_type(datagram, size)) {
+                case DATAGRAM_CONNECT:
+                    /* The accept was lost. */
+                    send_control(shard, connection, DATAGRAM_ACCEPT);
+                    break;
+
+                case DATAGRAM_DATA:
+                    if (!handle_data(shard, connection, datagram, size)) {
+                        printf("Client does not speak protocol version %d "
+                               "(%s).\r\n",
+                               PROTOCOL_VERSION, connection->ip);
+                        is_lost = TRUE;
+                    }
+                    break;
+
+                case DATAGRAM_CLOSE:
+                    is_lost = TRUE;
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+
+    if (is_lost) {
+        disconnect(shard, connection);
+    }
+}
+
+static void adopt(struct shard *shard, struct connection *connection) {
+    struct ghost *ghost;
+
+    if (!connection_table_attach(&shard->connections, connection)) {
+        printf("Shard full. Disconnecting client.\r\n");
+        send_control(shard, connection, DATAGRAM_CLOSE);
+        set_ghosts(shard, connection, 0);
+        close(connection->socket);
+        connection_destroy(connection);
+        return;
+    }
+
+    /* A player crossing over replaces its ghost here, and takes its
+       history in the ticks of this shard. */
+    ghost = get_ghost(shard, connection->id);
+    if (ghost) {
+        swap_member(shard, &ghost->member, &connection->member);
+        connection->history = ghost->history;
+        free_ghost(shard, ghost);
+    } else {
+        memset(&connection->history, 0, sizeof(connection->history));
+    }
+    connection->ghost_mask &= ~(1ul << shard->idx);
+
+    /* Its latest state is handled with the next tick here. */
+    if (connection->has_state) {
+        connection->update_tick = shard->tick;
+    }
+
+    /* Registering reports datagrams that arrived meanwhile. */
+    watch(shard, connection->socket, EPOLLIN | EPOLLET, connection->handle);
+}
+
+static void update_ghost(struct shard *shard,
+                         const struct shard_message *message) {
+    struct interest_cell cell;
+    struct ghost *ghost;
+
+    ghost = get_ghost(shard, message->id);
+    if (!ghost) {
+        ghost = add_ghost(shard, message->id);
+    }
+
+    ghost->state = message->state;
+
+    cell = get_cell(&ghost->state);
+    interest_place(&shard->grid, &ghost->member, &cell);
+}
+
+static void remove_ghost(struct shard *shard, unsigned int id) {
+    struct ghost *ghost = get_ghost(shard, id);
+
+    if (ghost) {
+        if (ghost->member.is_placed) {
+            interest_remove(&shard->grid, &ghost->member);
+        }
+        free_ghost(shard, ghost);
+    }
+}
+
+static void drain_inbox(struct shard *shard) {
+    struct shard_message *elems;
+    struct array inbox;
+    uint64_t count;
+    size_t i;
+
+    if (read(shard->event, &count, sizeof(count)) != sizeof(count)) {
+        return;
+    }
+
+    /* Swap in the empty scratch array, so posting is not blocked while
+       the messages are handled. */
+    pthread_mutex_lock(&shard->mutex);
+
+    inbox = shard->inbox;
+    elems = shard->inbox_elems;
+
+    shard->inbox       = shard->messages;
+    shard->inbox_elems = shard->message_elems;
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    for (i = 0; i < inbox.size; i++) {
+        const struct shard_message *message = &elems[i];
+
+        switch (message->type) {
+            case SHARD_ADOPT:
+                adopt(shard, message->connection);
+                break;
+
+            case SHARD_GHOST_UPDATE:
+                update_ghost(shard, message);
+                break;
+
+            case SHARD_GHOST_REMOVE:
+                remove_ghost(shard, message->id);
+                break;
+        }
+    }
+
+    inbox.size           = 0;
+    shard->messages      = inbox;
+    shard->message_elems = elems;
+}
+
+/* Updates the players that sent a state since the last tick, then sends
+   each client one datagram, however often players send. Ghosts were
+   updated as their messages came. */
+static void tick(struct shard *shard, unsigned long ticks) {
+    size_t i;
+
+    shard->time += ticks;
+
+    /* Backwards, as handoffs move the last connection. */
+    for (i = shard->connections.live.size; i-- > 0;) {
+        struct connection *connection = shard->connections.live_elems[i];
+
+        if (connection->update_tick == shard->tick) {
+            update_player(shard, connection);
+        }
+    }
+
+    record_histories(shard);
+
+    shard->outgoing.size = 0;
+
+    /* Nothing goes to clients before their hello, so a connection is no
+       use to amplify traffic until its client proved to speak. */
+    for (i = 0; i < shard->connections.live.size; i++) {
+        if (shard->connections.live_elems[i]->has_hello) {
+            write_datagram(shard, shard->connections.live_elems[i]);
+        }
+    }
+
+    send_datagrams(shard);
+
+    clear_blocks(shard);
+    shard->tick++;
+
+    /* Backwards, as removal moves the last connection. */
+    for (i = shard->connections.live.size; i-- > 0;) {
+        struct connection *connection = shard->connections.live_elems[i];
+
+        connection->idle_ticks += ticks;
+        if (!connection->has_hello) {
+            connection->hello_ticks += ticks;
+        }
+
+        if (connection->idle_ticks > TIMEOUT_TICKS ||
+            connection->hello_ticks > HELLO_TIMEOUT_TICKS) {
+            printf("Client timed out (%s).\r\n", connection->ip);
+            disconnect(shard, connection);
+        }
+    }
+}
+
+static void *run(void *context) {
+    struct shard *shard;
+
+    assert(context);
+
+    shard = (struct shard *)context;
+
+    while (TRUE) {
+        struct epoll_event events[EVENTS_MAX];
+        int count;
+        int i;
+
+        count = epoll_wait(shard->epoll, events, EVENTS_MAX, -1);
+
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            printf("Epoll error.\r\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for (i = 0; i < count; i++) {
+            unsigned int data = (unsigned int)events[i].data.u64;
+            struct connection *connection;
+
+            if (data == EVENT_TIMER) {
+                uint64_t expirations;
+
+                if (read(shard->timer, &expirations, sizeof(expirations)) ==
+                    sizeof(expirations)) {
+                    tick(shard, (unsigned long)expirations);
+                }
+                continue;
+            }
+
+            if (data == EVENT_INBOX) {
+                drain_inbox(shard);
+                continue;
+            }
+
+            connection = connection_table_get(&shard->connections, data);
+            if (connection) {
+                receive(shard, connection);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+void shard_init(struct shard *shard, unsigned int idx, struct shard *shards,
+                unsigned int shard_count, int socket) {
+    struct itimerspec interval;
+
+    assert(shard);
+    assert(shards);
+    assert(idx < shard_count && shard_count <= SHARDS_MAX);
+
+    shard->idx         = idx;
+    shard->shards      = shards;
+    shard->shard_count = shard_count;
+    shard->socket      = socket;
+
+    /* Update ticks of zeroed players, and ticks of zeroed histories, are
+       never current. */
+    shard->tick = 1;
+    shard->time = 0;
+
+    pthread_mutex_init(&shard->mutex, NULL);
+
+    shard->inbox.size     = 0;
+    shard->inbox.capacity = 0;
+    shard->inbox_elems    = NULL;
+
+    shard->messages.size     = 0;
+    shard->messages.capacity = 0;
+    shard->message_elems     = NULL;
+
+    shard->nearby.size     = 0;
+    shard->nearby.capacity = 0;
+    shard->nearby_elems    = NULL;
+
+    shard->visible.size     = 0;
+    shard->visible.capacity = 0;
+    shard->visible_elems    = NULL;
+
+    shard->packet.size     = 0;
+    shard->packet.capacity = 0;
+    shard->packet_elems    = NULL;
+
+    shard->parts.size     = 0;
+    shard->parts.capacity = 0;
+    shard->part_elems     = NULL;
+
+    shard->ghosts.size     = 0;
+    shard->ghosts.capacity = 0;
+    shard->ghost_buckets   = NULL;
+
+    shard->blocks.size     = 0;
+    shard->blocks.capacity = 0;
+    shard->block_buckets   = NULL;
+
+    shard->block_data.size     = 0;
+    shard->block_data.capacity = 0;
+    shard->block_data_elems    = NULL;
+
+    shard->block_entries.size     = 0;
+    shard->block_entries.capacity = 0;
+    shard->block_entry_elems      = NULL;
+
+    shard->outgoing.size     = 0;
+    shard->outgoing.capacity = 0;
+    shard->outgoing_elems    = NULL;
+
+    shard->slices.size     = 0;
+    shard->slices.capacity = 0;
+    shard->slice_elems     = NULL;
+
+    connection_table_init(&shard->connections);
+    interest_init(&shard->grid);
+
+    /* Event loop, tick timer and inbox signal. */
+
+    shard->epoll = epoll_create1(0);
+    shard->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    shard->event = eventfd(0, EFD_NONBLOCK);
+
+    if (shard->epoll == -1 || shard->timer == -1 || shard->event == -1) {
+        printf("Failed to create shard event loop.\r\n");
+        exit(EXIT_FAILURE);
+    }
+
+    interval.it_interval.tv_sec  = 0;
+    interval.it_interval.tv_nsec = 1000000000 / TICK_RATE;
+    interval.it_value            = interval.it_interval;
+
+    timerfd_settime(shard->timer, 0, &interval, NULL);
+
+    watch(shard, shard->timer, EPOLLIN | EPOLLET, EVENT_TIMER);
+    watch(shard, shard->event, EPOLLIN | EPOLLET, EVENT_INBOX);
+}
+
+void shard_start(struct shard *shard) {
+    assert(shard);
+
+    if (pthread_create(&shard->thread, NULL, run, shard) != 0) {
+        printf("Failed to start shard thread.\r\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void shard_post(struct shard *shard, const struct shard_message *message) {
+    uint64_t one = 1;
+
+    assert(shard);
+    assert(message);
+
+    pthread_mutex_lock(&shard->mutex);
+    ARRAY_APPEND(shard->inbox, shard->inbox_elems, *message);
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (write(shard->event, &one, sizeof(one)) != sizeof(one)) {
+        /* Only fails when the counter is saturated, still signaled. */
+    }
+}
@@ -0,0 +1,163 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "array.h"
+#include "map.h"
+#include "protocol.h"
+#include "server/connection.h"
+#include "server/interest.h"
+
+/* Ghost masks have a bit per shard. */
+#define SHARDS_MAX 32
+
+/* The world is split into square regions this many interest cells wide,
+   each owned by one shard. At least 2 * INTEREST_RADIUS + 1, so the range
+   of a cell spans at most four regions. */
+#define SHARD_REGION_CELLS 8
+
+enum shard_message_type {
+    SHARD_ADOPT,        /* Take over CONNECTION, new or handed off. */
+    SHARD_GHOST_UPDATE, /* STATE of a player near this shard's regions. */
+    SHARD_GHOST_REMOVE  /* Player ID is no longer near. */
+};
+
+struct shard_message {
+    enum shard_message_type type;
+    struct connection *connection;
+    struct player_state state;
+    unsigned int id;
+};
+
+/* Copy of a player owned by another shard, kept in the grid so players
+   near region borders see each other. */
+struct ghost {
+    unsigned int id;
+    struct player_state state;
+    struct player_history history;
+    struct interest_member member;
+};
+
+struct ghost_bucket {
+    unsigned int key;
+    struct ghost *value;
+    size_t psl;
+};
+
+/* A cell, and a past tick of the shard. */
+struct block_key {
+    struct interest_cell cell;
+    unsigned long tick;
+};
+
+/* Update of player ID, SIZE bytes at OFFSET in the buffer of its block. */
+struct block_entry {
+    unsigned int id;
+    size_t offset;
+    size_t size;
+};
+
+/* Updates of the players in a cell, deltas against their states at the
+   tick of the key, encoded once into a buffer queued by reference to all
+   clients whose snapshot bases hold those states. Players in the cell are
+   sent the rest of the block around their own update. */
+struct block {
+    struct buffer *buffer;
+    size_t entry_idx; /* In the shard's block entries. */
+    uint32_t count;
+};
+
+struct block_bucket {
+    struct block_key key;
+    struct block value;
+    size_t psl;
+};
+
+/* Worker thread owning the players in its regions, with its own event
+   loop. Shards share nothing but their inboxes and the listening
+   socket. */
+struct shard {
+    unsigned int idx;
+    struct shard *shards;
+    unsigned int shard_count;
+
+    pthread_t thread;
+
+    int epoll;
+    int timer;
+
+    /* Signaled after posting to the inbox. */
+    int event;
+
+    pthread_mutex_t mutex;
+    struct array inbox;
+    struct shard_message *inbox_elems;
+
+    /* Listening socket, shared by all shards to send datagrams. Sends
+       never wait on it, datagrams it has no room for are dropped. */
+    int socket;
+
+    /* Shard thread only. */
+
+    struct connection_table connections;
+    struct interest_grid grid;
+
+    /* Number of the next tick. Players updated since the last one carry it
+       as their update tick. */
+    unsigned long tick;
+
+    /* Timer periods since the shard started, counting ticks that ran late
+       together, so it follows the clock. Snapshots are stamped with it. */
+    unsigned long time;
+
+    struct map ghosts;
+    struct ghost_bucket *ghost_buckets;
+
+    /* Blocks built as snapshots need them. The map holds a reference to
+       each buffer until it is cleared after the tick. */
+    struct map blocks;
+    struct block_bucket *block_buckets;
+    struct array block_entries;
+    struct block_entry *block_entry_elems;
+
+    /* Connections with a datagram queued this tick, sent together after
+       the snapshots. */
+    struct array outgoing;
+    struct connection **outgoing_elems;
+
+    /* Scratch arrays. */
+    struct array messages;
+    struct shard_message *message_elems;
+    struct array nearby;
+    struct interest_member **nearby_elems;
+    struct array visible;
+    unsigned int *visible_elems;
+    struct array packet;
+    unsigned char *packet_elems;
+    struct array block_data;
+    unsigned char *block_data_elems;
+    struct array slices;
+    struct buffer_slice *slice_elems;
+    struct array parts;
+    struct iovec *part_elems;
+};
+
+/* Index of the shard owning CELL. */
+unsigned int shard_owner(const struct interest_cell *cell,
+                         unsigned int shard_count);
+
+/* SHARDS is the array of all SHARD_COUNT shards, SHARD at IDX. SOCKET is
+   the listening socket. */
+void shard_init(struct shard *shard, unsigned int idx, struct shard *shards,
+                unsigned int shard_count, int socket);
+void shard_start(struct shard *shard);
+
+/* Thread-safe. */
+void shard_post(struct shard *shard, const struct shard_message *message);
+
+#endif
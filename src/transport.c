@@ -0,0 +1,334 @@
+#include "transport.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include "macros.h"
+
+#define WINDOW_MASK (TRANSPORT_WINDOW - 1)
+
+static void put_u16(unsigned char *dst, uint16_t value) {
+    dst[0] = (unsigned char)(value & 0xFF);
+    dst[1] = (unsigned char)(value >> 8);
+}
+
+static uint16_t get_u16(const unsigned char *src) {
+    return (uint16_t)(src[0] | src[1] << 8);
+}
+
+static void put_u32(unsigned char *dst, uint32_t value) {
+    put_u16(dst, (uint16_t)(value & 0xFFFF));
+    put_u16(dst + 2, (uint16_t)(value >> 16));
+}
+
+static uint32_t get_u32(const unsigned char *src) {
+    return (uint32_t)get_u16(src) | (uint32_t)get_u16(src + 2) << 16;
+}
+
+static void put_u64(unsigned char *dst, uint64_t value) {
+    put_u32(dst, (uint32_t)(value & 0xFFFFFFFFUL));
+    put_u32(dst + 4, (uint32_t)(value >> 32));
+}
+
+static uint64_t get_u64(const unsigned char *src) {
+    return (uint64_t)get_u32(src) | (uint64_t)get_u32(src + 4) << 32;
+}
+
+void transport_init(struct transport *transport) {
+    assert(transport);
+
+    memset(transport, 0, sizeof(*transport));
+
+    /* Nothing received, and no datagram sent has this sequence until it
+       wraps. */
+    transport->ack = 0xFFFF;
+}
+
+void transport_free(struct transport *transport) {
+    assert(transport);
+
+    free(transport->outgoing_elems);
+    transport->outgoing_elems = NULL;
+}
+
+int transport_is_newer(uint16_t a, uint16_t b) {
+    return a != b && (uint16_t)(a - b) < 0x8000;
+}
+
+int transport_type(const unsigned char *src, size_t size) {
+    int type;
+
+    assert(src || size == 0);
+
+    if (size < 5 || get_u32(src) != TRANSPORT_MAGIC) {
+        return -1;
+    }
+
+    type = src[4];
+
+    if (type > DATAGRAM_CHALLENGE ||
+        (type == DATAGRAM_CONNECT && size < TRANSPORT_CONNECT_SIZE) ||
+        (type == DATAGRAM_CHALLENGE && size < 5 + 8)) {
+        return -1;
+    }
+
+    return type;
+}
+
+size_t transport_write_control(unsigned char *dst, int type,
+                               uint64_t cookie) {
+    assert(dst);
+    assert(type != DATAGRAM_DATA);
+
+    put_u32(dst, TRANSPORT_MAGIC);
+    dst[4] = (unsigned char)type;
+
+    if (type == DATAGRAM_CONNECT) {
+        put_u64(dst + 5, cookie);
+        memset(dst + 5 + 8, 0, TRANSPORT_CONNECT_SIZE - 5 - 8);
+        return TRANSPORT_CONNECT_SIZE;
+    }
+
+    if (type == DATAGRAM_CHALLENGE) {
+        put_u64(dst + 5, cookie);
+        return 5 + 8;
+    }
+
+    return 5;
+}
+
+uint64_t transport_cookie(const unsigned char *src) {
+    assert(src);
+    assert(src[4] == DATAGRAM_CONNECT || src[4] == DATAGRAM_CHALLENGE);
+
+    return get_u64(src + 5);
+}
+
+void transport_send(struct transport *transport, const void *data,
+                    size_t size) {
+    struct transport_message message;
+
+    assert(transport);
+    assert(data || size == 0);
+    assert(size <= TRANSPORT_MESSAGE_MAX);
+
+    message.id        = transport->send_id++;
+    message.size      = (uint16_t)size;
+    message.sent_time = -1.0;
+    memcpy(message.data, data, size);
+
+    ARRAY_APPEND(transport->outgoing, transport->outgoing_elems, message);
+}
+
+size_t transport_write(struct transport *transport, unsigned char *dst,
+                       double now, uint16_t *sequence) {
+    struct transport_sent *sent;
+    unsigned char count = 0;
+    size_t size         = TRANSPORT_HEADER_SIZE;
+    size_t bytes        = 0;
+    size_t i;
+
+    assert(transport);
+    assert(dst);
+    assert(sequence);
+
+    *sequence = transport->sequence++;
+
+    sent                = &transport->sent[*sequence & WINDOW_MASK];
+    sent->sequence      = *sequence;
+    sent->is_used       = TRUE;
+    sent->is_acked      = FALSE;
+    sent->message_count = 0;
+
+    put_u32(dst, TRANSPORT_MAGIC);
+    dst[4] = DATAGRAM_DATA;
+    put_u16(dst + 5, *sequence);
+    put_u16(dst + 7, transport->ack);
+    put_u32(dst + 9, transport->ack_bits);
+
+    for (i = 0; i < transport->outgoing.size; i++) {
+        struct transport_message *message = &transport->outgoing_elems[i];
+
+        /* The peer keeps a window of messages past the one it waits
+           for, which is at most the oldest not acked. */
+        if ((uint16_t)(message->id - transport->outgoing_elems[0].id) >=
+            TRANSPORT_WINDOW) {
+            break;
+        }
+
+        if (message->sent_time >= 0.0 &&
+            now - message->sent_time < TRANSPORT_RESEND_TIME) {
+            continue;
+        }
+
+        if (count == TRANSPORT_MESSAGES_MAX ||
+            bytes + 4 + message->size > TRANSPORT_RELIABLE_MAX) {
+            break;
+        }
+
+        put_u16(dst + size, message->id);
+        put_u16(dst + size + 2, message->size);
+        memcpy(dst + size + 4, message->data, message->size);
+
+        size += 4u + message->size;
+        bytes += 4u + message->size;
+
+        message->sent_time = now;
+        sent->message_ids[count++] = message->id;
+    }
+
+    dst[TRANSPORT_HEADER_SIZE - 1] = count;
+    sent->message_count            = count;
+
+    return size;
+}
+
+/* Marks datagram SEQUENCE acked, and forgets the messages it carried. */
+static void apply_ack(struct transport *transport, uint16_t sequence) {
+    struct transport_sent *sent = &transport->sent[sequence & WINDOW_MASK];
+    size_t i;
+    size_t j;
+
+    if (!sent->is_used || sent->sequence != sequence || sent->is_acked) {
+        return;
+    }
+
+    sent->is_acked = TRUE;
+
+    for (i = 0; i < sent->message_count; i++) {
+        for (j = 0; j < transport->outgoing.size; j++) {
+            if (transport->outgoing_elems[j].id == sent->message_ids[i]) {
+                ARRAY_REMOVE(transport->outgoing, transport->outgoing_elems,
+                             j);
+                break;
+            }
+        }
+    }
+}
+
+size_t transport_read(struct transport *transport, const unsigned char *src,
+                      size_t size, uint16_t *sequence) {
+    uint16_t ack;
+    uint32_t ack_bits;
+    size_t used = TRANSPORT_HEADER_SIZE;
+    unsigned int count;
+    unsigned int i;
+
+    assert(transport);
+    assert(src || size == 0);
+    assert(sequence);
+
+    if (size < TRANSPORT_HEADER_SIZE ||
+        transport_type(src, size) != DATAGRAM_DATA) {
+        return TRANSPORT_MALFORMED;
+    }
+
+    *sequence = get_u16(src + 5);
+    ack       = get_u16(src + 7);
+    ack_bits  = get_u32(src + 9);
+    count     = src[TRANSPORT_HEADER_SIZE - 1];
+
+    apply_ack(transport, ack);
+    for (i = 0; i < TRANSPORT_WINDOW; i++) {
+        if (ack_bits >> i & 1) {
+            apply_ack(transport, (uint16_t)(ack - 1 - i));
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        struct transport_slot *slot;
+        uint16_t id;
+        uint16_t message_size;
+
+        if (size - used < 4) {
+            return TRANSPORT_MALFORMED;
+        }
+
+        id           = get_u16(src + used);
+        message_size = get_u16(src + used + 2);
+        used += 4;
+
+        if (message_size > TRANSPORT_MESSAGE_MAX ||
+            size - used < message_size) {
+            return TRANSPORT_MALFORMED;
+        }
+
+        /* Resends of messages delivered already, or past the window, are
+           dropped. */
+        slot = &transport->incoming[id & WINDOW_MASK];
+        if (!transport_is_newer(transport->receive_id, id) &&
+            (uint16_t)(id - transport->receive_id) < TRANSPORT_WINDOW &&
+            !slot->is_used) {
+            slot->is_used = TRUE;
+            slot->size    = message_size;
+            memcpy(slot->data, src + used, message_size);
+        }
+
+        used += message_size;
+    }
+
+    return used;
+}
+
+void transport_ack(struct transport *transport, uint16_t sequence) {
+    uint16_t distance;
+
+    assert(transport);
+
+    if (!transport->has_ack) {
+        transport->ack      = sequence;
+        transport->ack_bits = 0;
+        transport->has_ack  = TRUE;
+        return;
+    }
+
+    if (transport_is_newer(sequence, transport->ack)) {
+        distance = (uint16_t)(sequence - transport->ack);
+
+        if (distance < 32) {
+            transport->ack_bits = transport->ack_bits << distance |
+                                  (uint32_t)1 << (distance - 1);
+        } else if (distance == 32) {
+            transport->ack_bits = (uint32_t)1 << 31;
+        } else {
+            transport->ack_bits = 0;
+        }
+
+        transport->ack = sequence;
+    } else {
+        distance = (uint16_t)(transport->ack - sequence);
+
+        if (distance >= 1 && distance <= 32) {
+            transport->ack_bits |= (uint32_t)1 << (distance - 1);
+        }
+    }
+}
+
+int transport_is_acked(const struct transport *transport, uint16_t sequence) {
+    const struct transport_sent *sent;
+
+    assert(transport);
+
+    sent = &transport->sent[sequence & WINDOW_MASK];
+
+    return sent->is_used && sent->sequence == sequence && sent->is_acked;
+}
+
+long transport_receive(struct transport *transport, void *dst) {
+    struct transport_slot *slot;
+
+    assert(transport);
+    assert(dst);
+
+    slot = &transport->incoming[transport->receive_id & WINDOW_MASK];
+
+    if (!slot->is_used) {
+        return -1;
+    }
+
+    memcpy(dst, slot->data, slot->size);
+    slot->is_used = FALSE;
+    transport->receive_id++;
+
+    return slot->size;
+}
@@ -0,0 +1,170 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "array.h"
+
+/* Connections over UDP. Clients send DATAGRAM_CONNECT until the server
+   answers DATAGRAM_ACCEPT, then both sides exchange sequenced
+   DATAGRAM_DATA that ack each other, carrying two channels:
+
+       reliable-ordered      messages resent until the datagram carrying
+                             them is acked, delivered once and in order
+       unreliable-sequenced  the rest of each datagram, for state where only
+                             the newest counts, so a lost datagram never
+                             holds up the ones after it
+
+   Layout, integers little-endian:
+
+       u32 TRANSPORT_MAGIC, u8 type, then by type
+
+       DATAGRAM_CONNECT    u64 cookie, 0 until challenged, then zero
+                           padding to TRANSPORT_CONNECT_SIZE, so that
+                           spoofed connects do not draw larger replies
+       DATAGRAM_ACCEPT     nothing
+       DATAGRAM_DATA       u16 sequence, u16 ack, u32 ack bits, u8
+                           message count, each message as u16 id, u16 size
+                           and bytes, then the unreliable payload
+       DATAGRAM_CLOSE      nothing, the peer dropped the connection
+       DATAGRAM_CHALLENGE  u64 cookie, for the client to echo in its next
+                           connects
+
+   Servers answer connects without a valid cookie with a challenge, and
+   keep no state for them, so a connect from a spoofed address goes no
+   further than the challenge sent there.
+
+   Ack is the newest datagram received, and bit N of the ack bits is set
+   if datagram ack - 1 - N was received too, so each ack is repeated in the
+   next 32 datagrams. */
+#define TRANSPORT_MAGIC 0x32504D43UL /* "CMP2". */
+
+#define DATAGRAM_CONNECT   0
+#define DATAGRAM_ACCEPT    1
+#define DATAGRAM_DATA      2
+#define DATAGRAM_CLOSE     3
+#define DATAGRAM_CHALLENGE 4
+
+/* Largest datagram sent, below common path MTUs. */
+#define TRANSPORT_MTU 1200
+
+#define TRANSPORT_CONNECT_SIZE 64
+
+/* Header of data datagrams without messages. */
+#define TRANSPORT_HEADER_SIZE (4 + 1 + 2 + 2 + 4 + 1)
+
+/* Datagrams whose acks are tracked, and reliable messages in flight. A
+   power of two, the width of the ack bits. */
+#define TRANSPORT_WINDOW 32
+
+#define TRANSPORT_MESSAGE_MAX 256
+
+/* Reliable messages per datagram, and bytes they may take. */
+#define TRANSPORT_MESSAGES_MAX 8
+#define TRANSPORT_RELIABLE_MAX 512
+
+/* Unacked messages are resent after this many seconds. */
+#define TRANSPORT_RESEND_TIME 0.1
+
+/* Returned by transport_read for datagrams that are not valid. */
+#define TRANSPORT_MALFORMED ((size_t)-1)
+
+struct transport_message {
+    uint16_t id;
+    uint16_t size;
+    double sent_time; /* Negative until first sent. */
+    unsigned char data[TRANSPORT_MESSAGE_MAX];
+};
+
+/* Sent datagram, kept at its sequence modulo the window. */
+struct transport_sent {
+    uint16_t sequence;
+    int is_used;
+    int is_acked;
+    unsigned char message_count;
+    uint16_t message_ids[TRANSPORT_MESSAGES_MAX];
+};
+
+/* Received message waiting for those before it, kept at its id modulo the
+   window. */
+struct transport_slot {
+    int is_used;
+    uint16_t size;
+    unsigned char data[TRANSPORT_MESSAGE_MAX];
+};
+
+/* One side of a connection. */
+struct transport {
+    uint16_t sequence; /* Of the next datagram sent. */
+    struct transport_sent sent[TRANSPORT_WINDOW];
+
+    /* Datagrams received. */
+    uint16_t ack;
+    uint32_t ack_bits;
+    int has_ack;
+
+    /* Reliable messages sent and not acked, by id. */
+    uint16_t send_id;
+    struct array outgoing;
+    struct transport_message *outgoing_elems;
+
+    /* Id of the next reliable message delivered. */
+    uint16_t receive_id;
+    struct transport_slot incoming[TRANSPORT_WINDOW];
+};
+
+void transport_init(struct transport *transport);
+void transport_free(struct transport *transport);
+
+/* TRUE if sequence or id A comes after B, across wrapping. */
+int transport_is_newer(uint16_t a, uint16_t b);
+
+/* Type of the SIZE bytes at SRC, or -1 if they are not a datagram of this
+   transport. */
+int transport_type(const unsigned char *src, size_t size);
+
+/* Writes a datagram of TYPE other than DATAGRAM_DATA to DST, which must
+   hold TRANSPORT_CONNECT_SIZE bytes. COOKIE goes in connects and
+   challenges, and is ignored otherwise. Returns its size. */
+size_t transport_write_control(unsigned char *dst, int type,
+                               uint64_t cookie);
+
+/* Cookie of the connect or challenge at SRC, whose type transport_type
+   returned. */
+uint64_t transport_cookie(const unsigned char *src);
+
+/* Queues SIZE bytes, at most TRANSPORT_MESSAGE_MAX, on the reliable
+   channel. */
+void transport_send(struct transport *transport, const void *data,
+                    size_t size);
+
+/* Writes the start of the next data datagram to DST, which must hold
+   TRANSPORT_MTU bytes: the header, acks, and the reliable messages due at
+   time NOW, in seconds. The caller appends the unreliable payload, up to
+   TRANSPORT_MTU bytes in all. Returns the size written, and the sequence
+   of the datagram in SEQUENCE. */
+size_t transport_write(struct transport *transport, unsigned char *dst,
+                       double now, uint16_t *sequence);
+
+/* Reads the data datagram of SIZE bytes at SRC: applies the acks of
+   datagrams sent, and keeps the reliable messages for transport_receive.
+   Returns the offset of the unreliable payload and the sequence of the
+   datagram in SEQUENCE, or TRANSPORT_MALFORMED. The datagram is acked only
+   after transport_ack. */
+size_t transport_read(struct transport *transport, const unsigned char *src,
+                      size_t size, uint16_t *sequence);
+
+/* Acks datagram SEQUENCE in the datagrams sent from now on. */
+void transport_ack(struct transport *transport, uint16_t sequence);
+
+/* TRUE if the peer acked datagram SEQUENCE, one of the last
+   TRANSPORT_WINDOW sent. */
+int transport_is_acked(const struct transport *transport, uint16_t sequence);
+
+/* Copies the next reliable message in order to DST, which must hold
+   TRANSPORT_MESSAGE_MAX bytes. Returns its size, or -1 if it has not
+   arrived. */
+long transport_receive(struct transport *transport, void *dst);
+
+#endif